@@ -148,7 +148,7 @@
 		assert($spb != 0);
 		assert($spb < 256);
 		assert($spb > -255);
-		return chr($spb >= 1 ? $spb : $spb + 128);
+		return chr($spb >= 1 ? $spb : 128 - $spb);
 	}
 
 	function parse_color($color) {
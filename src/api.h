@@ -42,6 +42,7 @@
 #define NO_RESPONSE 0
 
 #define DMX_PACKET_SIZE 512
+#define DMX_MIN_PACKET_SIZE 24
 
 #define RX_BUFFER_SIZE 40960
 #define TX_BUFFER_SIZE 40960
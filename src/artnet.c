@@ -0,0 +1,106 @@
+#define _POSIX_C_SOURCE 200112L
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "schaeckeling.h"
+#include "netout.h"
+#include "artnet.h"
+
+#define ARTNET_OP_DMX	0x5000
+#define ARTNET_OP_SYNC	0x5200
+#define ARTNET_VERSION	14
+
+/*
+ * Art-Net 4 packets: "Art-Net", the opcode (little endian) and the protocol
+ * version (big endian), then the fields of the opcode.
+ */
+static void
+artnet_header(unsigned char *p, int opcode) {
+	memcpy(p, "Art-Net", 8);
+	p[8] = opcode & 0xFF;
+	p[9] = opcode >> 8;
+	p[10] = 0;
+	p[11] = ARTNET_VERSION;
+}
+
+/*
+ * Send the output as an ArtDmx packet, spec is port-address@host[:port]
+ * with a 15 bit port-address (net, sub-net and universe). Returns 0 for an
+ * invalid spec.
+ */
+int
+artnet_add_output(const char *spec) {
+	char *end;
+	long universe = strtol(spec, &end, 0);
+	if(end == spec || *end != '@' || universe < 0 || universe > 0x7FFF) {
+		fprintf(stderr, "artnet: expected port-address@host, not %s\n", spec);
+		return 0;
+	}
+	struct netout_packet *p = netout_add(NETOUT_ARTDMX, end + 1, ARTNET_PORT);
+	if(p == NULL) {
+		return 0;
+	}
+	artnet_header(p->data, ARTNET_OP_DMX);
+	p->data[12] = 0;		// sequence
+	p->data[13] = 0;		// physical port
+	p->data[14] = universe & 0xFF;	// SubUni
+	p->data[15] = universe >> 8;	// Net
+	return 1;
+}
+
+/*
+ * Follow every frame with an ArtSync, so nodes that got it all latch their
+ * outputs at the same time. Must be added after the outputs.
+ */
+int
+artnet_add_sync(const char *host) {
+	struct netout_packet *p = netout_add(NETOUT_ARTSYNC, host, ARTNET_PORT);
+	if(p == NULL) {
+		return 0;
+	}
+	artnet_header(p->data, ARTNET_OP_SYNC);
+	p->data[12] = 0;	// Aux1
+	p->data[13] = 0;	// Aux2
+	p->len = 14;
+	return 1;
+}
+
+void
+artnet_fill_dmx(struct netout_packet *p, const unsigned char *frame, int channels) {
+	// an even length of at least 2
+	int len = (channels + 1) & ~1;
+	if(len < 2) {
+		len = 2;
+	}
+	// 1 to 255, 0 would switch reordering off
+	if(++p->sequence == 0) {
+		p->sequence = 1;
+	}
+	p->data[12] = p->sequence;
+	p->data[16] = len >> 8;
+	p->data[17] = len & 0xFF;
+	memcpy(p->data + ARTNET_HEADER, frame, channels);
+	memset(p->data + ARTNET_HEADER + channels, 0, len - channels);
+	p->len = ARTNET_HEADER + len;
+}
+
+/*
+ * Check a received packet for ArtDmx. Returns the number of channels, or -1
+ * for anything else; the values are left in the packet.
+ */
+int
+artnet_parse_dmx(const unsigned char *p, size_t len, int *universe, int *sequence, const unsigned char **values) {
+	int channels;
+	if(len < ARTNET_HEADER || memcmp(p, "Art-Net", 8) != 0 || (p[8] | p[9] << 8) != ARTNET_OP_DMX) {
+		return -1;
+	}
+	channels = p[16] << 8 | p[17];
+	if(channels > DMX_CHANNELS || ARTNET_HEADER + channels > len) {
+		return -1;
+	}
+	*sequence = p[12];
+	*universe = (p[14] | p[15] << 8) & 0x7FFF;
+	*values = p + ARTNET_HEADER;
+	return channels;
+}
@@ -0,0 +1,16 @@
+#ifndef ARTNET_H
+#define ARTNET_H
+
+#define ARTNET_PORT		6454
+#define ARTNET_HEADER		18	// of an ArtDmx packet
+
+#include <stddef.h>
+
+struct netout_packet;
+
+int artnet_add_output(const char *spec);
+int artnet_add_sync(const char *host);
+void artnet_fill_dmx(struct netout_packet *p, const unsigned char *frame, int channels);
+int artnet_parse_dmx(const unsigned char *p, size_t len, int *universe, int *sequence, const unsigned char **values);
+
+#endif
@@ -0,0 +1,161 @@
+#define _POSIX_C_SOURCE 200112L
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <err.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include "audio.h"
+
+static int
+read_fully(int fd, unsigned char *buf, int len) {
+	int done = 0, ret;
+	while(len > done) {
+		ret = read(fd, buf + done, len - done);
+		if(ret == -1 && errno == EINTR) {
+			continue;
+		} else if(ret <= 0) {
+			return done;
+		}
+		done += ret;
+	}
+	return done;
+}
+
+static unsigned long
+le(const unsigned char *buf, int bytes) {
+	unsigned long v = 0;
+	while(bytes-- > 0) {
+		v = v << 8 | buf[bytes];
+	}
+	return v;
+}
+
+/*
+ * Walk the RIFF chunks up to the sample data.
+ */
+static int
+read_wav_header(struct audio_source *a) {
+	unsigned char chunk[8], fmt[16], skip[256];
+	unsigned long size;
+	int bits = 0;
+	while(1) {
+		if(read_fully(a->fd, chunk, 8) != 8) {
+			return -1;
+		}
+		size = le(chunk + 4, 4);
+		if(memcmp(chunk, "data", 4) == 0) {
+			// streaming writers leave the size at 0 or 0xffffffff
+			a->remaining = (size == 0 || size == 0xffffffffUL) ? -1 : (long)size;
+			break;
+		} else if(memcmp(chunk, "fmt ", 4) == 0) {
+			if(size < 16 || read_fully(a->fd, fmt, 16) != 16) {
+				return -1;
+			}
+			a->channels = le(fmt + 2, 2);
+			a->rate = le(fmt + 4, 4);
+			bits = le(fmt + 14, 2);
+			size -= 16;
+		}
+		size += size & 1;
+		while(size > 0) {
+			int n = size > sizeof(skip) ? sizeof(skip) : size;
+			if(read_fully(a->fd, skip, n) != n) {
+				return -1;
+			}
+			size -= n;
+		}
+	}
+	if(bits != 16 || a->channels < 1 || a->rate <= 0) {
+		fprintf(stderr, "audio: Only 16-bit PCM is supported\n");
+		return -1;
+	}
+	return 0;
+}
+
+int
+audio_open(struct audio_source *a, const char *path, int paced) {
+	struct stat st;
+	memset(a, 0, sizeof(*a));
+	if(strcmp(path, "-") == 0) {
+		a->fd = dup(0);
+	} else {
+		a->fd = open(path, O_RDONLY);
+	}
+	if(a->fd == -1) {
+		warn("audio: %s", path);
+		return -1;
+	}
+	a->paced = paced && fstat(a->fd, &st) == 0 && S_ISREG(st.st_mode);
+	a->channels = 1;
+	a->rate = AUDIO_RAW_RATE;
+	a->remaining = -1;
+
+	a->npending = read_fully(a->fd, a->pending, 12);
+	if(a->npending == 12 && memcmp(a->pending, "RIFF", 4) == 0 && memcmp(a->pending + 8, "WAVE", 4) == 0) {
+		a->npending = 0;
+		if(read_wav_header(a) != 0) {
+			fprintf(stderr, "audio: %s: Invalid WAV file\n", path);
+			audio_close(a);
+			return -1;
+		}
+	}
+	printf("audio: Reading %s, %d Hz, %d channel(s)\n", path, a->rate, a->channels);
+	clock_gettime(CLOCK_MONOTONIC, &a->start);
+	return 0;
+}
+
+/*
+ * Read up to max mono samples. Returns the number read, 0 at the end.
+ */
+int
+audio_read(struct audio_source *a, short *mono, int max) {
+	unsigned char buf[4096];
+	int framesize = 2 * a->channels;
+	int want, got, frames, i, c;
+
+	want = max * framesize;
+	if(want > (int)sizeof(buf)) {
+		want = sizeof(buf) / framesize * framesize;
+	}
+	if(a->remaining >= 0 && want > a->remaining) {
+		want = a->remaining / framesize * framesize;
+	}
+	got = a->npending > want ? want : a->npending;
+	memcpy(buf, a->pending, got);
+	memmove(a->pending, a->pending + got, a->npending - got);
+	a->npending -= got;
+	got += read_fully(a->fd, buf + got, want - got);
+	if(a->remaining >= 0) {
+		a->remaining -= got;
+	}
+
+	frames = got / framesize;
+	for(i = 0; frames > i; i++) {
+		long sum = 0;
+		for(c = 0; a->channels > c; c++) {
+			sum += (short)le(buf + i * framesize + 2 * c, 2);
+		}
+		mono[i] = sum / a->channels;
+	}
+
+	if(a->paced && frames > 0) {
+		struct timespec due = a->start;
+		double t = (double)(a->frames + frames) / a->rate;
+		due.tv_sec += (time_t)t;
+		due.tv_nsec += (long)((t - (time_t)t) * 1e9);
+		due.tv_sec += due.tv_nsec / 1000000000L;
+		due.tv_nsec %= 1000000000L;
+		clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &due, NULL);
+	}
+	a->frames += frames;
+	return frames;
+}
+
+void
+audio_close(struct audio_source *a) {
+	close(a->fd);
+	a->fd = -1;
+}
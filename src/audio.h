@@ -0,0 +1,31 @@
+#ifndef AUDIO_H
+#define AUDIO_H
+
+#include <time.h>
+
+/*
+ * 16-bit PCM input from a WAV file, a FIFO or stdin ("-"). Input without a
+ * RIFF header is taken as raw mono samples at AUDIO_RAW_RATE. Samples are
+ * mixed down to mono. When paced, regular files are read no faster than
+ * real time, as if they came from a capture pipe.
+ */
+
+#define AUDIO_RAW_RATE	44100
+
+struct audio_source {
+	int fd;
+	int channels;
+	int rate;
+	int paced;
+	long remaining;		// bytes of sample data left, -1 if unknown
+	unsigned char pending[16];
+	int npending;
+	struct timespec start;
+	long frames;
+};
+
+int audio_open(struct audio_source *a, const char *path, int paced);
+int audio_read(struct audio_source *a, short *mono, int max);
+void audio_close(struct audio_source *a);
+
+#endif
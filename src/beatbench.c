@@ -0,0 +1,138 @@
+#define _POSIX_C_SOURCE 200112L
+#include <err.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sysexits.h>
+#include <time.h>
+#include <unistd.h>
+#include "audio.h"
+#include "beattrack.h"
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+extern char *optarg;
+extern int optind;
+
+static void
+put_le(FILE *f, unsigned long v, int bytes) {
+	while(bytes-- > 0) {
+		fputc(v & 0xff, f);
+		v >>= 8;
+	}
+}
+
+/*
+ * Write a test track: a kick on every beat, a hihat on the offbeats and
+ * some noise, 44.1kHz mono, starting with a beat.
+ */
+static void
+write_track(const char *filename, double bpm, double seconds) {
+	int rate = 44100;
+	long n = seconds * rate, i;
+	double beat = 60 / bpm;
+	FILE *f = fopen(filename, "wb");
+	if(f == NULL) {
+		err(1, "%s", filename);
+	}
+	fwrite("RIFF", 1, 4, f);
+	put_le(f, 36 + 2 * n, 4);
+	fwrite("WAVEfmt ", 1, 8, f);
+	put_le(f, 16, 4);
+	put_le(f, 1, 2);
+	put_le(f, 1, 2);
+	put_le(f, rate, 4);
+	put_le(f, rate * 2, 4);
+	put_le(f, 2, 2);
+	put_le(f, 16, 2);
+	fwrite("data", 1, 4, f);
+	put_le(f, 2 * n, 4);
+	srand(1);
+	for(i = 0; n > i; i++) {
+		double t = (double)i / rate;
+		double since_beat = fmod(t, beat);
+		double since_offbeat = fmod(t + beat / 2, beat);
+		double v = 0.05 * (rand() / (double)RAND_MAX - 0.5);
+		v += 0.8 * sin(2 * M_PI * 55 * since_beat) * exp(-since_beat * 25);
+		v += 0.3 * (rand() / (double)RAND_MAX - 0.5) * exp(-since_offbeat * 60);
+		put_le(f, (unsigned short)(short)(v * 32767), 2);
+	}
+	fclose(f);
+}
+
+static int
+bench(const char *filename, double expected) {
+	static struct beattrack bt;
+	struct audio_source a;
+	short block[BT_HOP];
+	clock_t cpu;
+	int n, estimates = 0;
+	long since = 0;
+	double phase;
+
+	if(audio_open(&a, filename, 0) != 0) {
+		return -1;
+	}
+	beattrack_init(&bt, a.rate);
+	cpu = clock();
+	while((n = audio_read(&a, block, BT_HOP)) > 0) {
+		if(beattrack_feed(&bt, block, n)) {
+			estimates++;
+			since = 0;
+		} else {
+			since += n;
+		}
+	}
+	cpu = clock() - cpu;
+	audio_close(&a);
+	// phase at the end of the file
+	phase = bt.phase + (double)since / a.rate * bt.bpm / 60;
+	phase -= floor(phase);
+
+	printf("%s: %.2f BPM, phase %.2f, confidence %.2f, %d estimates, %.0fx real time\n",
+		filename, bt.bpm, phase, bt.confidence, estimates,
+		cpu > 0 ? (double)a.frames / a.rate / ((double)cpu / CLOCKS_PER_SEC) : INFINITY);
+	if(expected > 0 && fabs(bt.bpm - expected) > expected * 0.02) {
+		fprintf(stderr, "%s: expected %.2f BPM\n", filename, expected);
+		return -1;
+	}
+	return 0;
+}
+
+int
+main(int argc, char **argv) {
+	int opt, i, failed = 0;
+	double expected = 0;
+
+	while((opt = getopt(argc, argv, "e:w:")) != -1) {
+		switch(opt) {
+			case 'e':
+				expected = atof(optarg);
+				break;
+			case 'w':
+				if(argc - optind != 2) {
+					goto usage;
+				}
+				write_track(argv[optind + 1], atof(optarg), atof(argv[optind]));
+				return 0;
+			default:
+				goto usage;
+		}
+	}
+	if(optind >= argc) {
+		goto usage;
+	}
+	for(i = optind; argc > i; i++) {
+		if(bench(argv[i], expected) != 0) {
+			failed = 1;
+		}
+	}
+	return failed ? 1 : 0;
+
+usage:
+	fprintf(stderr, "Usage: %s [-e bpm] file.wav ...\n", argv[0]);
+	fprintf(stderr, "       %s -w bpm seconds file.wav\n", argv[0]);
+	return EX_USAGE;
+}
@@ -0,0 +1,230 @@
+#include <math.h>
+#include <string.h>
+#include "beattrack.h"
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+#define BT_LOW_FREQ	30.0
+#define BT_HIGH_FREQ	12000.0
+
+void
+beattrack_init(struct beattrack *bt, int rate) {
+	int i, bits, b;
+	double high;
+
+	memset(bt, 0, sizeof(*bt));
+	bt->rate = rate;
+	bt->frame_time = (double)BT_HOP / rate;
+
+	for(i = 0; BT_FRAME > i; i++) {
+		bt->window[i] = 0.5 - 0.5 * cos(2 * M_PI * i / BT_FRAME);
+	}
+	for(i = 0; BT_FRAME / 2 > i; i++) {
+		bt->cos_table[i] = cos(2 * M_PI * i / BT_FRAME);
+		bt->sin_table[i] = sin(2 * M_PI * i / BT_FRAME);
+	}
+	for(bits = 0; BT_FRAME > 1 << bits; bits++);
+	for(i = 0; BT_FRAME > i; i++) {
+		int r = 0;
+		for(b = 0; bits > b; b++) {
+			r |= ((i >> b) & 1) << (bits - 1 - b);
+		}
+		bt->bitrev[i] = r;
+	}
+
+	// logarithmically spaced bands, at least one bin each
+	high = rate / 2.0 < BT_HIGH_FREQ ? rate / 2.0 : BT_HIGH_FREQ;
+	for(b = 0; BT_BANDS >= b; b++) {
+		double freq = BT_LOW_FREQ * pow(high / BT_LOW_FREQ, (double)b / BT_BANDS);
+		int bin = freq * BT_FRAME / rate;
+		if(b > 0 && bin <= bt->band_start[b - 1]) {
+			bin = bt->band_start[b - 1] + 1;
+		}
+		bt->band_start[b] = bin;
+	}
+}
+
+static void
+fft(struct beattrack *bt) {
+	int size, half, step, i, j;
+	float *re = bt->re, *im = bt->im;
+	for(size = 2; BT_FRAME >= size; size *= 2) {
+		half = size / 2;
+		step = BT_FRAME / size;
+		for(i = 0; BT_FRAME > i; i += size) {
+			for(j = 0; half > j; j++) {
+				float wr = bt->cos_table[j * step], wi = -bt->sin_table[j * step];
+				int k = i + j, l = i + j + half;
+				float tr = wr * re[l] - wi * im[l];
+				float ti = wr * im[l] + wi * re[l];
+				re[l] = re[k] - tr;
+				im[l] = im[k] - ti;
+				re[k] += tr;
+				im[k] += ti;
+			}
+		}
+	}
+}
+
+/*
+ * Onset strength of the current frame: the summed increase of the log
+ * energy in each band.
+ */
+static float
+onset_strength(struct beattrack *bt) {
+	float power[BT_FRAME / 2];
+	float flux = 0;
+	int i, b;
+
+	for(i = 0; BT_FRAME > i; i++) {
+		bt->re[bt->bitrev[i]] = bt->samples[i] * bt->window[i];
+		bt->im[i] = 0;
+	}
+	fft(bt);
+	for(i = 0; BT_FRAME / 2 > i; i++) {
+		power[i] = bt->re[i] * bt->re[i] + bt->im[i] * bt->im[i];
+	}
+	for(b = 0; BT_BANDS > b; b++) {
+		float energy = 0, log_energy;
+		for(i = bt->band_start[b]; bt->band_start[b + 1] > i && BT_FRAME / 2 > i; i++) {
+			energy += power[i];
+		}
+		log_energy = logf(1e-4f + energy);
+		if(log_energy > bt->prev_energy[b]) {
+			flux += log_energy - bt->prev_energy[b];
+		}
+		bt->prev_energy[b] = log_energy;
+	}
+	return flux;
+}
+
+static float
+autocorrelation(const float *x, int n, int lag) {
+	float sum = 0;
+	int i;
+	for(i = 0; n - lag > i; i++) {
+		sum += x[i] * x[i + lag];
+	}
+	return sum / (n - lag);
+}
+
+static void
+estimate(struct beattrack *bt) {
+	int n = bt->nframes < BT_HISTORY ? bt->nframes : BT_HISTORY;
+	int start = bt->nframes - n;
+	int i, k, lag, best = 0, min_lag, max_lag, offset, best_offset = 0;
+	float *x = bt->linear;
+	float mean = 0, score, best_score = 0, ac0, prev, next;
+	double period, fit, best_fit = -1, center;
+
+	for(i = 0; n > i; i++) {
+		x[i] = bt->onsets[(start + i) % BT_HISTORY];
+		mean += x[i];
+	}
+	mean /= n;
+	for(i = 0; n > i; i++) {
+		x[i] -= mean;
+	}
+	ac0 = autocorrelation(x, n, 0);
+	if(ac0 <= 0) {
+		return;
+	}
+
+	// best lag, with a preference for tempos near 120 BPM and taking the
+	// lag at twice the period into account against octave errors
+	min_lag = floor(60 / (BT_MAX_BPM * bt->frame_time));
+	max_lag = ceil(60 / (BT_MIN_BPM * bt->frame_time));
+	center = 60 / (120 * bt->frame_time);
+	if(2 * max_lag + 1 >= n) {
+		return;
+	}
+	for(lag = min_lag; max_lag >= lag; lag++) {
+		double octaves = log2(lag / center);
+		score = (autocorrelation(x, n, lag) + 0.5 * autocorrelation(x, n, 2 * lag)) * exp(-0.5 * octaves * octaves);
+		if(score > best_score) {
+			best_score = score;
+			best = lag;
+		}
+	}
+	if(best == 0) {
+		return;
+	}
+	period = best;
+	if(best > min_lag && max_lag > best) {
+		prev = autocorrelation(x, n, best - 1);
+		score = autocorrelation(x, n, best);
+		next = autocorrelation(x, n, best + 1);
+		if(prev - 2 * score + next < 0) {
+			period += 0.5 * (prev - next) / (prev - 2 * score + next);
+		}
+	}
+
+	// phase: the offset of a comb with teeth one period apart that
+	// collects the most onset strength, counting back from the last frame
+	for(offset = 0; best > offset; offset++) {
+		fit = 0;
+		for(k = 0; ; k++) {
+			int idx = n - 1 - offset - (int)(k * period + 0.5);
+			if(idx < 0) {
+				break;
+			}
+			fit += x[idx];
+		}
+		if(fit > best_fit) {
+			best_fit = fit;
+			best_offset = offset;
+		}
+	}
+
+	bt->bpm = 60 / (period * bt->frame_time);
+	// the last frame is centered half a frame before its end
+	bt->phase = (best_offset + (BT_FRAME / 2.0) / BT_HOP) / period;
+	bt->phase -= floor(bt->phase);
+	bt->confidence = autocorrelation(x, n, best) / ac0;
+	if(bt->confidence < 0) {
+		bt->confidence = 0;
+	}
+}
+
+/*
+ * Feed samples. Returns 1 if a new estimate was made; the phase is then the
+ * position within the beat at the last of these samples.
+ */
+int
+beattrack_feed(struct beattrack *bt, const short *samples, int n) {
+	int used, i, estimated = 0;
+	long since = 0;
+
+	while(n > 0) {
+		used = BT_FRAME - bt->nsamples;
+		if(used > n) {
+			used = n;
+		}
+		for(i = 0; used > i; i++) {
+			bt->samples[bt->nsamples + i] = samples[i] / 32768.0f;
+		}
+		bt->nsamples += used;
+		samples += used;
+		n -= used;
+		since += used;
+		if(bt->nsamples < BT_FRAME) {
+			break;
+		}
+		bt->onsets[bt->nframes % BT_HISTORY] = onset_strength(bt);
+		bt->nframes++;
+		memmove(bt->samples, bt->samples + BT_HOP, (BT_FRAME - BT_HOP) * sizeof(float));
+		bt->nsamples -= BT_HOP;
+		if(bt->nframes >= BT_HISTORY / 2 && bt->nframes % BT_ESTIMATE == 0) {
+			estimate(bt);
+			estimated = bt->bpm > 0;
+			since = 0;
+		}
+	}
+	if(estimated) {
+		bt->phase += (double)since / bt->rate * bt->bpm / 60;
+		bt->phase -= floor(bt->phase);
+	}
+	return estimated;
+}
@@ -0,0 +1,51 @@
+#ifndef BEATTRACK_H
+#define BEATTRACK_H
+
+/*
+ * Audio beat tracker. Mono 16-bit samples are cut into overlapping frames;
+ * every frame is windowed and transformed, and the increase in energy over
+ * a handful of frequency bands gives an onset strength. The tempo is found
+ * by autocorrelating the last few seconds of onset strengths, the phase by
+ * finding the offset of a comb at that tempo that hits the most onsets.
+ *
+ * All per-sample and per-bin loops work on plain float arrays, so the
+ * compiler can vectorize them (NEON on the ARM boards, SSE on x86).
+ */
+
+#define BT_FRAME	1024	// FFT size in samples
+#define BT_HOP		512	// samples between frames
+#define BT_BANDS	8
+#define BT_HISTORY	512	// onset strengths kept, about 6s at 44.1kHz
+#define BT_ESTIMATE	32	// frames between tempo estimates
+#define BT_MIN_BPM	60
+#define BT_MAX_BPM	180
+
+struct beattrack {
+	int rate;
+	double frame_time;		// seconds between frames
+
+	float samples[BT_FRAME];
+	int nsamples;
+
+	float window[BT_FRAME];
+	float cos_table[BT_FRAME / 2];
+	float sin_table[BT_FRAME / 2];
+	short bitrev[BT_FRAME];
+	float re[BT_FRAME];
+	float im[BT_FRAME];
+	int band_start[BT_BANDS + 1];
+	float prev_energy[BT_BANDS];
+
+	float onsets[BT_HISTORY];	// ring buffer
+	int nframes;			// frames analysed so far
+	float linear[BT_HISTORY];	// onsets in time order, for estimation
+
+	double bpm;		// last estimate, 0 if none yet
+	double phase;		// position within the beat at the end of the input, 0..1
+	double confidence;	// 0..1
+};
+
+void beattrack_init(struct beattrack *bt, int rate);
+int beattrack_feed(struct beattrack *bt, const short *samples, int n);
+
+#endif
@@ -0,0 +1,78 @@
+#define _POSIX_C_SOURCE 200112L
+#include <errno.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#include "clock.h"
+
+static int simulated = 0;
+static struct timespec simulated_time;
+
+// a thread handling a recorded input keeps seeing the time it was recorded at
+static __thread const struct timespec *pinned = NULL;
+
+void
+clock_now(struct timespec *now) {
+	if(pinned != NULL) {
+		*now = *pinned;
+	} else if(simulated) {
+		*now = simulated_time;
+	} else {
+		clock_gettime(CLOCK_MONOTONIC, now);
+	}
+}
+
+/*
+ * Switch to simulated time. Must be called before any other thread runs.
+ */
+void
+clock_simulate(const struct timespec *start) {
+	simulated = 1;
+	simulated_time = *start;
+}
+
+void
+clock_set(const struct timespec *t) {
+	simulated_time = *t;
+}
+
+/*
+ * Make the calling thread see a fixed time, until it is unpinned with NULL.
+ */
+void
+clock_pin(const struct timespec *t) {
+	pinned = t;
+}
+
+void
+clock_cond_init(pthread_cond_t *cond) {
+	pthread_condattr_t attr;
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	pthread_cond_init(cond, &attr);
+	pthread_condattr_destroy(&attr);
+}
+
+/*
+ * Wait on cond until it is signalled or the clock reaches until. Returns
+ * ETIMEDOUT on a timeout, like pthread_cond_timedwait.
+ */
+int
+clock_wait(pthread_cond_t *cond, pthread_mutex_t *mtx, const struct timespec *until) {
+	if(simulated) {
+		if(until->tv_sec > simulated_time.tv_sec || (until->tv_sec == simulated_time.tv_sec && until->tv_nsec > simulated_time.tv_nsec)) {
+			simulated_time = *until;
+		}
+		return ETIMEDOUT;
+	}
+	return pthread_cond_timedwait(cond, mtx, until);
+}
+
+void
+clock_sleep(int seconds) {
+	if(simulated) {
+		simulated_time.tv_sec += seconds;
+		return;
+	}
+	sleep(seconds);
+}
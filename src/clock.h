@@ -0,0 +1,21 @@
+#ifndef CLOCK_H
+#define CLOCK_H
+
+#include <pthread.h>
+#include <time.h>
+
+/*
+ * The engine's clock. Normally this is the monotonic system clock. In
+ * simulated time the clock only moves when it is set, and waiting moves it
+ * straight to the end of the wait, so hours of show run in seconds and
+ * come out the same every time.
+ */
+void clock_now(struct timespec *now);
+void clock_simulate(const struct timespec *start);
+void clock_set(const struct timespec *t);
+void clock_pin(const struct timespec *t);
+void clock_cond_init(pthread_cond_t *cond);
+int clock_wait(pthread_cond_t *cond, pthread_mutex_t *mtx, const struct timespec *until);
+void clock_sleep(int seconds);
+
+#endif
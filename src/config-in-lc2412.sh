@@ -1,5 +1,8 @@
 #!/usr/bin/env bash
 
+# One transaction: the daemon sends a single frame at the end
+printf '['
+
 # Reset all inputs
 printf 'R'
 
@@ -57,3 +60,5 @@ printf 'M\x0B2\x17\x59'
 # Stroboscoop
 printf 'M\x19V\x61' # X-fade: strobe frequency
 printf 'V\x62\xff' # strobe intensity vast op 255
+
+printf ']'
@@ -1,5 +1,8 @@
 #!/usr/bin/env bash
 
+# One transaction: the daemon sends a single frame at the end
+printf '['
+
 # Reset all inputs
 printf 'R'
 
@@ -35,3 +38,5 @@ printf 'M\x052\x15\x29'
 
 # LED-par 7
 printf 'M\x062\x16\x31'
+
+printf ']'
@@ -0,0 +1,168 @@
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "cue.h"
+
+static struct cue **cues = NULL;
+static int ncues = 0, allocated = 0;
+// current is the cue on stage, armed the last cue that GO was given for
+static int current = -1, armed = -1;
+static struct timerwheel wheel;
+static cue_apply_callback_t apply_cue;
+
+static void
+fire_cue(struct cue *cue, int follow) {
+	printf("cue: Cue %d\n", cue->index + 1);
+	current = cue->index;
+	if(armed < current) {
+		armed = current;
+	}
+	apply_cue(cue);
+	if(follow && cue->follow != CUE_MANUAL) {
+		timer_add(&wheel, &cue->follow_timer, wheel.now + cue->follow * CUE_TICKS_PER_TENTH);
+	}
+}
+
+static void
+wait_expired(struct timer *t) {
+	fire_cue(t->arg, 1);
+}
+
+static void
+go_next(void) {
+	struct cue *cue;
+	if(armed + 1 >= ncues) {
+		return;
+	}
+	armed++;
+	cue = cues[armed];
+	if(cue->wait > 0) {
+		timer_add(&wheel, &cue->wait_timer, wheel.now + cue->wait * CUE_TICKS_PER_TENTH);
+	} else {
+		fire_cue(cue, 1);
+	}
+}
+
+static void
+follow_expired(struct timer *t) {
+	go_next();
+}
+
+static void
+cancel_pending(void) {
+	int n;
+	for(n = 0; ncues > n; n++) {
+		timer_del(&wheel, &cues[n]->wait_timer);
+		timer_del(&wheel, &cues[n]->follow_timer);
+	}
+}
+
+void
+init_cues(cue_apply_callback_t apply, unsigned long now) {
+	apply_cue = apply;
+	timerwheel_init(&wheel, now);
+}
+
+void
+clear_cues(void) {
+	int n;
+	cancel_pending();
+	for(n = 0; ncues > n; n++) {
+		free(cues[n]);
+	}
+	ncues = 0;
+	current = -1;
+	armed = -1;
+}
+
+int
+add_cue(enum cue_type type, int target, int fade_in, int fade_out, int wait, int follow) {
+	struct cue *cue;
+	if(ncues == allocated) {
+		int newsize = allocated ? allocated * 2 : 32;
+		struct cue **newcues = realloc(cues, newsize * sizeof(struct cue *));
+		if(newcues == NULL) {
+			return -1;
+		}
+		cues = newcues;
+		allocated = newsize;
+	}
+	cue = malloc(sizeof(struct cue));
+	if(cue == NULL) {
+		return -1;
+	}
+	cue->index = ncues;
+	cue->type = type;
+	cue->target = target;
+	cue->fade_in = fade_in;
+	cue->fade_out = fade_out;
+	cue->wait = wait;
+	cue->follow = follow;
+	timer_init(&cue->wait_timer, wait_expired, cue);
+	timer_init(&cue->follow_timer, follow_expired, cue);
+	cues[ncues++] = cue;
+	return ncues - 1;
+}
+
+int
+cue_count(void) {
+	return ncues;
+}
+
+const struct cue *
+get_cue(int n) {
+	assert(n >= 0 && n < ncues);
+	return cues[n];
+}
+
+int
+current_cue(void) {
+	return current;
+}
+
+/*
+ * Give GO for the cue after the last one that got GO. It starts after its
+ * wait time, and may in turn GO the next cue after its follow time.
+ */
+void
+cue_go(unsigned long now) {
+	timerwheel_advance(&wheel, now);
+	go_next();
+}
+
+/*
+ * Go back to the cue before the current one, immediately and without
+ * following on. Anything that was still pending is cancelled.
+ */
+void
+cue_back(unsigned long now) {
+	timerwheel_advance(&wheel, now);
+	cancel_pending();
+	if(current <= 0) {
+		return;
+	}
+	armed = current - 1;
+	fire_cue(cues[armed], 0);
+}
+
+int
+cue_jump(int n, unsigned long now) {
+	if(n < 0 || n >= ncues) {
+		return -1;
+	}
+	timerwheel_advance(&wheel, now);
+	cancel_pending();
+	armed = n - 1;
+	go_next();
+	return 0;
+}
+
+void
+cue_tick(unsigned long now) {
+	timerwheel_advance(&wheel, now);
+}
+
+int
+cues_pending(void) {
+	return wheel.pending > 0;
+}
@@ -0,0 +1,38 @@
+#ifndef CUE_H
+#define CUE_H
+
+#include "timerwheel.h"
+
+// Cue times are in tenths of a second, the timer wheel ticks every 10ms
+#define CUE_TICKS_PER_TENTH	10
+#define CUE_MANUAL		0xffff
+
+enum cue_type { CUE_PRESET = 'Q', CUE_PROGRAM = 'P', CUE_RELEASE = 'X', CUE_STOP = 'S' };
+
+struct cue {
+	int index;
+	enum cue_type type;
+	int target;
+	int fade_in;
+	int fade_out;
+	int wait;
+	int follow;
+	struct timer wait_timer;
+	struct timer follow_timer;
+};
+
+typedef void (*cue_apply_callback_t)(const struct cue *);
+
+void init_cues(cue_apply_callback_t apply, unsigned long now);
+void clear_cues(void);
+int add_cue(enum cue_type type, int target, int fade_in, int fade_out, int wait, int follow);
+int cue_count(void);
+const struct cue *get_cue(int n);
+int current_cue(void);
+void cue_go(unsigned long now);
+void cue_back(unsigned long now);
+int cue_jump(int n, unsigned long now);
+void cue_tick(unsigned long now);
+int cues_pending(void);
+
+#endif
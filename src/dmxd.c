@@ -1,4 +1,4 @@
-#define _POSIX_C_SOURCE 199309L
+#define _POSIX_C_SOURCE 200112L
 #include <sys/mman.h>
 #include <sys/stat.h>
 #include <sys/types.h>
@@ -17,14 +17,28 @@
 #include <assert.h>
 #include <fcntl.h>
 #include <signal.h>
+#include <math.h>
 #include "schaeckeling.h"
 #include "dmxdriver.h"
 #include "net.h"
 #include "colors.h"
+#include "expr.h"
+#include "preset.h"
+#include "cue.h"
+#include "tempo.h"
+#include "midiclock.h"
+#include "timecode.h"
+#include "audio.h"
+#include "beattrack.h"
+#include "genprog.h"
+#include "record.h"
+#include "clock.h"
+#include "osc.h"
+#include "snapshot.h"
 #include "dmxd.h"
 
 
-enum handle_action { HANDLE_NONE, HANDLE_RAW_VALUE, HANDLE_LED_2CH_INTENSITY, HANDLE_LED_2CH_COLOR, HANDLE_MASTER, HANDLE_BPM, HANDLE_CHASE, HANDLE_RUN, HANDLE_BLACKOUT };
+enum handle_action { HANDLE_NONE, HANDLE_RAW_VALUE, HANDLE_LED_2CH_INTENSITY, HANDLE_LED_2CH_COLOR, HANDLE_MASTER, HANDLE_BPM, HANDLE_CHASE, HANDLE_RUN, HANDLE_BLACKOUT, HANDLE_PRESET, HANDLE_CUE_GO, HANDLE_CUE_BACK, HANDLE_TAP, HANDLE_NUDGE };
 
 struct fader_handler {
 	enum handle_action action;
@@ -36,12 +50,19 @@ struct fader_handler {
 			inputidx_t other_input;
 			dmxchannel_t base_channel;
 		} led_2ch;
+		struct {
+			int slot;
+			int fade;
+		} preset;
+		struct {
+			char kind;
+		} nudge;
 	} data;
 };
 
-pthread_t netthr, progthr, watchdogthr;
 pthread_mutex_t dmxout_sendbuf_mtx, stepmtx;
 pthread_cond_t stepcond;
+int program_woken = 0;
 
 int watchdog_dmx_pong = 0;
 int watchdog_net_pong = 0;
@@ -56,24 +77,116 @@ extern int receiving_changes;
 
 unsigned char dmxout_sendbuf[DMX_CHANNELS];
 volatile int dmxout_dirty = 0;
+int input_batches = 0;	// open batches hold back output frames, under dmxout_sendbuf_mtx
+int config_batch = 0;	// a transaction in a config file
+int dmxout_channels = 0;
+int dmxout_min_channels = 0;
 
 unsigned char channel_flags[DMX_CHANNELS];
 unsigned char channel_overrides[DMX_CHANNELS];
 unsigned char channel_intensity[DMX_CHANNELS];
+unsigned char channel_look[DMX_CHANNELS];
 
 int master_blackout = -1;
 int master_intensity = 255;
 int program_intensity = 255;
 int program_running = 1;
-long programma_wait = 1000000;
+struct tempo tempo;
 struct timespec nextstep;
 
-char *programma = NULL;
+enum sync_source { SYNC_INTERNAL = 'I', SYNC_MIDI_CLOCK = 'M', SYNC_TIMECODE = 'T', SYNC_AUDIO = 'A' };
+enum sync_source sync_source = SYNC_INTERNAL;
+struct midiclock midiclock;
+struct mtc mtc;
+
+// audio input for the beat tracker; the reader reopens when the path changes
+#define AUDIO_MIN_CONFIDENCE 0.2
+char audio_path[256] = "";
+int audio_generation = 0;
+double audio_bpm = 0, audio_confidence = 0;
+
+/*
+ * Programs are stored in pages of PROGRAMMA_PAGE_STEPS steps, so a running
+ * program can be patched by swapping in modified copies of single pages.
+ */
+#define PROGRAMMA_PAGE_STEPS 16
+#define PROGRAMMA_PAGES(steps) (((steps) + PROGRAMMA_PAGE_STEPS - 1) / PROGRAMMA_PAGE_STEPS)
+
+char **programma = NULL;
 int programma_steps = 1, programma_channels = 0, programma_spb = 1;
 
-char *new_programma = NULL;
+char **new_programma = NULL;
 int new_programma_steps, new_programma_channels, new_programma_spb = 1;
 
+// copies of pages of the active program with uncommitted patches, or NULL
+char **patched_pages = NULL;
+
+// a generative program renders each step into a one-step programma
+struct generator *generator = NULL;
+long generator_step = 0, generated_step = -1;
+
+struct expr_formula formulas[EXPR_MAX_FORMULAS];
+int nformulas = 0;
+struct expr_program formula_program;
+struct timespec started;
+
+/*
+ * Have the program runner render a frame now instead of at its next
+ * wakeup. The simulation checks program_woken instead of waiting on
+ * stepcond. Must be called with stepmtx held.
+ */
+static void
+wake_program(void) {
+	program_woken = 1;
+	pthread_cond_signal(&stepcond);
+}
+
+struct recorder *recorder = NULL;
+pthread_mutex_t record_mtx = PTHREAD_MUTEX_INITIALIZER;
+static __thread int in_event = 0;
+
+/*
+ * Inputs and frames are recorded one at a time, in the order they take
+ * effect: the recorder lock is taken before stepmtx, and held while the
+ * input is handled, seeing the time it is recorded at, so a replay can give
+ * it exactly the same time. Frames sent while an input is handled are held
+ * back and recorded after it. Returns 1 if the caller has to call end_event;
+ * nested inputs, like an input command, are recorded as part of the outer
+ * one.
+ */
+static int
+begin_event(struct timespec *now) {
+	if(recorder == NULL || in_event) {
+		return 0;
+	}
+	pthread_mutex_lock(&record_mtx);
+	clock_now(now);
+	clock_pin(now);
+	in_event = 1;
+	record_hold(recorder);
+	return 1;
+}
+
+static void
+end_event(void) {
+	record_release(recorder);
+	in_event = 0;
+	clock_pin(NULL);
+	pthread_mutex_unlock(&record_mtx);
+}
+
+struct preset *presets;
+struct preset *preset_from = NULL, *preset_to = NULL;
+struct timespec preset_fade_start;
+int preset_fade_in = 0, preset_fade_out = 0; // tenths of a second
+int preset_fading = 0;
+
+// step the program should continue from, set by cues
+int programma_jump = -1;
+
+// While formulas or fades are active, frames are rendered at this interval (ns)
+#define FRAME_INTERVAL 25000000L
+
 #define CHFLAG_IGNORE_MASTER 1
 #define CHFLAG_OVERRIDE_PROGRAMMA 2
 
@@ -88,31 +201,9 @@ int new_programma_steps, new_programma_channels, new_programma_spb = 1;
 #define CHFLAG_CLR_IGNORE_MASTER(ch) CHFLAG_CLR_FLAG(ch, CHFLAG_IGNORE_MASTER)
 #define CHFLAG_CLR_OVERRIDE_PROGRAMMA(ch) CHFLAG_CLR_FLAG(ch, CHFLAG_OVERRIDE_PROGRAMMA)
 
-static void inline
-increment_timespec(struct timespec *ts, long add) {
-	int i;
-	assert(add > 0);
-	// ts->tv_nsec += add * 1000L;
-	for(i = 0; 1000 > i; i++) {
-		ts->tv_nsec += add;
-		ts->tv_sec += ts->tv_nsec / 1000000000L;
-		ts->tv_nsec = ts->tv_nsec % 1000000000L;
-	}
-	assert(ts->tv_nsec >= 0);
-}
-
-static void inline
-decrement_timespec(struct timespec *ts, long sub) {
-	int i;
-	assert(sub > 0);
-	for(i = 0; 1000 > i; i++) {
-		ts->tv_nsec -= sub;
-		while(ts->tv_nsec < 0) {
-			ts->tv_sec -= 1;
-			ts->tv_nsec += 1000000000L;
-		}
-	}
-	assert(ts->tv_nsec >= 0);
+static int inline
+timespec_reached(const struct timespec *now, const struct timespec *ts) {
+	return now->tv_sec > ts->tv_sec || (now->tv_sec == ts->tv_sec && now->tv_nsec >= ts->tv_nsec);
 }
 
 static int inline
@@ -127,54 +218,445 @@ dmxindex_to_channel(int channel) {
 	return channel+1;
 }
 
+static inline char *
+programma_step(char **pages, int channels, int step) {
+	return pages[step / PROGRAMMA_PAGE_STEPS] + (step % PROGRAMMA_PAGE_STEPS) * channels;
+}
+
+static char **
+alloc_programma(int steps, int channels) {
+	int page, pages = PROGRAMMA_PAGES(steps);
+	char **p = calloc(pages, sizeof(char *));
+	for(page = 0; pages > page; page++) {
+		p[page] = calloc(PROGRAMMA_PAGE_STEPS, channels);
+	}
+	return p;
+}
+
+static void
+free_programma(char **pages, int steps) {
+	int page;
+	if(pages == NULL) {
+		return;
+	}
+	for(page = 0; PROGRAMMA_PAGES(steps) > page; page++) {
+		free(pages[page]);
+	}
+	free(pages);
+}
+
+/*
+ * Write a patch for the active program into private copies of the pages it
+ * touches. The renderer keeps reading the unmodified pages until
+ * commit_patches(). Only the network thread changes programs, so the active
+ * pages can be read here without holding stepmtx.
+ */
+static void
+patch_programma(int step, int dmxidx, int count, const unsigned char *values) {
+	int page = step / PROGRAMMA_PAGE_STEPS;
+	if(patched_pages == NULL) {
+		patched_pages = calloc(PROGRAMMA_PAGES(programma_steps), sizeof(char *));
+	}
+	if(patched_pages[page] == NULL) {
+		patched_pages[page] = malloc(PROGRAMMA_PAGE_STEPS * programma_channels);
+		memcpy(patched_pages[page], programma[page], PROGRAMMA_PAGE_STEPS * programma_channels);
+	}
+	memcpy(programma_step(patched_pages, programma_channels, step) + dmxidx, values, count);
+}
+
+/*
+ * Swap all patched pages into the active program at once.
+ */
+static void
+commit_patches(void) {
+	int page, pages = PROGRAMMA_PAGES(programma_steps);
+	if(patched_pages == NULL) {
+		return;
+	}
+	pthread_mutex_lock(&stepmtx);
+	for(page = 0; pages > page; page++) {
+		if(patched_pages[page] != NULL) {
+			char *old = programma[page];
+			programma[page] = patched_pages[page];
+			patched_pages[page] = old;
+		}
+	}
+	wake_program();
+	pthread_mutex_unlock(&stepmtx);
+	// patched_pages now holds the replaced pages
+	free_programma(patched_pages, programma_steps);
+	patched_pages = NULL;
+}
+
+static void
+discard_patches(void) {
+	free_programma(patched_pages, programma_steps);
+	patched_pages = NULL;
+}
+
 static unsigned char
 apply_intensity(unsigned char in, unsigned char intensity) {
 	int tmp = in * intensity;
 	return tmp / 255;
 }
 
+/*
+ * Steps per beat on the wire: n, or 1/n as 128 + n.
+ */
+static int
+decode_spb(unsigned char spb) {
+	return (spb < 128) ? spb : 128 - spb;
+}
+
+static double
+steps_per_beat(void) {
+	if(programma_spb >= 1) {
+		return programma_spb;
+	} else if(programma_spb < 0) {
+		return 1.0 / -programma_spb;
+	}
+	return 1;
+}
+
+/*
+ * The step to jump to for an absolute step count: a generative program
+ * goes on counting, a stored one wraps around.
+ */
+static int
+jump_target(long step) {
+	if(generator != NULL) {
+		return step;
+	}
+	return (programma_steps > 0) ? step % programma_steps : 0;
+}
+
+/*
+ * Fine tempo and phase controls: '+' and '-' change the tempo by 0.1 BPM,
+ * '>' and '<' shift the phase by 1/16th of a beat. Must be called with
+ * stepmtx held.
+ */
+static int
+nudge_tempo(char kind) {
+	struct timespec now;
+	clock_now(&now);
+	switch(kind) {
+		case '+':
+		case '-':
+			tempo_set_bpm(&tempo, tempo.bpm + (kind == '+' ? 0.1 : -0.1), &now);
+			printf("tempo: %.1f BPM\n", tempo.bpm);
+			break;
+		case '>':
+		case '<':
+			tempo_adjust_phase(&tempo, kind == '>' ? 1 / 16.0 : -1 / 16.0, &now);
+			break;
+		default:
+			return -1;
+	}
+	wake_program();
+	return 0;
+}
+
+static void
+run_formulas(int step, const struct timespec *now) {
+	struct expr_env env;
+	env.inputbuf = inputbuf;
+	env.vars[EXPR_VAR_MASTER] = master_intensity / 255.0f;
+	double beat = tempo_beat(&tempo, now);
+	env.vars[EXPR_VAR_BEAT] = beat - floor(beat);
+	env.vars[EXPR_VAR_STEP] = step;
+	env.vars[EXPR_VAR_TIME] = (now->tv_sec - started.tv_sec) + (now->tv_nsec - started.tv_nsec) / 1e9f;
+	expr_run(&formula_program, &env, dmxout_sendbuf);
+}
+
+/*
+ * Install, replace or (for a formula without instructions) remove the
+ * formula for f->channel. Must be called with stepmtx held.
+ */
+static int
+set_formula(const struct expr_formula *f) {
+	int i;
+	for(i = 0; nformulas > i; i++) {
+		if(formulas[i].channel == f->channel) {
+			break;
+		}
+	}
+	if(f->ninsns == 0) {
+		if(i < nformulas) {
+			memmove(formulas + i, formulas + i + 1, (nformulas - i - 1) * sizeof(struct expr_formula));
+			nformulas--;
+		}
+	} else {
+		if(i == EXPR_MAX_FORMULAS) {
+			return -1;
+		}
+		formulas[i] = *f;
+		if(i == nformulas) {
+			nformulas++;
+		}
+	}
+	expr_link(&formula_program, formulas, nformulas);
+	return 0;
+}
+
+/*
+ * The highest channel in the mask of a preset, 0 for none.
+ */
+static int
+preset_channels(const struct preset *p) {
+	int dmxidx;
+	if(p == NULL) {
+		return 0;
+	}
+	for(dmxidx = DMX_CHANNELS - 1; dmxidx >= 0; dmxidx--) {
+		if(p->mask[dmxidx]) {
+			return dmxindex_to_channel(dmxidx);
+		}
+	}
+	return 0;
+}
+
+/*
+ * Find the highest output channel that is written by a handler, the program,
+ * an override, a formula or a preset on stage. Frames are cut short after
+ * it, but never below dmxout_min_channels.
+ */
+static void
+update_dmxout_channels(void) {
+	int iidx, dmxidx, i;
+	int used = programma_channels;
+	for(iidx = 0; INPUT_CHANNELS > iidx; iidx++) {
+		switch(handlers[iidx].action) {
+			case HANDLE_RAW_VALUE:
+				if(handlers[iidx].data.raw_value.channel > used) {
+					used = handlers[iidx].data.raw_value.channel;
+				}
+				break;
+			case HANDLE_LED_2CH_INTENSITY:
+				if(handlers[iidx].data.led_2ch.base_channel + 2 > used) {
+					used = handlers[iidx].data.led_2ch.base_channel + 2;
+				}
+				break;
+			default:
+				break;
+		}
+	}
+	for(dmxidx = used; DMX_CHANNELS > dmxidx; dmxidx++) {
+		if(CHFLAG_GET_OVERRIDE_PROGRAMMA(dmxidx)) {
+			used = dmxindex_to_channel(dmxidx);
+		}
+	}
+	for(i = 0; nformulas > i; i++) {
+		if(formulas[i].channel > used) {
+			used = formulas[i].channel;
+		}
+	}
+	if(preset_channels(preset_to) > used) {
+		used = preset_channels(preset_to);
+	}
+	if(preset_channels(preset_from) > used) {
+		used = preset_channels(preset_from);
+	}
+	if(used < dmxout_min_channels) {
+		used = dmxout_min_channels;
+	}
+	if(used > DMX_CHANNELS) {
+		used = DMX_CHANNELS;
+	}
+	pthread_mutex_lock(&dmxout_sendbuf_mtx);
+	if(used != dmxout_channels) {
+		printf("dmx: Sending %d channels per frame\n", used);
+		dmxout_channels = used;
+	}
+	pthread_mutex_unlock(&dmxout_sendbuf_mtx);
+}
+
+/*
+ * How far a preset fade of fade tenths of a second has progressed, 0..255.
+ */
+static int
+preset_fade_level(const struct timespec *now, int fade) {
+	long elapsed;
+	if(!preset_fading || fade == 0) {
+		return 255;
+	}
+	elapsed = (now->tv_sec - preset_fade_start.tv_sec) * 1000L + (now->tv_nsec - preset_fade_start.tv_nsec) / 1000000L;
+	if(elapsed >= fade * 100L) {
+		return 255;
+	}
+	return elapsed * 255 / (fade * 100L);
+}
+
+/*
+ * Start fading from what is on stage now to preset p (or back to the program
+ * if p is NULL). Channels that go up take fade_in, channels that go down
+ * take fade_out. Only pointers change here; the compositor does the
+ * blending. Must be called with stepmtx held.
+ */
+static void
+recall_preset(struct preset *p, int fade_in, int fade_out) {
+	struct timespec now;
+	clock_now(&now);
+	// a fade that is interrupted continues from whichever side dominates
+	if(preset_fade_level(&now, preset_fade_in) >= 128) {
+		preset_from = preset_to;
+	}
+	preset_to = p;
+	preset_fade_start = now;
+	preset_fade_in = fade_in;
+	preset_fade_out = fade_out;
+	preset_fading = 1;
+	update_dmxout_channels();
+	wake_program();
+}
+
+static unsigned long
+cue_ticks(const struct timespec *now) {
+	return ((now->tv_sec - started.tv_sec) * 1000L + (now->tv_nsec - started.tv_nsec) / 1000000L) / CUE_TICKS_PER_TENTH;
+}
+
+/*
+ * Called by the cue list, with stepmtx held, when a cue starts.
+ */
+static void
+apply_cue(const struct cue *cue) {
+	switch(cue->type) {
+		case CUE_PRESET:
+			recall_preset(presets + cue->target, cue->fade_in, cue->fade_out);
+			break;
+		case CUE_PROGRAM:
+			recall_preset(NULL, cue->fade_in, cue->fade_out);
+			programma_jump = cue->target;
+			if(!program_running) {
+				program_running = 1;
+				set_feedback_running(1);
+			}
+			break;
+		case CUE_RELEASE:
+			recall_preset(NULL, cue->fade_in, cue->fade_out);
+			break;
+		case CUE_STOP:
+			program_running = 0;
+			set_feedback_running(0);
+			break;
+	}
+	wake_program();
+}
+
+/*
+ * Whether apply_cue could start this target, with stepmtx held. A
+ * generative program has no last step; release and stop have no target.
+ */
+static int
+valid_cue_target(int type, int target) {
+	switch(type) {
+		case CUE_PRESET:
+			return target < PRESET_SLOTS;
+		case CUE_PROGRAM:
+			if(generator != NULL) {
+				return 1;
+			}
+			return programma != NULL && target < programma_steps;
+		case CUE_RELEASE:
+		case CUE_STOP:
+			return target == 0;
+	}
+	return 0;
+}
+
+static void
+cue_command(char command) {
+	struct timespec now;
+	clock_now(&now);
+	pthread_mutex_lock(&stepmtx);
+	if(command == 'G') {
+		cue_go(cue_ticks(&now));
+	} else {
+		cue_back(cue_ticks(&now));
+	}
+	wake_program();
+	pthread_mutex_unlock(&stepmtx);
+}
+
+static int
+rendering_continuously(void) {
+	return nformulas > 0 || preset_fading || cues_pending();
+}
+
 void
 error_step(void) {
 	pthread_mutex_lock(&stepmtx);
-	pthread_cond_signal(&stepcond);
+	wake_program();
 	pthread_mutex_unlock(&stepmtx);
 }
 
 
-void
-update_websockets(int dmx1, int dmx2) {
 /*
+ * Publish the monitor streams that changed: the DMX input, the output (with
+ * dmxout_sendbuf_mtx held) and the MIDI input.
+ */
+void
+update_websockets(int dmx1, int dmx2, int midi) {
 	if(dmx1) {
-		char *msg = malloc(1 + DMX_CHANNELS);
-		msg[0] = '1';
-		memcpy(msg+1, inputbuf, DMX_CHANNELS);
-		broadcast(msg, 1 + DMX_CHANNELS);
+		broadcast_frame(MONITOR_DMX_INPUT, inputbuf + dmx_to_input_index(1), DMX_CHANNELS);
 	}
-*/
 	if(dmx2) {
-		char *msg = malloc(1 + DMX_CHANNELS);
-		msg[0] = '2';
-		memcpy(msg+1, dmxout_sendbuf, DMX_CHANNELS);
-		broadcast(msg, 1 + DMX_CHANNELS);
+		broadcast_frame(MONITOR_OUTPUT, dmxout_sendbuf, DMX_CHANNELS);
 	}
-	if(dmx1 || dmx2) {
-		wakeup_select();
+	if(midi) {
+		broadcast_frame(MONITOR_MIDI_INPUT, inputbuf + midi_to_input_index(0), MIDI_CHANNELS);
 	}
 }
 
+static void publish_snapshot(const struct timespec *now);
+
 void
 flush_dmxout_sendbuf(void) {
+	struct timespec now;
+	int recording = begin_event(&now);
 	pthread_mutex_lock(&dmxout_sendbuf_mtx);
-	if(dmxout_dirty) {
-		send_dmx(dmxout_sendbuf);
-		update_websockets(1, 0);
+	if(dmxout_dirty && input_batches == 0) {
+		send_dmx(dmxout_sendbuf, dmxout_channels);
+		if(recorder != NULL) {
+			clock_now(&now);
+			record_frame(recorder, RECORD_FLUSH, &now, dmxout_sendbuf, dmxout_channels);
+		}
+		update_websockets(0, 1, 0);
+		clock_now(&now);
+		publish_snapshot(&now);
 		dmxout_dirty = 0;
 	}
 	pthread_mutex_unlock(&dmxout_sendbuf_mtx);
+	if(recording) {
+		end_event();
+	}
+}
+
+/*
+ * Inputs applied between begin_input_batch() and end_input_batch() go out
+ * in one frame: no frame is sent while a batch is open, not even by the
+ * program runner, and the end sends what changed. A batch never outlasts
+ * the call that opened it; a client's '[' transaction only holds back its
+ * own flushes.
+ */
+void
+begin_input_batch(void) {
+	pthread_mutex_lock(&dmxout_sendbuf_mtx);
+	input_batches++;
+	pthread_mutex_unlock(&dmxout_sendbuf_mtx);
 }
 
 void
-update_input(inputidx_t input, unsigned char new) {
+end_input_batch(void) {
+	pthread_mutex_lock(&dmxout_sendbuf_mtx);
+	assert(input_batches > 0);
+	input_batches--;
+	pthread_mutex_unlock(&dmxout_sendbuf_mtx);
+	flush_dmxout_sendbuf();
+}
+
+static void
+apply_input(inputidx_t input, unsigned char new) {
+	struct timespec now;
 	unsigned char intensity, color;
 	dmxchannel_t dmxch;
 	int dmxidx;
@@ -217,14 +699,14 @@ update_input(inputidx_t input, unsigned char new) {
 				CHFLAG_SET_OVERRIDE_PROGRAMMA(dmxidx+2);
 				convert_color(color, channel_overrides + dmxidx);
 			}
-			pthread_cond_signal(&stepcond);
+			wake_program();
 			pthread_mutex_unlock(&stepmtx);
 			break;
 		case HANDLE_MASTER:
 			pthread_mutex_lock(&stepmtx);
 			if(master_blackout == -1) {
 				master_intensity = new;
-				pthread_cond_signal(&stepcond);
+				wake_program();
 			} else {
 				master_blackout = new;
 			}
@@ -244,32 +726,54 @@ update_input(inputidx_t input, unsigned char new) {
 				master_blackout = -1;
 				set_feedback_blackout(0);
 			}
-			pthread_cond_signal(&stepcond);
+			wake_program();
 			pthread_mutex_unlock(&stepmtx);
 			return;
 		case HANDLE_CHASE:
 			pthread_mutex_lock(&stepmtx);
 			program_intensity = new;
-			pthread_cond_signal(&stepcond);
+			wake_program();
 			pthread_mutex_unlock(&stepmtx);
 			return;
 		case HANDLE_BPM:
-			printf("[dmx] pthread_mutex_lock(&stepmtx);\n");
 			pthread_mutex_lock(&stepmtx);
 			// BPM range: 30 - 180
-			long new_wait = 1000000 * 60 / (30 + ((180 - 30) * new / 255));
-			if(programma_spb >= 1) {
-				new_wait /= programma_spb;
-			} else {
-				new_wait *= -programma_spb;
+			clock_now(&now);
+			tempo_set_bpm(&tempo, 30 + (180 - 30) * new / 255.0, &now);
+			wake_program();
+			pthread_mutex_unlock(&stepmtx);
+			return;
+		case HANDLE_PRESET:
+			if(new < 64) {
+				break;
 			}
-			if(programma_wait > new_wait) {
-				decrement_timespec(&nextstep, programma_wait - new_wait);
+			pthread_mutex_lock(&stepmtx);
+			recall_preset(presets + handlers[input].data.preset.slot, handlers[input].data.preset.fade, handlers[input].data.preset.fade);
+			pthread_mutex_unlock(&stepmtx);
+			return;
+		case HANDLE_CUE_GO:
+		case HANDLE_CUE_BACK:
+			if(new < 64) {
+				break;
+			}
+			cue_command(handlers[input].action == HANDLE_CUE_GO ? 'G' : 'B');
+			return;
+		case HANDLE_TAP:
+			if(new < 64) {
+				break;
+			}
+			pthread_mutex_lock(&stepmtx);
+			clock_now(&now);
+			tempo_tap(&tempo, &now);
+			wake_program();
+			pthread_mutex_unlock(&stepmtx);
+			return;
+		case HANDLE_NUDGE:
+			if(new < 64) {
+				break;
 			}
-			programma_wait = new_wait;
-			printf("[dmx] pthread_cond_signal(&stepcond);\n");
-			pthread_cond_signal(&stepcond);
-			printf("[dmx] pthread_mutex_unlock(&stepmtx);\n");
+			pthread_mutex_lock(&stepmtx);
+			nudge_tempo(handlers[input].data.nudge.kind);
 			pthread_mutex_unlock(&stepmtx);
 			return;
 		case HANDLE_RUN:
@@ -279,57 +783,192 @@ update_input(inputidx_t input, unsigned char new) {
 			pthread_mutex_lock(&stepmtx);
 			program_running = !program_running;
 			set_feedback_running(program_running);
-			if(program_running) {
-				clock_gettime(CLOCK_REALTIME, &nextstep);
+			wake_program();
+			pthread_mutex_unlock(&stepmtx);
+			return;
+	}
+}
+
+/*
+ * MIDI realtime and song position messages. The clock is always followed,
+ * but only drives the beat clock and the program when it is the sync source.
+ */
+static void
+apply_midi_clock(unsigned char status, int position) {
+	struct timespec now;
+	int follow = (sync_source == SYNC_MIDI_CLOCK);
+	pthread_mutex_lock(&stepmtx);
+	clock_now(&now);
+	switch(status) {
+		case 0xf8: // timing clock
+			midiclock_tick(&midiclock, &now);
+			if(follow && midiclock_bpm(&midiclock) > 0) {
+				// no need to wake the program thread 24 times per beat
+				tempo_sync(&tempo, midiclock_beat(&midiclock, &now), midiclock_bpm(&midiclock), &now);
+			}
+			pthread_mutex_unlock(&stepmtx);
+			return;
+		case 0xfa: // start
+			midiclock_start(&midiclock);
+			if(follow) {
+				if(midiclock_bpm(&midiclock) > 0) {
+					tempo_sync(&tempo, midiclock_beat(&midiclock, &now), midiclock_bpm(&midiclock), &now);
+				}
+				programma_jump = 0;
+				program_running = 1;
+				set_feedback_running(program_running);
+			}
+			break;
+		case 0xfb: // continue
+		case 0xfc: // stop
+			if(follow) {
+				program_running = (status == 0xfb);
+				set_feedback_running(program_running);
+			}
+			break;
+		case 0xf2: // song position, in sixteenth notes
+			midiclock_song_position(&midiclock, position);
+			if(follow && programma_steps > 0) {
+				programma_jump = jump_target((long)(position / 4.0 * steps_per_beat()));
 			}
-			pthread_cond_signal(&stepcond);
+			break;
+		default:
 			pthread_mutex_unlock(&stepmtx);
 			return;
 	}
+	wake_program();
+	pthread_mutex_unlock(&stepmtx);
 }
 
+/*
+ * Put the beat clock where the timecode map says the program should be.
+ * Small differences are slewed out; on a seek, or when the position is too
+ * far off, the program jumps straight to the right step. Must be called
+ * with stepmtx held.
+ */
+static void
+chase_timecode(const struct timespec *now, int seek) {
+	double bpm, pos;
+	pos = timecode_position(mtc_time(&mtc, now), steps_per_beat(), tempo.bpm, &bpm);
+	if(tempo_sync(&tempo, pos / steps_per_beat(), bpm, now) || seek) {
+		programma_jump = jump_target((long)floor(pos));
+		wake_program();
+	}
+}
 
-int
-handle_data(struct connection *c, char *buf_s, size_t len) {
+static void
+apply_mtc_quarter_frame(unsigned char data) {
+	struct timespec now;
+	pthread_mutex_lock(&stepmtx);
+	clock_now(&now);
+	int was_running = mtc_running(&mtc, &now);
+	if(mtc_quarter_frame(&mtc, data, &now) && sync_source == SYNC_TIMECODE) {
+		// after a stop or dropout, relocate instead of catching up
+		chase_timecode(&now, !was_running);
+	}
+	pthread_mutex_unlock(&stepmtx);
+}
+
+static void
+apply_mtc_full_frame(const unsigned char *hmsf) {
+	struct timespec now;
+	pthread_mutex_lock(&stepmtx);
+	clock_now(&now);
+	mtc_full_frame(&mtc, hmsf, &now);
+	printf("mtc: Locate to %.2fs\n", mtc.seconds);
+	if(sync_source == SYNC_TIMECODE) {
+		chase_timecode(&now, 1);
+	}
+	pthread_mutex_unlock(&stepmtx);
+}
+
+
+/*
+ * The input a 'D', 'M' or 'X' command is about, 'X' has the universe in
+ * buf[1].
+ */
+static inputidx_t
+input_of(const unsigned char *buf, int channel) {
+	switch(buf[0]) {
+		case 'D':
+			return dmx_to_input_index(channel);
+		case 'M':
+			return midi_to_input_index(channel);
+		default:
+			return netin_to_input_index(buf[1], channel);
+	}
+}
+
+/*
+ * The channel number of an input, as a 'D', 'M' or 'X' command gives it.
+ */
+static int
+channel_of(inputidx_t iidx) {
+	if(input_index_is_netin(iidx)) {
+		return input_index_to_netin(iidx);
+	}
+	return input_index_is_dmx(iidx) ? input_index_to_dmx(iidx) : input_index_to_midi(iidx);
+}
+
+static int
+handle_command(struct connection *c, char *buf_s, size_t len) {
 	unsigned char *buf = (unsigned char *)buf_s;
-	int processed = 0;
+	int processed = 0, repatched = 0;
+	struct timespec now;
 #define REQUIRE_MIN_LENGTH(x) if(x > len) { return 0; } processed = x
 	assert(len > 0);
 
 	inputidx_t iidx;
+	int skip;
+	int *batch = (c != NULL) ? &c->batch : &config_batch;
 
 	switch(buf[0]) {
 		case 'D':
 		case 'M':
-			REQUIRE_MIN_LENGTH(3);
-			iidx = (buf[0] == 'D' ? dmx_to_input_index(buf[1]) : midi_to_input_index(buf[1]));
-			char *type = (buf[0] == 'D' ? "DMX" : "MIDI");
-			int input_number = buf[1];
+		case 'X':
+			// 'X' has a universe and a two byte channel where 'D' and 'M' have one byte
+			skip = (buf[0] == 'X' ? 2 : 0);
+			REQUIRE_MIN_LENGTH(skip + 3);
+			unsigned char *arg = buf + skip;
+			int input_number = (buf[0] == 'X' ? buf[2] * 256 + buf[3] : buf[1]);
+			if(buf[0] == 'X' && (buf[1] >= NETIN_UNIVERSES || input_number < 1 || input_number > DMX_CHANNELS)) {
+				return -1;
+			}
+			iidx = input_of(buf, input_number);
+			char type[24];
+			if(buf[0] == 'X') {
+				snprintf(type, sizeof(type), "network %d", buf[1]);
+			} else {
+				snprintf(type, sizeof(type), "%s", buf[0] == 'D' ? "DMX" : "MIDI");
+			}
 			if(handlers[iidx].action == HANDLE_LED_2CH_INTENSITY || handlers[iidx].action == HANDLE_LED_2CH_COLOR) {
 				handlers[handlers[iidx].data.led_2ch.other_input].action = HANDLE_NONE;
 			}
-			switch(buf[2]) {
+			switch(arg[2]) {
 				case 'R':
 					printf("net: Set %s channel %d to default\n", type, input_number);
 					handlers[iidx].action = HANDLE_NONE;
 					update_input(iidx, inputbuf[iidx]);
 					break;
 				case 'V':
-					REQUIRE_MIN_LENGTH(4);
-					printf("net: Set raw %s channel %d to channel %d\n", type, input_number, buf[3]);
+					REQUIRE_MIN_LENGTH(skip + 4);
+					printf("net: Set raw %s channel %d to channel %d\n", type, input_number, arg[3]);
 					handlers[iidx].action = HANDLE_RAW_VALUE;
-					handlers[iidx].data.raw_value.channel = buf[3];
+					handlers[iidx].data.raw_value.channel = arg[3];
 					break;
 				case '2':
-					REQUIRE_MIN_LENGTH(5);
-					int other_iidx = (buf[0] == 'D' ? dmx_to_input_index(buf[3]) : midi_to_input_index(buf[3]));
-					printf("net: Set %s channel %d and %d to led 2ch [%d-%d]\n", type, input_number, buf[3], buf[4], buf[4] + 2);
+					REQUIRE_MIN_LENGTH(skip + 5);
+					if(buf[0] != 'M' && arg[3] == 0) {
+						return -1;
+					}
+					int other_iidx = input_of(buf, arg[3]);
+					printf("net: Set %s channel %d and %d to led 2ch [%d-%d]\n", type, input_number, arg[3], arg[4], arg[4] + 2);
 					handlers[iidx].action = HANDLE_LED_2CH_INTENSITY;
 					handlers[iidx].data.led_2ch.other_input = other_iidx;
-					handlers[iidx].data.led_2ch.base_channel = buf[4];
+					handlers[iidx].data.led_2ch.base_channel = arg[4];
 					handlers[other_iidx].action = HANDLE_LED_2CH_COLOR;
 					handlers[other_iidx].data.led_2ch.other_input = iidx;
-					handlers[other_iidx].data.led_2ch.base_channel = buf[4];
+					handlers[other_iidx].data.led_2ch.base_channel = arg[4];
 					break;
 				case 'B':
 					printf("net: Set %s channel %d to bpm\n", type, input_number);
@@ -351,15 +990,48 @@ handle_data(struct connection *c, char *buf_s, size_t len) {
 					printf("net: Set %s channel %d to blackout\n", type, input_number);
 					handlers[iidx].action = HANDLE_BLACKOUT;
 					break;
+				case 'T':
+					printf("net: Set %s channel %d to tap tempo\n", type, input_number);
+					handlers[iidx].action = HANDLE_TAP;
+					break;
+				case 'N':
+					REQUIRE_MIN_LENGTH(skip + 4);
+					if(arg[3] != '+' && arg[3] != '-' && arg[3] != '>' && arg[3] != '<') {
+						return -1;
+					}
+					printf("net: Set %s channel %d to tempo nudge %c\n", type, input_number, arg[3]);
+					handlers[iidx].action = HANDLE_NUDGE;
+					handlers[iidx].data.nudge.kind = arg[3];
+					break;
+				case 'G':
+					printf("net: Set %s channel %d to cue GO\n", type, input_number);
+					handlers[iidx].action = HANDLE_CUE_GO;
+					break;
+				case 'K':
+					printf("net: Set %s channel %d to cue BACK\n", type, input_number);
+					handlers[iidx].action = HANDLE_CUE_BACK;
+					break;
+				case 'Q':
+					REQUIRE_MIN_LENGTH(skip + 6);
+					if(arg[3] >= PRESET_SLOTS) {
+						return -1;
+					}
+					printf("net: Set %s channel %d to recall preset %d\n", type, input_number, arg[3]);
+					handlers[iidx].action = HANDLE_PRESET;
+					handlers[iidx].data.preset.slot = arg[3];
+					handlers[iidx].data.preset.fade = arg[4] * 256 + arg[5];
+					break;
 				default:
 					return -1;
 			}
+			repatched = 1;
 			break;
 		case 'R':
 			REQUIRE_MIN_LENGTH(1);
 			for(iidx = 0; INPUT_CHANNELS > iidx; iidx++) {
 				handlers[iidx].action = HANDLE_NONE;
 			}
+			repatched = 1;
 			break;
 		case 'V':
 			REQUIRE_MIN_LENGTH(3);
@@ -371,39 +1043,190 @@ handle_data(struct connection *c, char *buf_s, size_t len) {
 			dmxout_sendbuf[dmxidx] = buf[2];
 			dmxout_dirty = 1;
 			pthread_mutex_unlock(&dmxout_sendbuf_mtx);
+			repatched = 1;
 			break;
-		case 'B':
-			REQUIRE_MIN_LENGTH(2);
-			// TODO: HANDLE_BPM does this a lot better. Generalize.
-			programma_wait = 1000000 * 60 / buf[1];
-			if(programma_spb >= 1) {
-				programma_wait /= programma_spb;
-			} else {
-				programma_wait *= -programma_spb;
+		case 'W':
+			// a range of channels: start[2] count[2] values
+			REQUIRE_MIN_LENGTH(5);
+			int start = buf[1] * 256 + buf[2], span = buf[3] * 256 + buf[4];
+			if(start < 1 || span > DMX_CHANNELS - start + 1) {
+				return -1;
 			}
+			REQUIRE_MIN_LENGTH(5 + span);
+			pthread_mutex_lock(&dmxout_sendbuf_mtx);
+			for(int i = 0; span > i; i++) {
+				int dmxidx = dmx_channel_to_dmxindex(start + i);
+				CHFLAG_SET_IGNORE_MASTER(dmxidx);
+				CHFLAG_SET_OVERRIDE_PROGRAMMA(dmxidx);
+				channel_overrides[dmxidx] = buf[5 + i];
+				dmxout_sendbuf[dmxidx] = buf[5 + i];
+			}
+			dmxout_dirty = 1;
+			pthread_mutex_unlock(&dmxout_sendbuf_mtx);
+			repatched = 1;
+			break;
+		case '[':
+			// begin a transaction: its commands are not flushed until
+			// ']', the program and other clients go on sending frames
+			REQUIRE_MIN_LENGTH(1);
+			*batch = 1;
+			break;
+		case ']':
+			REQUIRE_MIN_LENGTH(1);
+			*batch = 0; // flushed below
+			break;
+		case 'L':
+			REQUIRE_MIN_LENGTH(3);
+			dmxout_min_channels = buf[1] * 256 + buf[2];
+			printf("net: Pad frames to at least %d channels\n", dmxout_min_channels);
+			repatched = 1;
+			break;
+		case 'B':
+			REQUIRE_MIN_LENGTH(2);
+			pthread_mutex_lock(&stepmtx);
+			clock_now(&now);
+			tempo_set_bpm(&tempo, buf[1], &now);
+			wake_program();
+			pthread_mutex_unlock(&stepmtx);
 			break;
 		case 'S':
 			REQUIRE_MIN_LENGTH(1);
+			// step now: move the beat clock forward to the next step boundary
+			pthread_mutex_lock(&stepmtx);
+			clock_now(&now);
+			double pos = tempo_beat(&tempo, &now) * steps_per_beat();
+			tempo_jump(&tempo, (floor(pos) + 1 - pos) / steps_per_beat(), &now);
+			wake_program();
+			pthread_mutex_unlock(&stepmtx);
+			break;
+		case 'T':
+			REQUIRE_MIN_LENGTH(1);
+			pthread_mutex_lock(&stepmtx);
+			clock_now(&now);
+			tempo_tap(&tempo, &now);
+			wake_program();
+			pthread_mutex_unlock(&stepmtx);
+			break;
+		case 'N':
+			REQUIRE_MIN_LENGTH(2);
+			pthread_mutex_lock(&stepmtx);
+			int nudged = nudge_tempo(buf[1]);
+			pthread_mutex_unlock(&stepmtx);
+			if(nudged != 0) {
+				return -1;
+			}
+			break;
+		case 'Y':
+			REQUIRE_MIN_LENGTH(2);
+			if(buf[1] != SYNC_INTERNAL && buf[1] != SYNC_MIDI_CLOCK && buf[1] != SYNC_TIMECODE && buf[1] != SYNC_AUDIO) {
+				return -1;
+			}
+			pthread_mutex_lock(&stepmtx);
+			sync_source = buf[1];
+			pthread_mutex_unlock(&stepmtx);
+			printf("net: Sync source %c\n", buf[1]);
+			break;
+		case 'I':
+			REQUIRE_MIN_LENGTH(1);
+			{
+				char stats[256];
+				int len;
+				pthread_mutex_lock(&stepmtx);
+				clock_now(&now);
+				len = snprintf(stats, sizeof(stats), "sync=%c bpm=%.1f running=%d steps=%d midiclock.bpm=%.1f midiclock.lock=%d mtc.time=%.2f mtc.running=%d audio.bpm=%.1f audio.confidence=%.2f",
+					sync_source, tempo.bpm, program_running, programma_steps,
+					midiclock_bpm(&midiclock), midiclock_quality(&midiclock, &now),
+					mtc_time(&mtc, &now), mtc_running(&mtc, &now),
+					audio_bpm, audio_confidence);
+				pthread_mutex_unlock(&stepmtx);
+				len += snprintf(stats + len, sizeof(stats) - len, " clients=%d", client_count());
+				if(c != NULL) {
+					snprintf(stats + len, sizeof(stats) - len, " queue=%d sent=%lu dropped=%lu",
+						c->queued, c->frames_sent, c->frames_dropped);
+				}
+				client_printf(c, "I%c%s", (int)strlen(stats), stats);
+			}
+			break;
+		case 'U':
+			REQUIRE_MIN_LENGTH(7);
+			{
+				// stream, first channel, count, frames per second
+				int stream = monitor_stream(buf[1]);
+				if(subscribe_monitor(c, stream, buf[2] << 8 | buf[3], buf[4] << 8 | buf[5], buf[6]) != 0) {
+					return -1;
+				}
+				set_monitor_deltas(c, 1);
+				// the current frame, so the client need not wait for a change
+				pthread_mutex_lock(&dmxout_sendbuf_mtx);
+				update_websockets(stream == MONITOR_DMX_INPUT, stream == MONITOR_OUTPUT, stream == MONITOR_MIDI_INPUT);
+				pthread_mutex_unlock(&dmxout_sendbuf_mtx);
+			}
+			break;
+		case 'F':
+			REQUIRE_MIN_LENGTH(2);
+			switch(buf[1]) {
+				case 'F': // whole frames
+					set_monitor_deltas(c, 0);
+					break;
+				case 'D': // keyframes and deltas
+					set_monitor_deltas(c, 1);
+					break;
+				case 'K': // resync with a keyframe
+					request_keyframe(c);
+					break;
+				default:
+					return -1;
+			}
+			break;
+		case 'A':
+			REQUIRE_MIN_LENGTH(2);
+			REQUIRE_MIN_LENGTH(2 + buf[1]);
+			if(buf[1] >= sizeof(audio_path)) {
+				return -1;
+			}
 			pthread_mutex_lock(&stepmtx);
-			clock_gettime(CLOCK_REALTIME, &nextstep);
-			pthread_cond_signal(&stepcond);
+			memcpy(audio_path, buf + 2, buf[1]);
+			audio_path[buf[1]] = '\0';
+			audio_generation++;
 			pthread_mutex_unlock(&stepmtx);
+			printf("net: Audio input %s\n", buf[1] > 0 ? audio_path : "off");
+			break;
+		case 'K':
+			REQUIRE_MIN_LENGTH(2);
+			switch(buf[1]) {
+				case 'N': // clear the timecode map
+					pthread_mutex_lock(&stepmtx);
+					clear_keyframes();
+					pthread_mutex_unlock(&stepmtx);
+					break;
+				case 'A': // add keyframe: time in ms, step, BPM
+					REQUIRE_MIN_LENGTH(9);
+					// what tempo_sync would clamp it to, the map has to agree
+					if(buf[8] < TEMPO_MIN_BPM || buf[8] > TEMPO_MAX_BPM) {
+						return -1;
+					}
+					pthread_mutex_lock(&stepmtx);
+					add_keyframe((unsigned long)buf[2] << 24 | buf[3] << 16 | buf[4] << 8 | buf[5], buf[6] * 256 + buf[7], buf[8]);
+					pthread_mutex_unlock(&stepmtx);
+					break;
+				default:
+					return -1;
+			}
 			break;
 		case 'P':
 			REQUIRE_MIN_LENGTH(2);
 			switch(buf[1]) {
 				case 'N': // new
 					REQUIRE_MIN_LENGTH(7);
-					if(new_programma != NULL) {
-						free(new_programma);
-					}
+					free_programma(new_programma, new_programma_steps);
+					new_programma = NULL;
 					new_programma_channels = buf[2] * 256 + buf[3];
 					new_programma_steps = buf[4] * 256 + buf[5];
-					new_programma_spb = (buf[6] < 128) ? buf[6] : buf[6] - 128-2;
+					new_programma_spb = decode_spb(buf[6]);
 					if(new_programma_steps < 1) {
 						return -1;
 					}
-					new_programma = calloc(new_programma_steps, new_programma_channels);
+					new_programma = alloc_programma(new_programma_steps, new_programma_channels);
 					break;
 				case 'S': // step
 					if(new_programma == NULL) {
@@ -414,16 +1237,77 @@ handle_data(struct connection *c, char *buf_s, size_t len) {
 					if(step >= new_programma_steps) {
 						return -1;
 					}
-					memcpy(new_programma + step * new_programma_channels, buf + 4, new_programma_channels);
+					memcpy(programma_step(new_programma, new_programma_channels, step), buf + 4, new_programma_channels);
 					break;
-				case 'A': // activate
-					if(new_programma_steps < 1) {
+				case 'L': // live patch of the active program
+					REQUIRE_MIN_LENGTH(10);
+					int first_step = buf[2] * 256 + buf[3];
+					int nsteps = buf[4] * 256 + buf[5];
+					int first_channel = buf[6] * 256 + buf[7];
+					int nchannels = buf[8] * 256 + buf[9];
+					if(programma == NULL || first_step + nsteps > programma_steps || first_channel < 1 || first_channel + nchannels - 1 > programma_channels) {
+						return -1;
+					}
+					// a patch has to fit in the input buffer of a client, larger ones go in several
+					if(nsteps * nchannels > COMMAND_MAX - 10) {
+						return -1;
+					}
+					REQUIRE_MIN_LENGTH(10 + nsteps * nchannels);
+					for(int i = 0; nsteps > i; i++) {
+						patch_programma(first_step + i, first_channel - 1, nchannels, buf + 10 + i * nchannels);
+					}
+					break;
+				case 'C': // commit live patches
+					commit_patches();
+					break;
+				case 'G': // generative program
+					REQUIRE_MIN_LENGTH(12);
+					REQUIRE_MIN_LENGTH(12 + 3 * buf[11] + buf[6]);
+					struct generator *g = calloc(1, sizeof(struct generator));
+					assert(g != NULL);
+					g->seed = (unsigned long)buf[2] << 24 | buf[3] << 16 | buf[4] << 8 | buf[5];
+					g->lamps = buf[6];
+					g->weights[GEN_ALL] = buf[8];
+					g->weights[GEN_GROUPED] = buf[9];
+					g->weights[GEN_RANDOM] = buf[10];
+					g->ncolors = buf[11];
+					if(g->lamps < 1 || g->lamps > GEN_MAX_LAMPS || g->ncolors < 1 || g->ncolors > GEN_MAX_COLORS) {
+						free(g);
 						return -1;
 					}
-					if(programma != NULL) {
-						free(programma);
+					memcpy(g->palette, buf + 12, 3 * g->ncolors);
+					memcpy(g->intensity, buf + 12 + 3 * g->ncolors, g->lamps);
+					discard_patches();
+					char **old_pages = programma;
+					int old_nsteps = programma_steps;
+					struct generator *old_generator;
+					pthread_mutex_lock(&stepmtx);
+					old_generator = generator;
+					generator = g;
+					generator_step = 0;
+					generated_step = -1;
+					programma = alloc_programma(1, generator_channels(g));
+					programma_steps = 1;
+					programma_channels = generator_channels(g);
+					programma_spb = decode_spb(buf[7]);
+					wake_program();
+					pthread_mutex_unlock(&stepmtx);
+					free_programma(old_pages, old_nsteps);
+					free(old_generator);
+					printf("net: Generative program, %d lamps, %d colors\n", g->lamps, g->ncolors);
+					repatched = 1;
+					break;
+				case 'A': // activate
+					if(new_programma == NULL) {
+						return -1;
 					}
+					discard_patches();
+					char **old_programma = programma;
+					int old_steps = programma_steps;
+					struct generator *old_gen;
 					pthread_mutex_lock(&stepmtx);
+					old_gen = generator;
+					generator = NULL;
 					programma = new_programma;
 					programma_steps = new_programma_steps;
 					programma_channels = new_programma_channels;
@@ -432,137 +1316,577 @@ handle_data(struct connection *c, char *buf_s, size_t len) {
 					new_programma_steps = -1;
 					new_programma_channels = -1;
 					new_programma_spb = 1;
-					pthread_cond_signal(&stepcond);
+					wake_program();
 					pthread_mutex_unlock(&stepmtx);
+					free_programma(old_programma, old_steps);
+					free(old_gen);
+					repatched = 1;
 					break;
 				default:
 					return -1;
 			}
 			break;
+		case 'Q':
+			REQUIRE_MIN_LENGTH(2);
+			int slot, first, count;
+			switch(buf[1]) {
+				case 'S': // store
+				case 'A': // add channels
+					REQUIRE_MIN_LENGTH(7);
+					slot = buf[2];
+					first = buf[3] * 256 + buf[4];
+					count = buf[5] * 256 + buf[6];
+					if(count == 0) {
+						first = 1;
+						count = DMX_CHANNELS;
+					}
+					if(slot >= PRESET_SLOTS || first < 1 || first + count - 1 > DMX_CHANNELS) {
+						return -1;
+					}
+					printf("net: Store channels %d-%d in preset %d\n", first, first + count - 1, slot);
+					pthread_mutex_lock(&stepmtx);
+					pthread_mutex_lock(&dmxout_sendbuf_mtx);
+					if(buf[1] == 'S') {
+						memset(presets[slot].mask, 0, DMX_CHANNELS);
+					}
+					memcpy(presets[slot].values + first - 1, channel_look + first - 1, count);
+					memset(presets[slot].mask + first - 1, 1, count);
+					pthread_mutex_unlock(&dmxout_sendbuf_mtx);
+					pthread_mutex_unlock(&stepmtx);
+					sync_preset(presets, slot);
+					repatched = 1; // the preset may be on stage
+					break;
+				case 'R': // recall
+					REQUIRE_MIN_LENGTH(5);
+					slot = buf[2];
+					if(slot >= PRESET_SLOTS) {
+						return -1;
+					}
+					if(preset_is_empty(presets + slot)) {
+						printf("net: Preset %d is empty\n", slot);
+						break;
+					}
+					pthread_mutex_lock(&stepmtx);
+					recall_preset(presets + slot, buf[3] * 256 + buf[4], buf[3] * 256 + buf[4]);
+					pthread_mutex_unlock(&stepmtx);
+					break;
+				case 'X': // release
+					REQUIRE_MIN_LENGTH(4);
+					pthread_mutex_lock(&stepmtx);
+					recall_preset(NULL, buf[2] * 256 + buf[3], buf[2] * 256 + buf[3]);
+					pthread_mutex_unlock(&stepmtx);
+					break;
+				case 'C': // clear
+					REQUIRE_MIN_LENGTH(3);
+					slot = buf[2];
+					if(slot >= PRESET_SLOTS) {
+						return -1;
+					}
+					pthread_mutex_lock(&stepmtx);
+					memset(presets[slot].mask, 0, DMX_CHANNELS);
+					pthread_mutex_unlock(&stepmtx);
+					sync_preset(presets, slot);
+					break;
+				default:
+					return -1;
+			}
+			break;
+		case 'C':
+			REQUIRE_MIN_LENGTH(2);
+			switch(buf[1]) {
+				case 'N': // new (empty) cue list
+					pthread_mutex_lock(&stepmtx);
+					clear_cues();
+					pthread_mutex_unlock(&stepmtx);
+					break;
+				case 'A': // append cue
+					REQUIRE_MIN_LENGTH(13);
+					pthread_mutex_lock(&stepmtx);
+					int n = -1;
+					if(valid_cue_target(buf[2], buf[3] * 256 + buf[4])) {
+						n = add_cue(buf[2], buf[3] * 256 + buf[4], buf[5] * 256 + buf[6], buf[7] * 256 + buf[8], buf[9] * 256 + buf[10], buf[11] * 256 + buf[12]);
+					}
+					pthread_mutex_unlock(&stepmtx);
+					if(n < 0) {
+						return -1;
+					}
+					printf("net: Added cue %d\n", n + 1);
+					break;
+				case 'G': // GO
+				case 'B': // BACK
+					cue_command(buf[1]);
+					break;
+				case 'J': // jump to cue
+					REQUIRE_MIN_LENGTH(4);
+					clock_now(&now);
+					pthread_mutex_lock(&stepmtx);
+					int res = cue_jump(buf[2] * 256 + buf[3], cue_ticks(&now));
+					wake_program();
+					pthread_mutex_unlock(&stepmtx);
+					if(res != 0) {
+						return -1;
+					}
+					break;
+				default:
+					return -1;
+			}
+			break;
+		case 'E':
+			REQUIRE_MIN_LENGTH(2);
+			REQUIRE_MIN_LENGTH(2 + buf[1]);
+			struct expr_formula formula;
+			if(expr_compile(&formula, buf_s + 2, buf[1]) != 0) {
+				return -1;
+			}
+			printf("net: Set formula \"%s\"\n", formula.source);
+			pthread_mutex_lock(&stepmtx);
+			int res = set_formula(&formula);
+			wake_program();
+			pthread_mutex_unlock(&stepmtx);
+			if(res != 0) {
+				fprintf(stderr, "net: Too many formulas\n");
+				return -1;
+			}
+			repatched = 1;
+			break;
 		case 'G':
 			REQUIRE_MIN_LENGTH(1);
 			printf("Sending settings to %p\n", c);
 			for(iidx = 0; INPUT_CHANNELS > iidx; iidx++) {
-				char chdesc[2];
-				chdesc[0] = input_index_is_dmx(iidx) ? 'D' : 'M';
-				chdesc[1] = input_index_is_dmx(iidx) ? input_index_to_dmx(iidx) : input_index_to_midi(iidx);
+				char chdesc[4];
+				size_t chlen;
+				if(handlers[iidx].action == HANDLE_NONE || handlers[iidx].action == HANDLE_LED_2CH_COLOR) {
+					continue;
+				}
+				if(input_index_is_netin(iidx)) {
+					chdesc[0] = 'X';
+					chdesc[1] = input_index_to_netin_universe(iidx);
+					chdesc[2] = input_index_to_netin(iidx) / 256;
+					chdesc[3] = input_index_to_netin(iidx) % 256;
+					chlen = 4;
+				} else {
+					chdesc[0] = input_index_is_dmx(iidx) ? 'D' : 'M';
+					chdesc[1] = input_index_is_dmx(iidx) ? input_index_to_dmx(iidx) : input_index_to_midi(iidx);
+					chlen = 2;
+				}
+				client_write(c, chdesc, chlen);
 				switch(handlers[iidx].action) {
 					case HANDLE_NONE:
 						break;
 					case HANDLE_RAW_VALUE:
-						client_printf(c, "%sV%c", chdesc, dmxindex_to_channel(handlers[iidx].data.raw_value.channel));
+						client_printf(c, "V%c", handlers[iidx].data.raw_value.channel);
 						break;
 					case HANDLE_LED_2CH_INTENSITY:
-						client_printf(c, "%s2%c%c", chdesc, dmxindex_to_channel(handlers[iidx].data.led_2ch.other_input), dmxindex_to_channel(handlers[iidx].data.led_2ch.base_channel));
+						// as configured: the other input in the same universe, the first output channel
+						client_printf(c, "2%c%c", channel_of(handlers[iidx].data.led_2ch.other_input), handlers[iidx].data.led_2ch.base_channel);
 						break;
 					case HANDLE_LED_2CH_COLOR:
 						// wordt geconfigt via HANDLE_LED_2CH_INTENSITY
 						break;
 					case HANDLE_MASTER:
-						client_printf(c, "%sM", chdesc);
+						client_printf(c, "M");
 						break;
 					case HANDLE_CHASE:
-						client_printf(c, "%sP", chdesc);
+						client_printf(c, "P");
 						break;
 					case HANDLE_BPM:
-						client_printf(c, "%sB", chdesc);
+						client_printf(c, "B");
 						break;
 					case HANDLE_RUN:
-						client_printf(c, "%sS", chdesc);
+						client_printf(c, "S");
 						break;
 					case HANDLE_BLACKOUT:
-						client_printf(c, "%sD", chdesc);
+						client_printf(c, "D");
+						break;
+					case HANDLE_PRESET:
+						client_printf(c, "Q%c%c%c", handlers[iidx].data.preset.slot, handlers[iidx].data.preset.fade / 256, handlers[iidx].data.preset.fade % 256);
+						break;
+					case HANDLE_CUE_GO:
+						client_printf(c, "G");
+						break;
+					case HANDLE_TAP:
+						client_printf(c, "T");
+						break;
+					case HANDLE_NUDGE:
+						client_printf(c, "N%c", handlers[iidx].data.nudge.kind);
+						break;
+					case HANDLE_CUE_BACK:
+						client_printf(c, "K");
 						break;
 				}
 			}
+			if(audio_path[0] != '\0') {
+				client_printf(c, "A%c%s", (int)strlen(audio_path), audio_path);
+			}
+			if(sync_source != SYNC_INTERNAL) {
+				client_printf(c, "Y%c", sync_source);
+			}
+			if(dmxout_min_channels > 0) {
+				client_printf(c, "L%c%c", dmxout_min_channels / 256, dmxout_min_channels % 256);
+			}
+			pthread_mutex_lock(&stepmtx);
+			for(int i = 0; nformulas > i; i++) {
+				client_printf(c, "E%c%s", (int)strlen(formulas[i].source), formulas[i].source);
+			}
+			client_printf(c, "KN");
+			for(int i = 0; keyframe_count() > i; i++) {
+				const struct keyframe *k = get_keyframe(i);
+				client_printf(c, "KA%c%c%c%c%c%c%c", (int)(k->ms >> 24) & 0xff, (int)(k->ms >> 16) & 0xff, (int)(k->ms >> 8) & 0xff, (int)k->ms & 0xff, k->step / 256, k->step % 256, k->bpm);
+			}
+			client_printf(c, "CN");
+			for(int i = 0; cue_count() > i; i++) {
+				const struct cue *cue = get_cue(i);
+				client_printf(c, "CA%c%c%c%c%c%c%c%c%c%c%c", cue->type, cue->target / 256, cue->target % 256, cue->fade_in / 256, cue->fade_in % 256, cue->fade_out / 256, cue->fade_out % 256, cue->wait / 256, cue->wait % 256, cue->follow / 256, cue->follow % 256);
+			}
+			pthread_mutex_unlock(&stepmtx);
 			break;
 		default:
 			return -1;
 	}
-	if(!receiving_changes) {
+	if(repatched) {
+		update_dmxout_channels();
+	}
+	if(!receiving_changes && !*batch) {
 		flush_dmxout_sendbuf();
 	}
 	return processed;
 }
 #undef REQUIRE_MIN_LENGTH
 
+/*
+ * Everything that comes into the engine passes through here, to be
+ * recorded when a show log is being written.
+ */
+int
+handle_data(struct connection *c, char *buf, size_t len) {
+	struct timespec now;
+	int recording = begin_event(&now);
+	int processed = handle_command(c, buf, len);
+	if(recording) {
+		if(processed > 0) {
+			record_command(recorder, &now, buf, processed);
+		}
+		end_event();
+	}
+	return processed;
+}
+
+void
+update_input(inputidx_t input, unsigned char new) {
+	struct timespec now;
+	int recording = begin_event(&now);
+	apply_input(input, new);
+	if(recording) {
+		record_input(recorder, &now, input, new);
+		end_event();
+	}
+}
+
+/*
+ * OSC messages set inputs: /fader/<0-127> a MIDI fader, /dmx/<1-512> a DMX
+ * input channel and /net/<universe>/<1-512> a network input, universe as
+ * in 'X'. Other addresses are ignored.
+ */
+static void
+osc_input(const struct osc_message *m, void *dummy) {
+	int a, b, n = 0;
+	int level = osc_level(m);
+	inputidx_t iidx;
+
+	if(level == -1) {
+		return;
+	}
+	if(sscanf(m->address, "/fader/%d%n", &a, &n) == 1 && m->address[n] == '\0' && a >= 0 && a < MIDI_CHANNELS) {
+		iidx = midi_to_input_index(a);
+	} else if(sscanf(m->address, "/dmx/%d%n", &a, &n) == 1 && m->address[n] == '\0' && a > 0 && a <= DMX_CHANNELS) {
+		iidx = dmx_to_input_index(a);
+	} else if(sscanf(m->address, "/net/%d/%d%n", &a, &b, &n) == 2 && m->address[n] == '\0' && a >= 0 && a < NETIN_UNIVERSES && b > 0 && b <= DMX_CHANNELS) {
+		iidx = netin_to_input_index(a, b);
+	} else {
+		return;
+	}
+	update_input(iidx, level);
+}
+
+/*
+ * A packet, a message or a bundle, is applied as a whole: nothing of a
+ * malformed one, and in one output frame.
+ */
+int
+handle_osc(const unsigned char *buf, size_t len) {
+	if(osc_parse(buf, len, NULL, NULL) != 0) {
+		return -1;
+	}
+	begin_input_batch();
+	osc_parse(buf, len, osc_input, NULL);
+	end_input_batch();
+	return 0;
+}
+
+void
+update_midi_clock(unsigned char status, int position) {
+	struct timespec now;
+	int recording = begin_event(&now);
+	apply_midi_clock(status, position);
+	if(recording) {
+		record_midi_clock(recorder, &now, status, position);
+		end_event();
+	}
+}
+
+void
+update_mtc_quarter_frame(unsigned char data) {
+	struct timespec now;
+	int recording = begin_event(&now);
+	apply_mtc_quarter_frame(data);
+	if(recording) {
+		record_mtc_quarter_frame(recorder, &now, data);
+		end_event();
+	}
+}
+
+void
+update_mtc_full_frame(const unsigned char *hmsf) {
+	struct timespec now;
+	int recording = begin_event(&now);
+	apply_mtc_full_frame(hmsf);
+	if(recording) {
+		record_mtc_full_frame(recorder, &now, hmsf);
+		end_event();
+	}
+}
+
+/*
+ * Program position: the step on stage, and the last step boundary of the
+ * beat clock that has been passed. Only touched with stepmtx held.
+ */
+int programma_position = 0;
+long step_boundary = 0;
+
+/*
+ * Every frame that is sent also goes to the shared memory snapshot. Must be
+ * called with dmxout_sendbuf_mtx held, which keeps its writers apart.
+ */
+static void
+publish_snapshot(const struct timespec *now) {
+	struct snapshot_meta meta;
+	meta.time = *now;
+	meta.step = programma_position;
+	meta.steps = programma_steps;
+	meta.bpm = tempo.bpm;
+	meta.master = master_intensity;
+	meta.blackout = master_blackout != -1;
+	meta.running = program_running;
+	snapshot_publish(dmxout_sendbuf, dmxout_channels, &meta);
+}
+
+static void
+start_program_clock(const struct timespec *now) {
+	step_boundary = floor(tempo_beat(&tempo, now) * steps_per_beat());
+}
+
+/*
+ * Compose one output frame for the current step and send it. Must be
+ * called with stepmtx held.
+ */
+static void
+render_frame(const struct timespec *now) {
+	int dmxidx, level_in, level_out;
+	cue_tick(cue_ticks(now));
+	if(programma_jump >= 0) {
+		programma_position = (programma_jump < programma_steps) ? programma_jump : 0;
+		generator_step = programma_jump;
+		programma_jump = -1;
+		start_program_clock(now);
+	}
+	if(programma_position >= programma_steps) {
+		programma_position = 0;
+	}
+	level_in = preset_fade_level(now, preset_fade_in);
+	level_out = preset_fade_level(now, preset_fade_out);
+	if(preset_fading && level_in == 255 && level_out == 255) {
+		preset_from = NULL;
+		preset_fading = 0;
+		update_dmxout_channels();
+	}
+	if(generator != NULL && generated_step != generator_step) {
+		generate_step(generator, generator_step, (unsigned char *)programma[0]);
+		generated_step = generator_step;
+	}
+	unsigned char *stepdata = (programma != NULL) ? (unsigned char *)programma_step(programma, programma_channels, programma_position) : NULL;
+	pthread_mutex_lock(&dmxout_sendbuf_mtx);
+	for(dmxidx = 0; DMX_CHANNELS > dmxidx; dmxidx++) {
+		int value;
+		if(CHFLAG_GET_OVERRIDE_PROGRAMMA(dmxidx) || dmxidx >= programma_channels) {
+			value = channel_overrides[dmxidx];
+		} else {
+			value = apply_intensity(stepdata[dmxidx], program_intensity);
+		}
+		value = apply_intensity(value, channel_intensity[dmxidx]);
+		channel_look[dmxidx] = value;
+		if(preset_to != NULL || preset_from != NULL) {
+			int a = (preset_from != NULL && preset_from->mask[dmxidx]) ? preset_from->values[dmxidx] : value;
+			int b = (preset_to != NULL && preset_to->mask[dmxidx]) ? preset_to->values[dmxidx] : value;
+			value = a + (b - a) * (b >= a ? level_in : level_out) / 255;
+		}
+		if(!CHFLAG_GET_IGNORE_MASTER(dmxidx)) {
+			value = apply_intensity(value, master_intensity);
+		}
+		dmxout_sendbuf[dmxidx] = value;
+	}
+	if(nformulas > 0) {
+		run_formulas(programma_position, now);
+	}
+	if(input_batches > 0) {
+		// sent when the last batch ends
+		dmxout_dirty = 1;
+		pthread_mutex_unlock(&dmxout_sendbuf_mtx);
+		return;
+	}
+	// the network outputs go on while the widget is lost
+	send_dmx(dmxout_sendbuf, dmxout_channels);
+	if(recorder != NULL) {
+		record_frame(recorder, RECORD_FRAME, now, dmxout_sendbuf, dmxout_channels);
+	}
+	update_websockets(0, 1, 0);
+	publish_snapshot(now);
+	if(mk2c_lost) {
+		dmxout_dirty = 1;
+		pthread_mutex_unlock(&dmxout_sendbuf_mtx);
+		reconnect_if_needed();
+	} else {
+		pthread_mutex_unlock(&dmxout_sendbuf_mtx);
+	}
+}
+
+/*
+ * When the next frame is due: at the next step boundary, or one frame
+ * interval from now while something is changing over time.
+ */
+static void
+next_frame_time(const struct timespec *now, struct timespec *wakeup) {
+	struct timespec next = *now;
+	tempo_time_of(&tempo, (step_boundary + 1) / steps_per_beat(), now, &nextstep);
+	*wakeup = nextstep;
+	if(rendering_continuously()) {
+		// formulas and fades change over time, so keep rendering frames
+		next.tv_nsec += FRAME_INTERVAL;
+		next.tv_sec += next.tv_nsec / 1000000000L;
+		next.tv_nsec %= 1000000000L;
+		if(!timespec_reached(&next, &nextstep)) {
+			*wakeup = next;
+		}
+	}
+}
+
+/*
+ * Step the program for every step boundary the beat clock has passed.
+ */
+static void
+advance_program(const struct timespec *now) {
+	long b = floor(tempo_beat(&tempo, now) * steps_per_beat());
+	if(b != step_boundary) {
+		// a phase correction can also move the clock back a little
+		if(b > step_boundary && program_running && (sync_source != SYNC_TIMECODE || mtc_running(&mtc, now))) {
+			programma_position++;
+			generator_step++;
+			set_feedback_step();
+		}
+		step_boundary = b;
+	}
+}
+
+/*
+ * One round of the program runner: step the program, render a frame and
+ * work out when the next one is due. The program is stepped and rendered
+ * at the same time, so a replay of a show log only needs the time of each
+ * frame. Must be called with stepmtx held.
+ */
+void
+run_program(const struct timespec *now, struct timespec *wakeup) {
+	program_woken = 0;
+	advance_program(now);
+	render_frame(now);
+	next_frame_time(now, wakeup);
+}
+
 void *
 prog_runner(void *dummy) {
+	struct timespec now, wakeup;
+	int recording = 0;
 	pthread_mutex_lock(&stepmtx);
-	clock_gettime(CLOCK_REALTIME, &nextstep);
 	while(1) {
-		int step = 0;
-		while(programma_steps > step) {
-			int dmxidx;
-			pthread_mutex_lock(&dmxout_sendbuf_mtx);
-			for(dmxidx = 0; DMX_CHANNELS > dmxidx; dmxidx++) {
-				if(CHFLAG_GET_OVERRIDE_PROGRAMMA(dmxidx) || dmxidx >= programma_channels) {
-					dmxout_sendbuf[dmxidx] = channel_overrides[dmxidx];
-				} else {
-					dmxout_sendbuf[dmxidx] = apply_intensity(programma[step * programma_channels + dmxidx], program_intensity);
-				}
-				dmxout_sendbuf[dmxidx] = apply_intensity(dmxout_sendbuf[dmxidx], channel_intensity[dmxidx]);
-				if(!CHFLAG_GET_IGNORE_MASTER(dmxidx)) {
-					dmxout_sendbuf[dmxidx] = apply_intensity(dmxout_sendbuf[dmxidx], master_intensity);
-				}
-			}
-			if(mk2c_lost) {
-				dmxout_dirty = 1;
-				pthread_mutex_unlock(&dmxout_sendbuf_mtx);
-				reconnect_if_needed();
-			} else {
-				send_dmx(dmxout_sendbuf);
-				update_websockets(1, 0);
-				pthread_mutex_unlock(&dmxout_sendbuf_mtx);
-			}
-
-			printf("[prog] pthread_cond_timedwait(&stepcond, &stepmtx, { %d, %ld });\n", (int)nextstep.tv_sec, nextstep.tv_nsec);
-			int res = pthread_cond_timedwait(&stepcond, &stepmtx, &nextstep);
-			if(res == ETIMEDOUT) {
-				increment_timespec(&nextstep, programma_wait);
-				if(program_running) {
-					step++;
-					set_feedback_step();
-				}
-			}
-			watchdog_prog_pong = 1;
+		if(recorder != NULL) {
+			// the recorder lock comes before stepmtx
+			pthread_mutex_unlock(&stepmtx);
+			recording = begin_event(&now);
+			pthread_mutex_lock(&stepmtx);
+		}
+		clock_now(&now);
+		run_program(&now, &wakeup);
+		if(recording) {
+			end_event();
 		}
+		clock_wait(&stepcond, &stepmtx, &wakeup);
+		watchdog_prog_pong = 1;
 	}
 	pthread_mutex_unlock(&stepmtx);
 	return NULL;
 }
 
+/*
+ * Feeds the beat tracker from the audio input. Regular files are paced to
+ * real time and start over at the end, like a looping soundtrack.
+ */
 void *
-watchdog_runner(void *dummy) {
-	int ok = 1;
-	pid_t parent;
-	while(1) {
-		watchdog_dmx_pong = 0;
-		watchdog_net_pong = 0;
-		watchdog_prog_pong = 0;
-		wakeup_select();
+audio_runner(void *dummy) {
+	struct audio_source src;
+	struct beattrack *bt;
+	struct timespec now;
+	short block[BT_HOP];
+	char path[sizeof(audio_path)];
+	int generation, n;
+	double beat, target;
 
-		sleep(5);
-
-		if(!watchdog_dmx_pong) {
-			fprintf(stderr, "Watchdog: DMX thread not responding\n");
-			ok = 0;
-		}
-		if(!watchdog_net_pong) {
-			fprintf(stderr, "Watchdog: Network thread not responding\n");
-			ok = 0;
-		}
-		if(!watchdog_prog_pong) {
-			fprintf(stderr, "Watchdog: Program thread not responding\n");
-			ok = 0;
+	bt = malloc(sizeof(struct beattrack));
+	assert(bt != NULL);
+	while(1) {
+		pthread_mutex_lock(&stepmtx);
+		strcpy(path, audio_path);
+		generation = audio_generation;
+		pthread_mutex_unlock(&stepmtx);
+		if(path[0] == '\0' || audio_open(&src, path, 1) != 0) {
+			sleep(1);
+			continue;
 		}
-		if(ok) {
-			parent = getppid();
-			if(parent != 1) {
-				kill(parent, SIGWINCH);
+		beattrack_init(bt, src.rate);
+		while(generation == audio_generation && (n = audio_read(&src, block, BT_HOP)) > 0) {
+			if(!beattrack_feed(bt, block, n)) {
+				continue;
 			}
+			pthread_mutex_lock(&stepmtx);
+			audio_bpm = bt->bpm;
+			audio_confidence = bt->confidence;
+			if(sync_source == SYNC_AUDIO && bt->confidence >= AUDIO_MIN_CONFIDENCE) {
+				// only the phase is known, so aim for the nearest beat position with that phase
+				clock_now(&now);
+				beat = tempo_beat(&tempo, &now);
+				target = floor(beat) + bt->phase;
+				if(target - beat > 0.5) {
+					target -= 1;
+				} else if(beat - target > 0.5) {
+					target += 1;
+				}
+				tempo_sync(&tempo, target, bt->bpm, &now);
+			}
+			pthread_mutex_unlock(&stepmtx);
+		}
+		audio_close(&src);
+		if(generation == audio_generation) {
+			sleep(1);
 		}
 	}
+	free(bt);
 	return NULL;
 }
 
@@ -618,33 +1942,38 @@ read_config_file(char *filename) {
 	return ret;
 }
 
-int
-main(int argc, char **argv) {
+/*
+ * Set up the engine state; the caller still has to open the preset arena
+ * and read the configuration.
+ */
+void
+init_engine(void) {
 	pthread_mutex_init(&dmxout_sendbuf_mtx, NULL);
 	pthread_mutex_init(&stepmtx, NULL);
-	pthread_cond_init(&stepcond, NULL);
+	clock_cond_init(&stepcond);
 	reset_vars();
+	clock_now(&started);
+	init_cues(apply_cue, 0);
+	midiclock_init(&midiclock);
+	mtc_init(&mtc);
+	tempo_init(&tempo, 60, &started);
+}
 
-	read_config_file("config.dat");
-
-	init_communications();
-	init_net();
-
-	set_feedback_running(program_running);
-	set_feedback_blackout(master_blackout != -1);
-
-	pthread_create(&netthr, NULL, net_runner, NULL);
-	pthread_create(&progthr, NULL, prog_runner, NULL);
-
-	send_dmx(dmxout_sendbuf);
-
-	watchdog_runner(NULL);
-
-	pre_deinit_net();
-
-	void *ret = NULL;
-	pthread_join(netthr, &ret);
-	deinit_net();
-	pthread_join(progthr, &ret);
-	return 0;
+/*
+ * Record everything from here on to a new show log, starting with the
+ * presets. Must be called before any input is handled.
+ */
+int
+start_recording(const char *filename) {
+	struct timespec now;
+	struct recorder *r = malloc(sizeof(struct recorder));
+	if(r == NULL || !recorder_open(r, filename, &started)) {
+		free(r);
+		return 0;
+	}
+	clock_now(&now);
+	record_presets(r, &now, (unsigned char *)presets, PRESET_SLOTS * sizeof(struct preset));
+	recorder = r;
+	printf("recorder: Recording to %s\n", filename);
+	return 1;
 }
@@ -1,12 +1,25 @@
+struct timespec;
+
 /* dmxd.c */
+void init_engine(void);
+int read_config_file(char *filename);
+int start_recording(const char *filename);
+void run_program(const struct timespec *now, struct timespec *wakeup);
+void *prog_runner(void *dummy);
+void *audio_runner(void *dummy);
 void update_input(inputidx_t input, unsigned char value);
+void update_midi_clock(unsigned char status, int position);
+void update_mtc_quarter_frame(unsigned char data);
+void update_mtc_full_frame(const unsigned char *hmsf);
 void flush_dmxout_sendbuf(void);
-void update_websockets(int dmx1, int dmx2);
+void begin_input_batch(void);
+void end_input_batch(void);
+void update_websockets(int dmx1, int dmx2, int midi);
 void error_step(void);
 
 
 /* input.c */
-int send_dmx(unsigned char *dmxbytes);
+int send_dmx(unsigned char *dmxbytes, int channels);
 void reconnect_if_needed(void);
 int init_communications(void);
 void set_feedback_running(int);
@@ -115,14 +115,20 @@ send_msg(struct ftdi_context *ftdic, int label, unsigned char *prepared_buffer,
 
 
 /*
- * Send DMX data from the provided buffer dmxbytes.
- * Buffer HAS TO BE 512 bytes (or longer, only 512 bytes will be used).
+ * Send the first channels DMX channels from the provided buffer dmxbytes.
+ * Shorter frames refresh faster; the widget needs at least 24 channels, so
+ * frames are padded from dmxbytes up to that.
  * DMX channels are 0-based in the buffer (DMX channel 1 == dmxbytes[0]).
  */
 int
-mk2_send_dmx(struct mk2_pro_context *mk2c, unsigned char *dmxbytes) {
+mk2_send_dmx(struct mk2_pro_context *mk2c, unsigned char *dmxbytes, int channels) {
 	int ret;
-	unsigned char *messagebuffer = prepare_msg_buffer(1 + DMX_PACKET_SIZE);
+	if (channels < DMX_MIN_PACKET_SIZE) {
+		channels = DMX_MIN_PACKET_SIZE;
+	} else if (channels > DMX_PACKET_SIZE) {
+		channels = DMX_PACKET_SIZE;
+	}
+	unsigned char *messagebuffer = prepare_msg_buffer(1 + channels);
 	if (messagebuffer == NULL) {
 		fprintf(stderr, "send_dmx: Failed to allocate space for prepared buffer.\n");
 		return -2;
@@ -130,10 +136,10 @@ mk2_send_dmx(struct mk2_pro_context *mk2c, unsigned char *dmxbytes) {
 
 	// First byte has to be 0
 	messagebuffer[0] = 0;
-	memcpy(messagebuffer + 1, dmxbytes, DMX_PACKET_SIZE);
+	memcpy(messagebuffer + 1, dmxbytes, channels);
 
 	// send the array here
-	ret = send_msg(mk2c->ftdic, mk2c->device_type == ENTTEC_DMX_USB_PRO_MK2 ? SEND_DMX_2 : SEND_DMX_1, messagebuffer, 1 + DMX_PACKET_SIZE);
+	ret = send_msg(mk2c->ftdic, mk2c->device_type == ENTTEC_DMX_USB_PRO_MK2 ? SEND_DMX_2 : SEND_DMX_1, messagebuffer, 1 + channels);
 	if (ret < 0)
 	{
 		fprintf(stderr, "send_dmx: Failed to send DMX\n");
@@ -17,5 +17,5 @@ struct mk2_pro_context;
 
 struct mk2_pro_context * init_dmx_usb_mk2_pro(dmx_update_callback_t update_callback, dmx_commit_callback_t commit_callback, dmx_error_callback_t error_callback);
 void teardown_dmx_usb_mk2_pro(struct mk2_pro_context *mk2c);
-int mk2_send_dmx(struct mk2_pro_context *mk2c, unsigned char *dmxbytes);
+int mk2_send_dmx(struct mk2_pro_context *mk2c, unsigned char *dmxbytes, int channels);
 #endif
@@ -0,0 +1,429 @@
+#include <assert.h>
+#include <ctype.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "schaeckeling.h"
+#include "expr.h"
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+enum expr_op {
+	OP_CONST, OP_INPUT, OP_CHANNEL, OP_VAR,
+	OP_ADD, OP_SUB, OP_MUL, OP_DIV, OP_MOD, OP_NEG,
+	OP_LT, OP_LE, OP_GT, OP_GE, OP_EQ, OP_NE, OP_SELECT,
+	OP_SIN, OP_COS, OP_ABS, OP_FLOOR, OP_FRAC, OP_MIN, OP_MAX,
+	OP_STORE
+};
+
+struct expr_parser {
+	const char *src;
+	const char *p;
+	struct expr_formula *f;
+	int depth;
+	const char *error;
+	char errbuf[16];
+};
+
+static int parse_expr(struct expr_parser *ps);
+
+static int
+stack_effect(int op) {
+	switch(op) {
+		case OP_CONST: case OP_INPUT: case OP_CHANNEL: case OP_VAR:
+			return 1;
+		case OP_NEG: case OP_SIN: case OP_COS: case OP_ABS: case OP_FLOOR: case OP_FRAC:
+			return 0;
+		case OP_SELECT:
+			return -2;
+		default:
+			return -1;
+	}
+}
+
+static int
+emit(struct expr_parser *ps, int op, int arg, float value) {
+	struct expr_formula *f = ps->f;
+	// one slot stays free for the final OP_STORE
+	if(f->ninsns >= EXPR_MAX_INSNS - 1) {
+		ps->error = "formula too long";
+		return -1;
+	}
+	ps->depth += stack_effect(op);
+	if(ps->depth > EXPR_MAX_STACK) {
+		ps->error = "formula nested too deeply";
+		return -1;
+	}
+	f->code[f->ninsns].op = op;
+	f->code[f->ninsns].arg = arg;
+	f->code[f->ninsns].value = value;
+	f->ninsns++;
+	return 0;
+}
+
+static void
+skip_space(struct expr_parser *ps) {
+	while(isspace((unsigned char)*ps->p)) {
+		ps->p++;
+	}
+}
+
+static int
+expect(struct expr_parser *ps, char c) {
+	skip_space(ps);
+	if(*ps->p != c) {
+		snprintf(ps->errbuf, sizeof(ps->errbuf), "expected '%c'", c);
+		ps->error = ps->errbuf;
+		return -1;
+	}
+	ps->p++;
+	return 0;
+}
+
+static int
+parse_int(struct expr_parser *ps, int *out) {
+	char *end;
+	skip_space(ps);
+	if(!isdigit((unsigned char)*ps->p)) {
+		ps->error = "expected a channel number";
+		return -1;
+	}
+	*out = (int)strtol(ps->p, &end, 10);
+	ps->p = end;
+	return 0;
+}
+
+static int
+parse_call(struct expr_parser *ps, int op, int nargs) {
+	if(expect(ps, '(') != 0 || parse_expr(ps) != 0) {
+		return -1;
+	}
+	if(nargs == 2 && (expect(ps, ',') != 0 || parse_expr(ps) != 0)) {
+		return -1;
+	}
+	if(expect(ps, ')') != 0) {
+		return -1;
+	}
+	return emit(ps, op, 0, 0);
+}
+
+static int
+parse_channel_ref(struct expr_parser *ps, int *n, int first, int last) {
+	if(expect(ps, '(') != 0 || parse_int(ps, n) != 0 || expect(ps, ')') != 0) {
+		return -1;
+	}
+	if(*n < first || *n > last) {
+		ps->error = "channel number out of range";
+		return -1;
+	}
+	return 0;
+}
+
+static int
+parse_primary(struct expr_parser *ps) {
+	char name[16];
+	int len = 0, n;
+
+	skip_space(ps);
+	if(*ps->p == '(') {
+		ps->p++;
+		if(parse_expr(ps) != 0) {
+			return -1;
+		}
+		return expect(ps, ')');
+	}
+	if(isdigit((unsigned char)*ps->p) || *ps->p == '.') {
+		char *end;
+		float value = strtof(ps->p, &end);
+		if(end == ps->p) {
+			ps->error = "invalid number";
+			return -1;
+		}
+		ps->p = end;
+		return emit(ps, OP_CONST, 0, value);
+	}
+	while(isalnum((unsigned char)ps->p[len]) || ps->p[len] == '_') {
+		if(len == sizeof(name) - 1) {
+			ps->error = "unknown name";
+			return -1;
+		}
+		name[len] = ps->p[len];
+		len++;
+	}
+	name[len] = '\0';
+	if(len == 0) {
+		ps->error = "unexpected character";
+		return -1;
+	}
+	ps->p += len;
+
+	if(strcmp(name, "master") == 0) {
+		return emit(ps, OP_VAR, EXPR_VAR_MASTER, 0);
+	} else if(strcmp(name, "beat") == 0) {
+		return emit(ps, OP_VAR, EXPR_VAR_BEAT, 0);
+	} else if(strcmp(name, "step") == 0) {
+		return emit(ps, OP_VAR, EXPR_VAR_STEP, 0);
+	} else if(strcmp(name, "time") == 0) {
+		return emit(ps, OP_VAR, EXPR_VAR_TIME, 0);
+	} else if(strcmp(name, "pi") == 0) {
+		return emit(ps, OP_CONST, 0, M_PI);
+	} else if(strcmp(name, "fader") == 0) {
+		if(parse_channel_ref(ps, &n, 0, MIDI_CHANNELS - 1) != 0) {
+			return -1;
+		}
+		return emit(ps, OP_INPUT, midi_to_input_index(n), 0);
+	} else if(strcmp(name, "dmx") == 0) {
+		if(parse_channel_ref(ps, &n, 1, DMX_CHANNELS) != 0) {
+			return -1;
+		}
+		return emit(ps, OP_INPUT, dmx_to_input_index(n), 0);
+	} else if(strcmp(name, "ch") == 0) {
+		if(parse_channel_ref(ps, &n, 1, DMX_CHANNELS) != 0) {
+			return -1;
+		}
+		return emit(ps, OP_CHANNEL, n - 1, 0);
+	} else if(strcmp(name, "sin") == 0) {
+		return parse_call(ps, OP_SIN, 1);
+	} else if(strcmp(name, "cos") == 0) {
+		return parse_call(ps, OP_COS, 1);
+	} else if(strcmp(name, "abs") == 0) {
+		return parse_call(ps, OP_ABS, 1);
+	} else if(strcmp(name, "floor") == 0) {
+		return parse_call(ps, OP_FLOOR, 1);
+	} else if(strcmp(name, "frac") == 0) {
+		return parse_call(ps, OP_FRAC, 1);
+	} else if(strcmp(name, "min") == 0) {
+		return parse_call(ps, OP_MIN, 2);
+	} else if(strcmp(name, "max") == 0) {
+		return parse_call(ps, OP_MAX, 2);
+	}
+	ps->p -= len;
+	ps->error = "unknown name";
+	return -1;
+}
+
+static int
+parse_unary(struct expr_parser *ps) {
+	skip_space(ps);
+	if(*ps->p == '-') {
+		ps->p++;
+		if(parse_unary(ps) != 0) {
+			return -1;
+		}
+		return emit(ps, OP_NEG, 0, 0);
+	}
+	return parse_primary(ps);
+}
+
+static int
+parse_product(struct expr_parser *ps) {
+	if(parse_unary(ps) != 0) {
+		return -1;
+	}
+	while(1) {
+		int op;
+		skip_space(ps);
+		switch(*ps->p) {
+			case '*': op = OP_MUL; break;
+			case '/': op = OP_DIV; break;
+			case '%': op = OP_MOD; break;
+			default: return 0;
+		}
+		ps->p++;
+		if(parse_unary(ps) != 0 || emit(ps, op, 0, 0) != 0) {
+			return -1;
+		}
+	}
+}
+
+static int
+parse_sum(struct expr_parser *ps) {
+	if(parse_product(ps) != 0) {
+		return -1;
+	}
+	while(1) {
+		int op;
+		skip_space(ps);
+		switch(*ps->p) {
+			case '+': op = OP_ADD; break;
+			case '-': op = OP_SUB; break;
+			default: return 0;
+		}
+		ps->p++;
+		if(parse_product(ps) != 0 || emit(ps, op, 0, 0) != 0) {
+			return -1;
+		}
+	}
+}
+
+static int
+parse_compare(struct expr_parser *ps) {
+	int op;
+	if(parse_sum(ps) != 0) {
+		return -1;
+	}
+	skip_space(ps);
+	if(ps->p[0] == '<' && ps->p[1] == '=') {
+		op = OP_LE;
+	} else if(ps->p[0] == '>' && ps->p[1] == '=') {
+		op = OP_GE;
+	} else if(ps->p[0] == '=' && ps->p[1] == '=') {
+		op = OP_EQ;
+	} else if(ps->p[0] == '!' && ps->p[1] == '=') {
+		op = OP_NE;
+	} else if(ps->p[0] == '<') {
+		op = OP_LT;
+	} else if(ps->p[0] == '>') {
+		op = OP_GT;
+	} else {
+		return 0;
+	}
+	ps->p += (op == OP_LT || op == OP_GT) ? 1 : 2;
+	if(parse_sum(ps) != 0) {
+		return -1;
+	}
+	return emit(ps, op, 0, 0);
+}
+
+static int
+parse_expr(struct expr_parser *ps) {
+	if(parse_compare(ps) != 0) {
+		return -1;
+	}
+	skip_space(ps);
+	if(*ps->p != '?') {
+		return 0;
+	}
+	ps->p++;
+	if(parse_expr(ps) != 0 || expect(ps, ':') != 0 || parse_expr(ps) != 0) {
+		return -1;
+	}
+	return emit(ps, OP_SELECT, 0, 0);
+}
+
+/*
+ * Compile "chN = <expression>" into f. Returns 0 on success, or -1 after
+ * printing what was wrong; f is left in an unspecified state on failure.
+ * A bare "chN =" compiles to zero instructions, meaning "no formula".
+ */
+int
+expr_compile(struct expr_formula *f, const char *src, int len) {
+	struct expr_parser ps;
+
+	if(len > EXPR_MAX_SOURCE) {
+		fprintf(stderr, "expr: formula too long (%d bytes)\n", len);
+		return -1;
+	}
+	memcpy(f->source, src, len);
+	f->source[len] = '\0';
+	f->ninsns = 0;
+
+	ps.src = f->source;
+	ps.p = f->source;
+	ps.f = f;
+	ps.depth = 0;
+	ps.error = NULL;
+
+	skip_space(&ps);
+	if(strncmp(ps.p, "ch", 2) != 0) {
+		ps.error = "expected 'chN ='";
+	} else {
+		ps.p += 2;
+		if(parse_int(&ps, &f->channel) == 0 && expect(&ps, '=') == 0) {
+			skip_space(&ps);
+			if(f->channel < 1 || f->channel > DMX_CHANNELS) {
+				ps.error = "channel number out of range";
+			} else if(*ps.p == '\0') {
+				// "chN =" without an expression removes the formula
+				return 0;
+			} else if(parse_expr(&ps) == 0) {
+				skip_space(&ps);
+				if(*ps.p != '\0') {
+					ps.error = "trailing characters";
+				}
+			}
+		}
+	}
+	if(ps.error != NULL) {
+		fprintf(stderr, "expr: %s at position %d in \"%s\"\n", ps.error, (int)(ps.p - ps.src), ps.src);
+		return -1;
+	}
+
+	assert(ps.depth == 1);
+	f->code[f->ninsns].op = OP_STORE;
+	f->code[f->ninsns].arg = f->channel - 1;
+	f->code[f->ninsns].value = 0;
+	f->ninsns++;
+	return 0;
+}
+
+/*
+ * Concatenate all formulas into one program, in the order given. A formula
+ * that reads ch(n) sees the result of any earlier formula for channel n.
+ */
+void
+expr_link(struct expr_program *prog, const struct expr_formula *formulas, int nformulas) {
+	int i;
+	assert(nformulas <= EXPR_MAX_FORMULAS);
+	prog->ninsns = 0;
+	for(i = 0; nformulas > i; i++) {
+		memcpy(prog->code + prog->ninsns, formulas[i].code, formulas[i].ninsns * sizeof(struct expr_insn));
+		prog->ninsns += formulas[i].ninsns;
+	}
+}
+
+/*
+ * Run all linked formulas once, reading and writing the output buffer out.
+ * Stack depth was checked at compile time, so there are no checks here.
+ */
+void
+expr_run(const struct expr_program *prog, const struct expr_env *env, unsigned char *out) {
+	float stack[EXPR_MAX_STACK];
+	float *sp = stack;
+	const struct expr_insn *insn = prog->code;
+	const struct expr_insn *end = prog->code + prog->ninsns;
+
+	for(; insn < end; insn++) {
+		switch(insn->op) {
+			case OP_CONST: *sp++ = insn->value; break;
+			case OP_INPUT: *sp++ = env->inputbuf[insn->arg] * (1.0f / 255); break;
+			case OP_CHANNEL: *sp++ = out[insn->arg] * (1.0f / 255); break;
+			case OP_VAR: *sp++ = env->vars[insn->arg]; break;
+			case OP_ADD: sp--; sp[-1] += sp[0]; break;
+			case OP_SUB: sp--; sp[-1] -= sp[0]; break;
+			case OP_MUL: sp--; sp[-1] *= sp[0]; break;
+			case OP_DIV: sp--; sp[-1] /= sp[0]; break;
+			case OP_MOD: sp--; sp[-1] = fmodf(sp[-1], sp[0]); break;
+			case OP_NEG: sp[-1] = -sp[-1]; break;
+			case OP_LT: sp--; sp[-1] = sp[-1] < sp[0]; break;
+			case OP_LE: sp--; sp[-1] = sp[-1] <= sp[0]; break;
+			case OP_GT: sp--; sp[-1] = sp[-1] > sp[0]; break;
+			case OP_GE: sp--; sp[-1] = sp[-1] >= sp[0]; break;
+			case OP_EQ: sp--; sp[-1] = sp[-1] == sp[0]; break;
+			case OP_NE: sp--; sp[-1] = sp[-1] != sp[0]; break;
+			case OP_SELECT: sp -= 2; sp[-1] = (sp[-1] != 0) ? sp[0] : sp[1]; break;
+			case OP_SIN: sp[-1] = sinf(sp[-1]); break;
+			case OP_COS: sp[-1] = cosf(sp[-1]); break;
+			case OP_ABS: sp[-1] = fabsf(sp[-1]); break;
+			case OP_FLOOR: sp[-1] = floorf(sp[-1]); break;
+			case OP_FRAC: sp[-1] -= floorf(sp[-1]); break;
+			case OP_MIN: sp--; sp[-1] = (sp[0] < sp[-1]) ? sp[0] : sp[-1]; break;
+			case OP_MAX: sp--; sp[-1] = (sp[0] > sp[-1]) ? sp[0] : sp[-1]; break;
+			case OP_STORE:
+				sp--;
+				// also catches NaN
+				if(!(sp[0] > 0)) {
+					out[insn->arg] = 0;
+				} else if(sp[0] >= 1) {
+					out[insn->arg] = 255;
+				} else {
+					out[insn->arg] = (unsigned char)(sp[0] * 255 + 0.5f);
+				}
+				break;
+		}
+	}
+	assert(sp == stack);
+}
@@ -0,0 +1,47 @@
+#ifndef EXPR_H
+#define EXPR_H
+
+/*
+ * Per-channel formulas, e.g. "ch12 = fader(3) * sin(beat * 2 * pi) * master".
+ *
+ * A formula is compiled once into a short stack program. All active formulas
+ * are then linked into one flat array that is run once per rendered frame.
+ * Values are normalized: inputs and channels read as 0..1, the result is
+ * clamped to 0..1 and scaled to 0..255 before it is stored.
+ */
+
+#define EXPR_MAX_FORMULAS	64
+#define EXPR_MAX_INSNS		32
+#define EXPR_MAX_STACK		16
+#define EXPR_MAX_SOURCE		255
+
+enum expr_var { EXPR_VAR_MASTER, EXPR_VAR_BEAT, EXPR_VAR_STEP, EXPR_VAR_TIME, EXPR_VARS };
+
+struct expr_insn {
+	unsigned char op;
+	short arg;
+	float value;
+};
+
+struct expr_formula {
+	int channel;
+	int ninsns;
+	struct expr_insn code[EXPR_MAX_INSNS];
+	char source[EXPR_MAX_SOURCE + 1];
+};
+
+struct expr_program {
+	int ninsns;
+	struct expr_insn code[EXPR_MAX_FORMULAS * EXPR_MAX_INSNS];
+};
+
+struct expr_env {
+	const unsigned char *inputbuf;
+	float vars[EXPR_VARS];
+};
+
+int expr_compile(struct expr_formula *f, const char *src, int len);
+void expr_link(struct expr_program *prog, const struct expr_formula *formulas, int nformulas);
+void expr_run(const struct expr_program *prog, const struct expr_env *env, unsigned char *out);
+
+#endif
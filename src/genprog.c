@@ -0,0 +1,99 @@
+#include <assert.h>
+#include <math.h>
+#include <string.h>
+#include "genprog.h"
+
+typedef unsigned long long rng_t;
+
+/*
+ * splitmix64: good enough randomness from a counter, which is all that is
+ * needed to make every step independent of the ones before it.
+ */
+static unsigned long
+rng_next(rng_t *state) {
+	rng_t z = (*state += 0x9e3779b97f4a7c15ULL);
+	z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+	z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+	return (z ^ (z >> 31)) & 0xffffffffUL;
+}
+
+static int
+rng_below(rng_t *state, int n) {
+	return rng_next(state) % n;
+}
+
+int
+generator_channels(const struct generator *g) {
+	return g->lamps * GEN_CHANNELS_PER_LAMP;
+}
+
+static enum gen_mode
+pick_mode(const struct generator *g, rng_t *state) {
+	int weights[GEN_MODES], total = 0, m, r;
+	for(m = 0; GEN_MODES > m; m++) {
+		weights[m] = g->weights[m];
+		if(m == GEN_GROUPED && g->lamps < 4) {
+			weights[m] = 0;
+		}
+		total += weights[m];
+	}
+	if(total == 0) {
+		return GEN_RANDOM;
+	}
+	r = rng_below(state, total);
+	for(m = 0; GEN_MODES - 1 > m && r >= weights[m]; m++) {
+		r -= weights[m];
+	}
+	return m;
+}
+
+void
+generate_step(const struct generator *g, unsigned long step, unsigned char *out) {
+	rng_t state = ((rng_t)g->seed << 32) ^ step;
+	int colors[GEN_MAX_LAMPS], order[GEN_MAX_LAMPS];
+	int lamp, i, group, color = 0;
+
+	assert(g->lamps > 0 && g->lamps <= GEN_MAX_LAMPS);
+	assert(g->ncolors > 0 && g->ncolors <= GEN_MAX_COLORS);
+	rng_next(&state);
+
+	switch(pick_mode(g, &state)) {
+		case GEN_ALL:
+			color = rng_below(&state, g->ncolors);
+			for(lamp = 0; g->lamps > lamp; lamp++) {
+				colors[lamp] = color;
+			}
+			break;
+		case GEN_GROUPED:
+			for(lamp = 0; g->lamps > lamp; lamp++) {
+				order[lamp] = lamp;
+			}
+			for(lamp = g->lamps - 1; lamp > 0; lamp--) {
+				i = rng_below(&state, lamp + 1);
+				int tmp = order[lamp];
+				order[lamp] = order[i];
+				order[i] = tmp;
+			}
+			group = floor(sqrt(g->lamps) + 0.5);
+			for(i = 0; g->lamps > i; i++) {
+				if(i % group == 0) {
+					color = rng_below(&state, g->ncolors);
+				}
+				colors[order[i]] = color;
+			}
+			break;
+		default:
+			for(lamp = 0; g->lamps > lamp; lamp++) {
+				colors[lamp] = rng_below(&state, g->ncolors);
+			}
+			break;
+	}
+
+	memset(out, 0, generator_channels(g));
+	for(lamp = 0; g->lamps > lamp; lamp++) {
+		for(i = 0; 3 > i; i++) {
+			int v = g->palette[colors[lamp]][i] * g->intensity[lamp];
+			out[lamp * GEN_CHANNELS_PER_LAMP + i] = (v + 127) / 255;
+		}
+	}
+}
@@ -0,0 +1,31 @@
+#ifndef GENPROG_H
+#define GENPROG_H
+
+/*
+ * Generative programs, the built-in version of generate-programma.php.
+ * Every step colours the lamps in one of three modes: all lamps the same
+ * colour, lamps in random groups of about sqrt(lamps) sharing a colour, or
+ * every lamp its own colour. A step is a pure function of the seed and the
+ * step number, so nothing is stored per step and a step seen again after a
+ * jump looks the same as the first time.
+ */
+
+#define GEN_MAX_LAMPS		64
+#define GEN_MAX_COLORS		32
+#define GEN_CHANNELS_PER_LAMP	8
+
+enum gen_mode { GEN_ALL, GEN_GROUPED, GEN_RANDOM, GEN_MODES };
+
+struct generator {
+	unsigned long seed;
+	int lamps;
+	int ncolors;
+	unsigned char weights[GEN_MODES];
+	unsigned char palette[GEN_MAX_COLORS][3];
+	unsigned char intensity[GEN_MAX_LAMPS];
+};
+
+int generator_channels(const struct generator *g);
+void generate_step(const struct generator *g, unsigned long step, unsigned char *out);
+
+#endif
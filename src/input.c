@@ -1,15 +1,18 @@
 #include <assert.h>
 #include <stdio.h>
+#include <time.h>
 #include "schaeckeling.h"
 #include "dmxdriver.h"
 #include "dmxd.h"
 #include "nanokontroldriver.h"
 #include "usbmididriver.h"
+#include "netout.h"
 
 struct mk2_pro_context *mk2c;
 struct nanokontrol2_context *nanokontrol2;
 struct usbmidi_context *usbmidi;
 volatile int mk2c_lost = 0;
+volatile int dmx_widget = 0; // connected, its reader thread answers the watchdog
 volatile int nanokontrol_lost = 0;
 volatile int midi_lost = 0;
 
@@ -31,7 +34,31 @@ void
 midi_input_completed(void) {
 	receiving_changes = 0;
 	flush_dmxout_sendbuf();
-//	update_websockets(0, 1);
+	update_websockets(0, 0, 1);
+}
+
+
+void
+midi_realtime(unsigned char status) {
+	update_midi_clock(status, 0);
+}
+
+
+void
+midi_song_position(int sixteenths) {
+	update_midi_clock(0xf2, sixteenths);
+}
+
+
+void
+midi_quarter_frame(unsigned char data) {
+	update_mtc_quarter_frame(data);
+}
+
+
+void
+midi_full_frame(const unsigned char *hmsf) {
+	update_mtc_full_frame(hmsf);
 }
 
 
@@ -49,7 +76,7 @@ void
 dmx_input_completed(void) {
 	receiving_changes = 0;
 	flush_dmxout_sendbuf();
-	update_websockets(0, 1);
+	update_websockets(1, 0, 0);
 }
 
 
@@ -77,14 +104,24 @@ generic_midi_error(int error) {
 }
 
 
+#define RECONNECT_INTERVAL 2 // seconds between attempts to find the widget
+
+/*
+ * Called for every frame while the widget is lost, so only tries again
+ * every RECONNECT_INTERVAL seconds.
+ */
 void
 reconnect_if_needed(void) {
-	if (mk2c_lost) {
+	static time_t next_attempt = 0;
+	if (mk2c_lost && time(NULL) >= next_attempt) {
+		next_attempt = time(NULL) + RECONNECT_INTERVAL;
 		if (mk2c != NULL) {
 			teardown_dmx_usb_mk2_pro(mk2c);
+			dmx_widget = 0;
 		}
 		mk2c = init_dmx_usb_mk2_pro(dmx_changed, dmx_input_completed, mk2c_error);
 		if (mk2c != NULL) {
+			dmx_widget = 1;
 			mk2c_lost = 0;
 			flush_dmxout_sendbuf();
 		}
@@ -101,7 +138,13 @@ int
 init_communications(void) {
 	mk2c = init_dmx_usb_mk2_pro(dmx_changed, dmx_input_completed, mk2c_error);
 	if (mk2c == NULL) {
-		abort(); // XXX
+		if (netout_outputs() == 0) {
+			abort(); // XXX
+		}
+		fprintf(stderr, "init_communications: no DMX widget, only network output.\n");
+		mk2c_lost = 1;
+	} else {
+		dmx_widget = 1;
 	}
 	nanokontrol2 = init_nanokontrol2("/dev/snd/midiC1D0");
 	if (nanokontrol2 == NULL) {
@@ -121,10 +164,11 @@ init_communications(void) {
 
 
 int
-send_dmx(unsigned char *dmxbytes) {
+send_dmx(unsigned char *dmxbytes, int channels) {
 	int ret = -2;
-	if (mk2c != NULL) {
-		ret = mk2_send_dmx(mk2c, dmxbytes);
+	netout_send(dmxbytes, channels);
+	if (mk2c != NULL && !mk2c_lost) {
+		ret = mk2_send_dmx(mk2c, dmxbytes, channels);
 	}
 	return ret;
 }
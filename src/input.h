@@ -1,2 +1,6 @@
 void midi_input_completed(void);
 void midi_changed(int, unsigned char);
+void midi_realtime(unsigned char);
+void midi_song_position(int);
+void midi_quarter_frame(unsigned char);
+void midi_full_frame(const unsigned char *);
@@ -0,0 +1,164 @@
+#define _POSIX_C_SOURCE 199309L
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <assert.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <signal.h>
+#include <sysexits.h>
+#include <time.h>
+#include "schaeckeling.h"
+#include "net.h"
+#include "preset.h"
+#include "dmxd.h"
+#include "clock.h"
+#include "netout.h"
+#include "artnet.h"
+#include "sacn.h"
+#include "netin.h"
+#include "snapshot.h"
+
+pthread_t netthr, progthr, audiothr, netoutthr, netinthr;
+
+extern char *optarg;
+extern int optind;
+
+extern int watchdog_dmx_pong;
+extern volatile int dmx_widget;
+extern int watchdog_net_pong;
+extern int watchdog_prog_pong;
+
+extern struct preset *presets;
+extern unsigned char dmxout_sendbuf[DMX_CHANNELS];
+extern int dmxout_channels;
+extern int master_blackout;
+extern int program_running;
+
+void *
+watchdog_runner(void *dummy) {
+	int ok = 1;
+	pid_t parent;
+	while(1) {
+		watchdog_dmx_pong = 0;
+		watchdog_net_pong = 0;
+		watchdog_prog_pong = 0;
+		wakeup_net();
+
+		clock_sleep(5);
+
+		// without a widget, as with only network output, there is no DMX thread
+		if(dmx_widget && !watchdog_dmx_pong) {
+			fprintf(stderr, "Watchdog: DMX thread not responding\n");
+			ok = 0;
+		}
+		if(!watchdog_net_pong) {
+			fprintf(stderr, "Watchdog: Network thread not responding\n");
+			ok = 0;
+		}
+		if(!watchdog_prog_pong) {
+			fprintf(stderr, "Watchdog: Program thread not responding\n");
+			ok = 0;
+		}
+		if(ok) {
+			parent = getppid();
+			if(parent != 1) {
+				kill(parent, SIGWINCH);
+			}
+		}
+	}
+	return NULL;
+}
+
+int
+main(int argc, char **argv) {
+	char *record = NULL, *artsync = NULL, *source = NULL, logname[256];
+	time_t t;
+	int opt;
+
+	while((opt = getopt(argc, argv, "r:a:A:e:E:i:")) != -1) {
+		switch(opt) {
+			case 'r':
+				record = optarg;
+				break;
+			case 'a':
+				if(!artnet_add_output(optarg)) {
+					return EX_USAGE;
+				}
+				break;
+			case 'A':
+				artsync = optarg;
+				break;
+			case 'e':
+				if(!sacn_add_output(optarg)) {
+					return EX_USAGE;
+				}
+				break;
+			case 'E':
+				source = optarg;
+				break;
+			case 'i':
+				if(!netin_add(optarg)) {
+					return EX_USAGE;
+				}
+				break;
+			default:
+				fprintf(stderr, "Usage: %s [-r show-%%Y%%m%%d-%%H%%M.log] [-a port-address@host[:port] ...] [-A artsync-host] [-e universe[/priority][@host[:port]] ...] [-E sacn-source-name] [-i artnet:port-address|sacn:universe ...]\n", argv[0]);
+				return EX_USAGE;
+		}
+	}
+	// after all ArtDmx packets of a frame
+	if(artsync != NULL && !artnet_add_sync(artsync)) {
+		return EX_USAGE;
+	}
+	if(!sacn_finish(source)) {
+		return EX_USAGE;
+	}
+
+	init_engine();
+	presets = open_preset_arena("presets.dat", 1);
+
+	if(record != NULL) {
+		// a new log for every start, so a restart never overwrites the log of a crash
+		t = time(NULL);
+		if(strftime(logname, sizeof(logname), record, localtime(&t)) == 0 || !start_recording(logname)) {
+			fprintf(stderr, "Not recording the show\n");
+		}
+	}
+
+	read_config_file("config.dat");
+	if(access("programma.dat", R_OK) == 0) {
+		read_config_file("programma.dat");
+	}
+
+	init_snapshot();
+	if(netout_outputs() > 0) {
+		init_netout();
+		pthread_create(&netoutthr, NULL, netout_runner, NULL);
+	}
+	init_communications();
+	init_net();
+	if(netin_inputs() > 0) {
+		init_netin();
+		pthread_create(&netinthr, NULL, netin_runner, NULL);
+	}
+
+	set_feedback_running(program_running);
+	set_feedback_blackout(master_blackout != -1);
+
+	pthread_create(&netthr, NULL, net_runner, NULL);
+	pthread_create(&progthr, NULL, prog_runner, NULL);
+	pthread_create(&audiothr, NULL, audio_runner, NULL);
+
+	send_dmx(dmxout_sendbuf, dmxout_channels);
+
+	watchdog_runner(NULL);
+
+	pre_deinit_net();
+
+	void *ret = NULL;
+	pthread_join(netthr, &ret);
+	deinit_net();
+	pthread_join(progthr, &ret);
+	return 0;
+}
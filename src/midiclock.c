@@ -0,0 +1,100 @@
+#define _POSIX_C_SOURCE 200112L
+#include <math.h>
+#include <string.h>
+#include "midiclock.h"
+
+// loop gains: phase and frequency correction per tick
+#define MIDICLOCK_KP	0.1
+#define MIDICLOCK_KI	0.0025
+
+static double
+seconds_between(const struct timespec *from, const struct timespec *to) {
+	return (to->tv_sec - from->tv_sec) + (to->tv_nsec - from->tv_nsec) / 1e9;
+}
+
+static void
+add_seconds(struct timespec *ts, double seconds) {
+	double whole = floor(seconds);
+	ts->tv_sec += (time_t)whole;
+	ts->tv_nsec += (long)((seconds - whole) * 1e9);
+	ts->tv_sec += ts->tv_nsec / 1000000000L;
+	ts->tv_nsec %= 1000000000L;
+}
+
+void
+midiclock_init(struct midiclock *mc) {
+	memset(mc, 0, sizeof(*mc));
+}
+
+void
+midiclock_tick(struct midiclock *mc, const struct timespec *now) {
+	double dt, err;
+
+	if(mc->locked == 0 || seconds_between(&mc->last, now) > MIDICLOCK_TIMEOUT) {
+		// first tick after a pause: nothing to predict yet
+		mc->locked = 1;
+		mc->period = 0;
+		mc->jitter = 0;
+		mc->tick = *now;
+	} else if(mc->period == 0) {
+		mc->locked++;
+		mc->period = seconds_between(&mc->last, now);
+		mc->tick = *now;
+	} else {
+		mc->locked++;
+		dt = seconds_between(&mc->tick, now);
+		err = dt - mc->period;
+		if(fabs(err) > mc->period) {
+			// a lost or doubled tick; keep the tempo, resync the phase
+			mc->tick = *now;
+		} else {
+			add_seconds(&mc->tick, mc->period + MIDICLOCK_KP * err);
+			mc->period += MIDICLOCK_KI * err;
+		}
+		mc->jitter += (fabs(err) - mc->jitter) / 16;
+	}
+	mc->last = *now;
+	mc->ticks++;
+}
+
+/*
+ * Start and song position messages move the position; the first tick after
+ * them is the new position.
+ */
+void
+midiclock_start(struct midiclock *mc) {
+	mc->ticks = -1;
+}
+
+void
+midiclock_song_position(struct midiclock *mc, int sixteenths) {
+	mc->ticks = sixteenths * (MIDICLOCK_PPQN / 4) - 1;
+}
+
+/*
+ * How well the loop is locked, 0..100. Zero when there is no clock or it
+ * has not been running for a beat yet.
+ */
+int
+midiclock_quality(const struct midiclock *mc, const struct timespec *now) {
+	double q;
+	if(mc->period == 0 || mc->locked < MIDICLOCK_PPQN || seconds_between(&mc->last, now) > MIDICLOCK_TIMEOUT) {
+		return 0;
+	}
+	q = 100 * (1 - 2 * mc->jitter / mc->period);
+	return q < 1 ? 1 : q;
+}
+
+double
+midiclock_bpm(const struct midiclock *mc) {
+	return mc->period > 0 ? 60 / (MIDICLOCK_PPQN * mc->period) : 0;
+}
+
+double
+midiclock_beat(const struct midiclock *mc, const struct timespec *now) {
+	double pos = mc->ticks;
+	if(mc->period > 0) {
+		pos += seconds_between(&mc->tick, now) / mc->period;
+	}
+	return pos / MIDICLOCK_PPQN;
+}
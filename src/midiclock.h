@@ -0,0 +1,32 @@
+#ifndef MIDICLOCK_H
+#define MIDICLOCK_H
+
+#include <time.h>
+
+#define MIDICLOCK_PPQN		24
+#define MIDICLOCK_TIMEOUT	0.5	// seconds without a tick lose the lock
+
+/*
+ * MIDI clock follower. The tick times that come in over USB jitter by a
+ * millisecond or more, so instead of using them directly a second order
+ * phase-locked loop predicts when the next tick is due and corrects both
+ * that prediction and the tick period a little with every tick.
+ */
+struct midiclock {
+	long ticks;		// position in ticks, counted since start
+	long locked;		// ticks since the loop was (re)started
+	double period;		// filtered seconds per tick
+	double jitter;		// average prediction error, in seconds
+	struct timespec tick;	// filtered time of the last tick
+	struct timespec last;	// arrival time of the last tick
+};
+
+void midiclock_init(struct midiclock *mc);
+void midiclock_tick(struct midiclock *mc, const struct timespec *now);
+void midiclock_start(struct midiclock *mc);
+void midiclock_song_position(struct midiclock *mc, int sixteenths);
+int midiclock_quality(const struct midiclock *mc, const struct timespec *now);
+double midiclock_bpm(const struct midiclock *mc);
+double midiclock_beat(const struct midiclock *mc, const struct timespec *now);
+
+#endif
@@ -19,6 +19,18 @@ midi_print_buf(const char *prefix, const unsigned char *buf, int len) {
 	}
 }
 
+/*
+ * Length of a message the driver does not know about: everything up to the
+ * next status byte.
+ */
+int
+midi_skip_message(const unsigned char *buf, int len) {
+	int i;
+	for(i = 1; len > i && buf[i] < 0x80; i++);
+	printf("Skipping unknown MIDI message %02x (%d bytes)\n", buf[0], i);
+	return i;
+}
+
 int
 midi_send_buf(struct midi_context *ctx, const unsigned char *buf, const int len) {
 	int ret;
@@ -41,7 +53,18 @@ midi_reader(struct midi_context *ctx) {
 			break;
 		}
 		assert(ret != -1);
-		bufpos += ret;
+
+		// realtime messages may come in between the bytes of any other
+		// message, so take them out before the driver sees the buffer
+		int i, kept = bufpos;
+		for(i = bufpos; bufpos + ret > i; i++) {
+			if(buffer[i] >= 0xf8) {
+				midi_realtime(buffer[i]);
+			} else {
+				buffer[kept++] = buffer[i];
+			}
+		}
+		bufpos = kept;
 
 		int eat;
 		int did_something = 0;
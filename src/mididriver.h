@@ -13,6 +13,7 @@ struct midi_context {
 };
 
 void midi_print_buf(const char *prefix, const unsigned char *buf, int len);
+int midi_skip_message(const unsigned char *buf, int len);
 int midi_send_buf(struct midi_context *ctx, const unsigned char *buf, const int len);
 struct midi_context * init_midi(struct midi_context *ctx, char *path, midi_data_eater *eater);
 void teardown_midi(struct midi_context *ctx);
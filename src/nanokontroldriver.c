@@ -57,10 +57,14 @@ nanokontrol2_read_data(void *_ctx, const unsigned char *buffer, int len) {
 				cmdlen = 11;
 			}
 			break;
+		case 0xf1:
+			cmdlen = 2;
+			break;
+		case 0xf2:
+			cmdlen = 3;
+			break;
 		default:
-			printf("Wat de fuck is %02x?\n", buffer[0]);
-			midi_print_buf("buffer: ", buffer, len);
-			abort();
+			return midi_skip_message(buffer, len);
 	}
 	if(cmdlen > len) {
 		printf("Not enough data for %02x: %d of %d\n", buffer[0], len, cmdlen);
@@ -80,6 +84,12 @@ nanokontrol2_read_data(void *_ctx, const unsigned char *buffer, int len) {
 			midi_changed(buffer[1], buffer[2]);
 #endif
 			break;
+		case 0xf1:
+			midi_quarter_frame(buffer[1]);
+			break;
+		case 0xf2:
+			midi_song_position(buffer[1] + buffer[2] * 128);
+			break;
 		case 0xf0:
 			assert(buffer[cmdlen-1] == 0xf7);
 			switch(buffer[7]) {
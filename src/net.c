@@ -1,4 +1,6 @@
-#include <sys/select.h>
+#define _GNU_SOURCE
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
 #include <ctype.h>
 #include <stdlib.h>
 #include <sys/types.h>
@@ -18,52 +20,184 @@
 #include <fcntl.h>
 #include <netdb.h>
 #include <pthread.h>
+#include <time.h>
 #include <unistd.h>
+#include "schaeckeling.h"
 #include "net.h"
+#include "dmxd.h"
+#include "websocket.h"
+#include "osc.h"
 
-static void accept_client(int);
+static void accept_clients(int);
+static int accept_client(int);
+static void queue_buffer(struct connection *, char *, size_t);
 static int create_listen_socket(int);
+static int create_udp_socket(int);
+static void read_osc(void);
 static int read_client(struct connection *);
 static int flush_writes(struct connection *);
 static void drop_client(struct connection *);
+static void start_closing(struct connection *);
+static void detach_monitor(struct connection *, struct monitor *);
+static void release_outbuf(struct connection *);
+static void take_published(void);
+static int held_timeout(void);
+static void release_held(void);
 
+/*
+ * The network thread waits in epoll, edge-triggered, so a descriptor is
+ * only reported when something changed; reads and writes go on until they
+ * would block. Connections that got output since their last write are on
+ * the pending list, so a wakeup only visits those and not every client.
+ */
 struct connection *connhead;
-fd_set socksetin, socksetout;
-int maxsock = -1;
+struct connection *pendinghead;
+int epollfd = -1;
 int listensock = -1;
-int controlpipes[2];
+int wslistensock = -1;
+int oscsock = -1;
+int wakefd = -1;
 // pthread_mutex_t treelock, outbuflock;
 pthread_mutex_t callmtx;
 
 #define PERSISTENT_IOVS 30
 struct iovec piovs[PERSISTENT_IOVS];
 
+#define MAX_EVENTS 64
+struct epoll_event events[MAX_EVENTS];
+
+/*
+ * Engine threads publish monitor frames under publishmtx, without waiting
+ * for the network thread. The network thread takes the newest frame of a
+ * stream into a ring of preallocated buffers that all clients share. As
+ * every client only holds the newest frame of a stream, one slot per
+ * stream and one to fill are enough, however many clients there are.
+ */
+#define MONITOR_SLOTS (MONITOR_STREAMS + 1)
+
+struct monitor_slot {
+	struct linkedbuf lb;	// first, a slot is found from its buffer
+	char data[MONITOR_FRAME_MAX];
+	uint32_t seq;
+};
+
+struct monitor_slot monitor_ring[MONITOR_SLOTS];
+struct monitor_slot *latest[MONITOR_STREAMS];
+uint32_t monitor_seq[MONITOR_STREAMS];
+const char monitor_types[MONITOR_STREAMS] = { '2', '1', '3' };
+const int monitor_channels[MONITOR_STREAMS] = { DMX_CHANNELS, DMX_CHANNELS, MIDI_CHANNELS };
+
+pthread_mutex_t publishmtx;
+struct {
+	int fresh;
+	size_t len;
+	unsigned char data[DMX_CHANNELS];
+} published[MONITOR_STREAMS];
+volatile int subscribers[MONITOR_STREAMS];
+
+int nclients = 0;
+struct monitor *heldhead;	// monitors with a frame held back for their rate
+
+#define KEYFRAME_INTERVAL 64
+
+// epoll data for the descriptors that are not connections
+#define EVENT_LISTEN ((void *)&listensock)
+#define EVENT_WS_LISTEN ((void *)&wslistensock)
+#define EVENT_OSC ((void *)&oscsock)
+#define EVENT_WAKEUP ((void *)&wakefd)
+
 extern int watchdog_net_pong;
 
-#define FD_DUP(src, dst) memcpy(&dst, &src, sizeof(fd_set));
+static void
+watch_fd(int fd, uint32_t flags, void *ptr) {
+	struct epoll_event ev;
+	ev.events = flags;
+	ev.data.ptr = ptr;
+	if(epoll_ctl(epollfd, EPOLL_CTL_ADD, fd, &ev) != 0) {
+		err(1, "epoll_ctl");
+	}
+}
+
+static void
+set_pending(struct connection *c) {
+	if(c->pending_prevp != NULL) {
+		return;
+	}
+	c->next_pending = pendinghead;
+	if(pendinghead != NULL) {
+		pendinghead->pending_prevp = &c->next_pending;
+	}
+	pendinghead = c;
+	c->pending_prevp = &pendinghead;
+}
+
+static void
+hold_monitor(struct monitor *m) {
+	if(m->held_prevp != NULL) {
+		return;
+	}
+	m->next_held = heldhead;
+	if(heldhead != NULL) {
+		heldhead->held_prevp = &m->next_held;
+	}
+	heldhead = m;
+	m->held_prevp = &heldhead;
+}
+
+static void
+unhold_monitor(struct monitor *m) {
+	if(m->held_prevp == NULL) {
+		return;
+	}
+	*m->held_prevp = m->next_held;
+	if(m->next_held != NULL) {
+		m->next_held->held_prevp = m->held_prevp;
+	}
+	m->held_prevp = NULL;
+}
+
+static void
+clear_pending(struct connection *c) {
+	if(c->pending_prevp == NULL) {
+		return;
+	}
+	*c->pending_prevp = c->next_pending;
+	if(c->next_pending != NULL) {
+		c->next_pending->pending_prevp = c->pending_prevp;
+	}
+	c->pending_prevp = NULL;
+}
 
 void
 init_net() {
 	// pthread_mutex_init(&outbuflock, NULL);
 	// pthread_mutex_init(&treelock, NULL);
 	pthread_mutex_init(&callmtx, NULL);
+	pthread_mutex_init(&publishmtx, NULL);
 
-	FD_ZERO(&socksetin);
-	FD_ZERO(&socksetout);
-
-	listensock = create_listen_socket(1337);
-	FD_SET(listensock, &socksetin);
+	for(int i = 0; MONITOR_SLOTS > i; i++) {
+		monitor_ring[i].lb.iov.iov_base = monitor_ring[i].data;
+		monitor_ring[i].lb.refcount = 0;
+		monitor_ring[i].lb.pooled = 1;
+	}
 
-	if(pipe(controlpipes) != 0) {
-		err(1, "pipe");
+	epollfd = epoll_create1(EPOLL_CLOEXEC);
+	if(epollfd == -1) {
+		err(1, "epoll_create1");
 	}
-	FD_SET(controlpipes[0], &socksetin);
 
-	if(controlpipes[0] > listensock) {
-		maxsock = controlpipes[0] + 1;
-	} else {
-		maxsock = listensock + 1;
+	listensock = create_listen_socket(1337);
+	watch_fd(listensock, EPOLLIN | EPOLLET, EVENT_LISTEN);
+	wslistensock = create_listen_socket(WEBSOCKET_PORT);
+	watch_fd(wslistensock, EPOLLIN | EPOLLET, EVENT_WS_LISTEN);
+	oscsock = create_udp_socket(OSC_PORT);
+	watch_fd(oscsock, EPOLLIN | EPOLLET, EVENT_OSC);
+
+	wakefd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if(wakefd == -1) {
+		err(1, "eventfd");
 	}
+	watch_fd(wakefd, EPOLLIN | EPOLLET, EVENT_WAKEUP);
 
 #ifndef SO_NOSIGPIPE
 	signal(SIGPIPE, SIG_IGN);
@@ -73,8 +207,10 @@ init_net() {
 void
 pre_deinit_net() {
 	pthread_mutex_lock(&callmtx);
-	FD_CLR(listensock, &socksetin);
-	wakeup_select();
+	epoll_ctl(epollfd, EPOLL_CTL_DEL, listensock, NULL);
+	epoll_ctl(epollfd, EPOLL_CTL_DEL, wslistensock, NULL);
+	epoll_ctl(epollfd, EPOLL_CTL_DEL, oscsock, NULL);
+	wakeup_net();
 	pthread_mutex_unlock(&callmtx);
 }
 
@@ -83,11 +219,11 @@ deinit_net() {
 	pthread_mutex_lock(&callmtx);
 	// pthread_mutex_lock(&treelock);
 	close(listensock);
-	struct timeval tv = { 0, 0 };
-	select(maxsock, NULL, &socksetout, NULL, &tv);
+	close(wslistensock);
+	close(oscsock);
 	while(connhead != NULL) {
 		struct connection *c = connhead;
-		if(FD_ISSET(c->fd, &socksetout)) {
+		if(c->outbuf != NULL) {
 			printf("Attempt to flush the last data to %d\n", c->fd);
 			flush_writes(c);
 		}
@@ -96,116 +232,109 @@ deinit_net() {
 			printf("Truncating output buffers for %d\n", c->fd);
 		}
 	 	close(c->fd);
-		while(c->outbuf != NULL) {
-			struct linkedbuf_ptr *obp = c->outbuf;
-			if(--obp->lb->refcount == 0) {
-				free(obp->lb->iov.iov_base);
-				free(obp->lb);
-			}
-			c->outbuf = obp->next;
-			free(obp);
-		}
+		release_outbuf(c);
 		// pthread_mutex_unlock(&outbuflock);
 		connhead = c->next;
 		free(c);
 	}
+	pendinghead = NULL;
+	close(wakefd);
+	close(epollfd);
 	// pthread_mutex_unlock(&treelock);
 	pthread_mutex_unlock(&callmtx);
 }
 
 void
-wakeup_select(void) {
-	char poke = 'p';
-	write(controlpipes[1], &poke, 1);
+wakeup_net(void) {
+	uint64_t poke = 1;
+	if(wakefd == -1) {
+		return; // no network, as in the offline renderer
+	}
+	write(wakefd, &poke, sizeof(poke));
 }
 
 void *
 net_runner(void *dummy) {
 	pthread_mutex_lock(&callmtx);
 	while(1) {
-		int n;
-		fd_set readset, writeset;
-
-		FD_DUP(socksetin, readset);
-		FD_DUP(socksetout, writeset);
-
-		if(maxsock == -1) {
-			maxsock = listensock;
-			if(controlpipes[0] > maxsock) {
-				maxsock = controlpipes[0];
-			}
-
-			// pthread_mutex_nlock(&treelock);
-			struct connection *c = connhead;
-			while(c != NULL) {
-				if(c->fd > maxsock) {
-					maxsock = c->fd;
-				}
-				c = c->next;
-			}
-			maxsock++;
-			// pthread_mutex_unlock(&treelock);
-		}
+		int i, n;
 
+		int timeout = heldhead != NULL ? held_timeout() : -1;
 		pthread_mutex_unlock(&callmtx);
-		n = select(maxsock, &readset, &writeset, NULL, NULL);
+		n = epoll_wait(epollfd, events, MAX_EVENTS, timeout);
 		pthread_mutex_lock(&callmtx);
 		watchdog_net_pong = 1;
 		if(n == -1) {
 			if(errno != EINTR) {
-				err(1, "select");
+				err(1, "epoll_wait");
 			}
 			n = 0;
 		}
 
-		if(n > 0 && FD_ISSET(listensock, &readset)) {
-			accept_client(listensock);
-			n--;
+		// a connection shows up at most once per epoll_wait, and is only dropped while handling its own event
+		for(i = 0; n > i; i++) {
+			if(events[i].data.ptr == EVENT_LISTEN) {
+				accept_clients(listensock);
+			} else if(events[i].data.ptr == EVENT_WS_LISTEN) {
+				accept_clients(wslistensock);
+			} else if(events[i].data.ptr == EVENT_OSC) {
+				read_osc();
+			} else if(events[i].data.ptr == EVENT_WAKEUP) {
+				uint64_t pokes;
+				read(wakefd, &pokes, sizeof(pokes));
+			} else {
+				struct connection *c = events[i].data.ptr;
+				int lost = 0;
+				if(events[i].events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR)) {
+					lost = read_client(c);
+				}
+				if(lost == 0 && (events[i].events & EPOLLOUT) && c->outbuf != NULL) {
+					lost = flush_writes(c);
+				}
+				if(lost != 0 || c->overrun) {
+					drop_client(c);
+				}
+			}
 		}
 
-		if(n > 0 && FD_ISSET(controlpipes[0], &readset)) {
-			char buf[16];
-			read(controlpipes[0], buf, sizeof(buf));
-			n--;
+		take_published();
+		if(heldhead != NULL) {
+			release_held();
 		}
 
-		struct connection *c = connhead;
-		while(c != NULL && n > 0) {
-			int lost = 0;
-			if(FD_ISSET(c->fd, &readset)) {
-				lost = read_client(c);
-				n--;
-			}
-			if(FD_ISSET(c->fd, &writeset)) {
-				if(lost == 0) {
-					lost = flush_writes(c);
-				}
-				n--;
-			}
-			if(lost != 0) {
-				struct connection *deadc = c;
-				c = c->next;
-				drop_client(deadc);
-			} else {
-				c = c->next;
+		// output queued since the last round: replies and monitor frames
+		while(pendinghead != NULL) {
+			struct connection *c = pendinghead;
+			clear_pending(c);
+			if(c->overrun || (c->outbuf != NULL && flush_writes(c) != 0)) {
+				drop_client(c);
 			}
 		}
-
-		assert(n==0);
 	}
 	pthread_mutex_unlock(&callmtx);
 	return NULL;
 }
 
 static void
+accept_clients(int sock) {
+	while(accept_client(sock) == 0) {
+	}
+}
+
+/*
+ * Returns 1 when there is no client waiting to be accepted.
+ */
+static int
 accept_client(int sock) {
 	struct connection *c;
 	int client;
 
 	client = accept(sock, NULL, NULL);
 	if(client < 0) {
-		warn("accept()");
-		return;
+		if(errno != EAGAIN && errno != EWOULDBLOCK) {
+			warn("accept()");
+		}
+		return 1;
 	}
 
 	int on = 1;
@@ -232,19 +361,46 @@ accept_client(int sock) {
 
 	c = malloc(sizeof(struct connection));
 	c->fd = client;
+	c->proto = sock == wslistensock ? CONN_HTTP : CONN_RAW;
+	c->closing = 0;
 	c->inbuf_pos = 0;
 	c->outbuf = NULL;
 	c->outbuf_tail = &c->outbuf;
+	c->queued = 0;
+	c->queued_bytes = 0;
+	c->overrun = 0;
+	c->pending_prevp = NULL;
+	c->frames_sent = 0;
+	c->frames_dropped = 0;
+	c->batch = 0;
+	websocket_init(&c->ws);
+	// browsers get deltas, plain clients whole frames unless they ask
+	c->monitor_deltas = c->proto == CONN_HTTP;
+	for(int i = 0; MONITOR_STREAMS > i; i++) {
+		struct monitor *m = &c->monitors[i];
+		m->subscribed = 0;
+		m->held_prevp = NULL;
+		m->conn = c;
+		m->stream = i;
+		m->queued = 0;
+		m->waiting = NULL;
+		m->own.pooled = 1;
+	}
+	// everyone gets the output, as before there were subscriptions
+	subscribe_monitor(c, MONITOR_OUTPUT, 0, DMX_CHANNELS, 0);
 
 	c->next = connhead;
+	if(connhead != NULL) {
+		connhead->prevp = &c->next;
+	}
 	connhead = c;
+	c->prevp = &connhead;
 
-	FD_SET(client, &socksetin);
-	if(client >= maxsock) {
-		maxsock = client+1;
-	}
+	watch_fd(client, EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET, c);
+	nclients++;
 
 	printf("Welcome #%d\n", c->fd);
+	return 0;
 }
 
 static int
@@ -267,112 +423,645 @@ create_listen_socket(int port) {
 	if(listen(sock, 25) != 0) {
 		err(EX_UNAVAILABLE, "listen()");
 	}
+	if(fcntl(sock, F_SETFL, fcntl(sock, F_GETFL, 0) | O_NONBLOCK) == -1) {
+		err(EX_UNAVAILABLE, "fcntl(O_NONBLOCK)");
+	}
 	return sock;
 }
 
 static int
-read_client(struct connection *c) {
-	assert(c->inbuf_pos >= 0 && c->inbuf_pos <= sizeof(c->inbuf));
-	int n = read(c->fd, c->inbuf + c->inbuf_pos, sizeof(c->inbuf) - c->inbuf_pos);
-	switch(n) {
-		case -1:
-			warn("read");
-#ifdef STRESS
-			if(errno != ECONNRESET) {
-				abort();
+create_udp_socket(int port) {
+	int sock;
+	struct sockaddr_in addr;
+	sock = socket(PF_INET, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if(sock == -1) {
+		err(EX_UNAVAILABLE, "socket()");
+	}
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = PF_INET;
+	addr.sin_addr.s_addr = INADDR_ANY;
+	addr.sin_port = htons(port);
+	if(bind(sock, (struct sockaddr *)&addr, sizeof(struct sockaddr_in)) != 0) {
+		err(EX_UNAVAILABLE, "bind(%d)", port);
+	}
+	return sock;
+}
+
+/*
+ * Every OSC datagram is handled where it lies in the buffer, until the
+ * socket is drained.
+ */
+static void
+read_osc(void) {
+	static unsigned char buf[OSC_PACKET_MAX];
+	while(1) {
+		ssize_t n = recv(oscsock, buf, sizeof(buf), MSG_TRUNC);
+		if(n == -1) {
+			if(errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+				warn("recv(osc)");
 			}
-#endif
-			/* FALL THROUGH */
-		case 0:
-			return 1;
+			if(errno != EINTR) {
+				return;
+			}
+			continue;
+		}
+		if(n > (ssize_t)sizeof(buf) || handle_osc(buf, n) != 0) {
+			fprintf(stderr, "net: Ignoring a malformed OSC packet of %zd bytes\n", n);
+		}
 	}
+}
 
-	c->inbuf_pos += n;
-	assert(c->inbuf_pos >= 0 && c->inbuf_pos <= sizeof(c->inbuf));
+static void
+send_frame(struct connection *c, int opcode, const unsigned char *payload, size_t len) {
+	char *buf = malloc(WS_HEADER_MAX + len);
+	size_t h = websocket_header((unsigned char *)buf, opcode, len);
+	memcpy(buf + h, payload, len);
+	queue_buffer(c, buf, h + len);
+}
 
-	int offset = 0, processed;
-	do {
-		processed = handle_data(c, c->inbuf + offset, c->inbuf_pos - offset);
-		if(processed == -1) {
-			FD_CLR(c->fd, &socksetin);
-			return 1;
+static void
+close_websocket(struct connection *c, int status) {
+	unsigned char code[2] = { status >> 8, status & 0xFF };
+	send_frame(c, WS_OP_CLOSE, code, sizeof(code));
+	start_closing(c);
+}
+
+static void
+control_frame(struct connection *c, int opcode, const unsigned char *payload, size_t len) {
+	switch(opcode) {
+		case WS_OP_PING:
+			send_frame(c, WS_OP_PONG, payload, len);
+			break;
+		case WS_OP_CLOSE:
+			// echo the status code, then hang up
+			send_frame(c, WS_OP_CLOSE, payload, len < 2 ? 0 : 2);
+			start_closing(c);
+			break;
+		case WS_OP_PONG:
+			break;
+		default:
+			close_websocket(c, 1002);
+			break;
+	}
+}
+
+/*
+ * Take the upgrade request line by line. Lines too long for the buffer,
+ * like cookies, are skipped; the headers that matter are short.
+ */
+static void
+read_request(struct connection *c) {
+	size_t start = 0;
+	for(size_t i = 0; c->inbuf_pos > i && c->proto == CONN_HTTP && !c->closing; i++) {
+		if(c->inbuf[i] != '\n') {
+			continue;
+		}
+		size_t len = i - start;
+		if(len > 0 && c->inbuf[i - 1] == '\r') {
+			len--;
+		}
+		int r = c->ws.skipping ? 0 : websocket_request_line(&c->ws, c->inbuf + start, len);
+		c->ws.skipping = 0;
+		start = i + 1;
+		if(r == 1) {
+			char accept[WS_ACCEPT_LEN + 1];
+			websocket_accept(c->ws.key, accept);
+			client_printf(c, "HTTP/1.1 101 Switching Protocols\r\nUpgrade: websocket\r\nConnection: Upgrade\r\nSec-WebSocket-Accept: %s\r\n\r\n", accept);
+			c->proto = CONN_WEBSOCKET;
+		} else if(r < 0) {
+			client_printf(c, "HTTP/1.1 %s\r\nConnection: close\r\nContent-Length: 0\r\n%s\r\n",
+				r == -2 ? "426 Upgrade Required" : "400 Bad Request",
+				r == -2 ? "Sec-WebSocket-Version: 13\r\n" : "");
+			start_closing(c);
+		}
+	}
+	if(c->proto == CONN_HTTP && start == 0 && c->inbuf_pos == sizeof(c->inbuf)) {
+		c->ws.skipping = 1;
+		start = c->inbuf_pos;
+	}
+	c->inbuf_pos -= start;
+	memmove(c->inbuf, c->inbuf + start, c->inbuf_pos);
+}
+
+/*
+ * Unmask the payload of data frames into the command bytes at the start of
+ * inbuf, and handle control frames as soon as they are complete.
+ */
+static void
+decode_frames(struct connection *c) {
+	struct websocket *ws = &c->ws;
+	unsigned char *buf = (unsigned char *)c->inbuf;
+	size_t pos = ws->decoded;
+
+	while(c->inbuf_pos > pos && !c->closing) {
+		if(ws->remaining > 0) {
+			size_t n = c->inbuf_pos - pos;
+			if(n > ws->remaining) {
+				n = ws->remaining;
+			}
+			websocket_unmask(buf + pos, n, ws->mask, &ws->maskpos);
+			memmove(buf + ws->decoded, buf + pos, n);
+			ws->decoded += n;
+			ws->remaining -= n;
+			pos += n;
+			continue;
 		}
-		offset += processed;
-	} while(processed > 0 && c->inbuf_pos > offset);
 
-	c->inbuf_pos -= offset;
-	if(offset > 0 && c->inbuf_pos != 0) {
-		memmove(c->inbuf, c->inbuf + offset, c->inbuf_pos);
+		struct websocket_frame f;
+		int h = websocket_parse_header(buf + pos, c->inbuf_pos - pos, &f);
+		if(h == 0) {
+			break;
+		}
+		if(h == -1 || !f.masked) {
+			close_websocket(c, 1002);
+			break;
+		}
+		if(f.opcode >= WS_OP_CLOSE) {
+			if(c->inbuf_pos - pos < h + f.len) {
+				break;
+			}
+			int maskpos = 0;
+			websocket_unmask(buf + pos + h, f.len, f.mask, &maskpos);
+			control_frame(c, f.opcode, buf + pos + h, f.len);
+			pos += h + f.len;
+		} else if(f.opcode <= WS_OP_BINARY) {
+			memcpy(ws->mask, f.mask, sizeof(ws->mask));
+			ws->maskpos = 0;
+			ws->remaining = f.len;
+			pos += h;
+		} else {
+			close_websocket(c, 1002);
+		}
 	}
 
-	if(c->inbuf_pos == sizeof(c->inbuf)) {
-		FD_CLR(c->fd, &socksetin);
-		printf("#%d Buffer vol\n", c->fd);
-		return 1;
+	size_t rest = c->inbuf_pos - pos;
+	memmove(buf + ws->decoded, buf + pos, rest);
+	c->inbuf_pos = ws->decoded + rest;
+}
+
+/*
+ * Read and handle everything the client sent, until the read would block.
+ */
+static int
+read_client(struct connection *c) {
+	while(1) {
+		assert(c->inbuf_pos >= 0 && c->inbuf_pos <= sizeof(c->inbuf));
+		int n = read(c->fd, c->inbuf + c->inbuf_pos, sizeof(c->inbuf) - c->inbuf_pos);
+		switch(n) {
+			case -1:
+				if(errno == EAGAIN || errno == EWOULDBLOCK) {
+					return 0;
+				}
+				if(errno == EINTR) {
+					continue;
+				}
+				warn("read");
+#ifdef STRESS
+				if(errno != ECONNRESET) {
+					abort();
+				}
+#endif
+				/* FALL THROUGH */
+			case 0:
+				return 1;
+		}
+
+		if(c->closing) {
+			continue; // nothing more is handled
+		}
+		c->inbuf_pos += n;
+		assert(c->inbuf_pos >= 0 && c->inbuf_pos <= sizeof(c->inbuf));
+
+		if(c->proto == CONN_HTTP) {
+			read_request(c);
+		}
+		if(c->proto == CONN_WEBSOCKET) {
+			decode_frames(c);
+		}
+		if(c->proto == CONN_HTTP || c->closing) {
+			continue;
+		}
+
+		size_t end = c->proto == CONN_WEBSOCKET ? c->ws.decoded : c->inbuf_pos;
+		int offset = 0, processed = 0;
+		while(end > offset) {
+			processed = handle_data(c, c->inbuf + offset, end - offset);
+			if(processed == -1 || c->overrun) {
+				return 1;
+			}
+			if(processed == 0) {
+				break;
+			}
+			offset += processed;
+		}
+
+		c->inbuf_pos -= offset;
+		if(c->proto == CONN_WEBSOCKET) {
+			c->ws.decoded -= offset;
+		}
+		if(offset > 0 && c->inbuf_pos != 0) {
+			memmove(c->inbuf, c->inbuf + offset, c->inbuf_pos);
+		}
+
+		if(c->inbuf_pos == sizeof(c->inbuf)) {
+			printf("#%d Buffer vol\n", c->fd);
+			return 1;
+		}
 	}
+}
 
-	return 0;
+static void
+unref_buf(struct linkedbuf *lb) {
+	if(--lb->refcount == 0 && !lb->pooled) {
+		free(lb->iov.iov_base);
+		free(lb);
+	}
 }
 
 static void
-queue_buf(struct connection *c, struct linkedbuf *lb) {
+append_link(struct connection *c, struct linkedbuf_ptr *obp) {
 	// pthread_mutex_lock(&outbuflock);
-	struct linkedbuf_ptr *obp = malloc(sizeof(struct linkedbuf_ptr));
-	obp->lb = lb;
-	lb->refcount++;
 	obp->next = NULL;
-
+	obp->offset = 0;
 	*c->outbuf_tail = obp;
 	c->outbuf_tail = &obp->next;
+	c->queued++;
 
-	FD_SET(c->fd, &socksetout);
+	set_pending(c);
 	// pthread_mutex_unlock(&outbuflock);
 }
 
+static struct monitor *
+monitor_of_link(struct connection *c, struct linkedbuf_ptr *obp) {
+	for(int i = 0; MONITOR_STREAMS > i; i++) {
+		if(obp == &c->monitors[i].link) {
+			return &c->monitors[i];
+		}
+	}
+	return NULL;
+}
+
+static int
+is_slot(struct linkedbuf *lb) {
+	return (char *)lb >= (char *)monitor_ring && (char *)lb < (char *)(monitor_ring + MONITOR_SLOTS);
+}
+
+/*
+ * A buffer has been written completely, or the client is going away.
+ */
+static void
+release_link(struct connection *c, struct linkedbuf_ptr *obp) {
+	struct monitor *m = monitor_of_link(c, obp);
+	c->queued--;
+	if(m == NULL) {
+		c->queued_bytes -= obp->lb->iov.iov_len;
+	}
+	unref_buf(obp->lb);
+	if(m == NULL) {
+		free(obp);
+		return;
+	}
+	m->queued = 0;
+}
+
+static void
+release_outbuf(struct connection *c) {
+	while(c->outbuf != NULL) {
+		struct linkedbuf_ptr *obp = c->outbuf;
+		c->outbuf = obp->next;
+		release_link(c, obp);
+	}
+	c->outbuf_tail = &c->outbuf;
+	for(int i = 0; MONITOR_STREAMS > i; i++) {
+		struct monitor *m = &c->monitors[i];
+		if(m->waiting != NULL) {
+			unref_buf(m->waiting);
+			m->waiting = NULL;
+		}
+		unhold_monitor(m);
+		if(m->subscribed) {
+			m->subscribed = 0;
+			subscribers[i]--;
+		}
+	}
+}
+
+static int
+before(const struct timespec *a, const struct timespec *b) {
+	return a->tv_sec < b->tv_sec || (a->tv_sec == b->tv_sec && a->tv_nsec < b->tv_nsec);
+}
+
+/*
+ * The rate allows a frame now; the next one may follow an interval later.
+ */
+static int
+rate_allows(struct monitor *m, const struct timespec *now) {
+	if(m->interval == 0) {
+		return 1;
+	}
+	if(before(now, &m->next)) {
+		hold_monitor(m);
+		return 0;
+	}
+	m->next = *now;
+	m->next.tv_nsec += m->interval;
+	while(m->next.tv_nsec >= 1000000000) {
+		m->next.tv_nsec -= 1000000000;
+		m->next.tv_sec++;
+	}
+	return 1;
+}
+
+/*
+ * Give the client the newest frame of a stream. A frame that has not gone
+ * out yet is replaced, so a slow client skips to the newest frame instead
+ * of falling further behind. Clients on deltas get nothing when their
+ * channels did not change.
+ */
+static void
+queue_monitor(struct connection *c, struct monitor *m, struct monitor_slot *slot, const struct timespec *now) {
+	struct linkedbuf *lb = &slot->lb;
+	if(m->queued && is_slot(m->link.lb)) {
+		unref_buf(m->link.lb);
+		lb->refcount++;
+		m->link.lb = lb;
+		c->frames_dropped++;
+	} else if(m->queued) {
+		if(m->waiting != NULL) {
+			unref_buf(m->waiting);
+			c->frames_dropped++;
+		} else if(!rate_allows(m, now)) {
+			return;
+		}
+		lb->refcount++;
+		m->waiting = lb;
+	} else {
+		if(c->monitor_deltas && m->seen_valid && !m->keyframe_wanted && memcmp(m->seen + m->first, slot->data + 1 + m->first, m->count) == 0) {
+			return;
+		}
+		if(!rate_allows(m, now)) {
+			return;
+		}
+		lb->refcount++;
+		m->link.lb = lb;
+		m->queued = 1;
+		append_link(c, &m->link);
+	}
+}
+
+/*
+ * The monitor frame was partly written: keep the rest in the connection,
+ * so the shared slot is free again for newer frames.
+ */
+static void
+keep_partial_monitor(struct monitor *m) {
+	struct linkedbuf_ptr *obp = &m->link;
+	size_t rest = obp->lb->iov.iov_len - obp->offset;
+	memcpy(m->rest, (char *)obp->lb->iov.iov_base + obp->offset, rest);
+	unref_buf(obp->lb);
+	m->own.iov.iov_base = m->rest;
+	m->own.iov.iov_len = rest;
+	m->own.refcount = 1;
+	obp->lb = &m->own;
+	obp->offset = 0;
+}
+
+/*
+ * Publish a frame of a monitor stream, if anyone is subscribed to it. Can be
+ * called from any thread, with any locks held.
+ */
 void
-broadcast(char *buf, size_t size) {
-	struct linkedbuf *ob;
-	struct connection *c;
-	pthread_mutex_lock(&callmtx);
-	if(connhead == NULL) {
-		free(buf);
-		pthread_mutex_unlock(&callmtx);
+broadcast_frame(int stream, const unsigned char *data, size_t len) {
+	assert(stream >= 0 && stream < MONITOR_STREAMS && len < MONITOR_FRAME_MAX);
+	if(subscribers[stream] == 0) {
 		return;
 	}
-	ob = calloc(1, sizeof(struct linkedbuf));
-	ob->iov.iov_len = size;
-	ob->iov.iov_base = buf;
-	ob->refcount = 0;
+	pthread_mutex_lock(&publishmtx);
+	memcpy(published[stream].data, data, len);
+	published[stream].len = len;
+	published[stream].fresh = 1;
+	pthread_mutex_unlock(&publishmtx);
+	wakeup_net();
+}
 
-	c = connhead;
-	while(c != NULL) {
-		queue_buf(c, ob);
-		c = c->next;
+/*
+ * Slots are only held by latest and by subscribers that are not closing,
+ * which take each new frame in place of the one they had: all of them hold
+ * the latest frame of a stream, so one of the slots is always free.
+ */
+static struct monitor_slot *
+free_slot(void) {
+	int i = 0;
+	while(monitor_ring[i].lb.refcount != 0) {
+		i++;
 	}
-	pthread_mutex_unlock(&callmtx);
+	return &monitor_ring[i];
 }
 
+/*
+ * Take the frames published since the last round, and queue them for the
+ * subscribers.
+ */
 static void
-write_client(struct connection *c, char *buf, size_t size) {
+take_published(void) {
+	struct timespec now;
+	int taken = 0;
+
+	for(int i = 0; MONITOR_STREAMS > i; i++) {
+		struct monitor_slot *slot;
+		pthread_mutex_lock(&publishmtx);
+		if(!published[i].fresh) {
+			pthread_mutex_unlock(&publishmtx);
+			continue;
+		}
+		slot = free_slot();
+		slot->data[0] = monitor_types[i];
+		memcpy(slot->data + 1, published[i].data, published[i].len);
+		slot->lb.iov.iov_len = 1 + published[i].len;
+		published[i].fresh = 0;
+		pthread_mutex_unlock(&publishmtx);
+
+		slot->seq = ++monitor_seq[i];
+		slot->lb.refcount++;
+		if(latest[i] != NULL) {
+			unref_buf(&latest[i]->lb);
+		}
+		latest[i] = slot;
+
+		if(!taken) {
+			clock_gettime(CLOCK_MONOTONIC, &now);
+			taken = 1;
+		}
+		for(struct connection *c = connhead; c != NULL; c = c->next) {
+			if(c->monitors[i].subscribed && c->proto != CONN_HTTP && !c->closing) {
+				queue_monitor(c, &c->monitors[i], slot, &now);
+			}
+		}
+	}
+}
+
+/*
+ * Milliseconds until the first frame held back for a rate may go.
+ */
+static int
+held_timeout(void) {
+	struct timespec now, *first = NULL;
+	for(struct monitor *m = heldhead; m != NULL; m = m->next_held) {
+		if(first == NULL || before(&m->next, first)) {
+			first = &m->next;
+		}
+	}
+	assert(first != NULL);
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	if(!before(&now, first)) {
+		return 0;
+	}
+	long ms = (first->tv_sec - now.tv_sec) * 1000 + (first->tv_nsec - now.tv_nsec + 999999) / 1000000;
+	return ms > 0 ? ms : 1;
+}
+
+/*
+ * Send the newest frame to subscribers whose rate allows it again. Only the
+ * held monitors are looked at, not every client.
+ */
+static void
+release_held(void) {
+	struct timespec now;
+	struct monitor *m, *next;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	for(m = heldhead; m != NULL; m = next) {
+		next = m->next_held;
+		if(!before(&now, &m->next)) {
+			unhold_monitor(m);
+			queue_monitor(m->conn, m, latest[m->stream], &now);
+		}
+	}
+}
+
+int
+monitor_stream(char type) {
+	for(int i = 0; MONITOR_STREAMS > i; i++) {
+		if(monitor_types[i] == type) {
+			return i;
+		}
+	}
+	return -1;
+}
+
+/*
+ * Subscribe a client to channels first to first + count of a stream, at
+ * most rate frames per second, or all frames for rate 0. A count of 0
+ * unsubscribes. Ranges only apply to keyframes and deltas, so subscribing
+ * switches the client to those. Returns -1 for an invalid subscription.
+ */
+int
+subscribe_monitor(struct connection *c, int stream, int first, int count, int rate) {
+	if(c == NULL) {
+		return 0;
+	}
+	if(stream < 0 || stream >= MONITOR_STREAMS || first < 0 || count < 0 || first + count > monitor_channels[stream]) {
+		return -1;
+	}
+	struct monitor *m = &c->monitors[stream];
+	unhold_monitor(m);
+	if(count == 0) {
+		if(m->subscribed) {
+			m->subscribed = 0;
+			subscribers[stream]--;
+		}
+		detach_monitor(c, m);
+		return 0;
+	}
+	if(!m->subscribed) {
+		m->subscribed = 1;
+		subscribers[stream]++;
+	}
+	m->first = first;
+	m->count = count;
+	m->interval = rate > 0 ? 1000000000L / rate : 0;
+	m->next.tv_sec = 0;
+	m->next.tv_nsec = 0;
+	m->keyframe_wanted = 1;
+	m->since_keyframe = 0;
+	m->seen_valid = 0;
+	return 0;
+}
+
+int
+client_count(void) {
+	return nclients;
+}
+
+/*
+ * Replies pile up when a client sends commands without reading: past
+ * CLIENT_QUEUE_MAX nothing more is queued and the client is dropped.
+ */
+static void
+queue_buffer(struct connection *c, char *buf, size_t size) {
+	if(c->overrun || c->queued_bytes + size > CLIENT_QUEUE_MAX) {
+		if(!c->overrun) {
+			fprintf(stderr, "net: #%d Not reading its replies, dropped\n", c->fd);
+		}
+		c->overrun = 1;
+		free(buf);
+		return;
+	}
+	c->queued_bytes += size;
+
 	struct linkedbuf *ob = malloc(sizeof(struct linkedbuf));
 	struct linkedbuf_ptr *obp = malloc(sizeof(struct linkedbuf_ptr));
 	ob->iov.iov_len = size;
 	ob->iov.iov_base = buf;
 	ob->refcount = 1;
+	ob->pooled = 0;
 
 	obp->lb = ob;
-	obp->next = NULL;
+	append_link(c, obp);
+}
 
-	*c->outbuf_tail = obp;
-	c->outbuf_tail = &obp->next;
+/*
+ * Queue a reply, in a binary message on a WebSocket.
+ */
+static void
+write_client(struct connection *c, char *buf, size_t size) {
+	if(c->proto == CONN_WEBSOCKET) {
+		unsigned char header[WS_HEADER_MAX];
+		size_t h = websocket_header(header, WS_OP_BINARY, size);
+		buf = realloc(buf, h + size);
+		if(buf == NULL) {
+			err(1, "realloc");
+		}
+		memmove(buf + h, buf, size);
+		memcpy(buf, header, h);
+		size += h;
+	}
+	queue_buffer(c, buf, size);
+}
 
-	FD_SET(c->fd, &socksetout);
+/*
+ * Queue a reply that may hold zero bytes.
+ */
+void
+client_write(struct connection *c, const char *data, size_t size) {
+	char *buf;
+	if(c == NULL) {
+		return;
+	}
+	buf = malloc(size);
+	if(buf == NULL) {
+		err(1, "malloc");
+	}
+	memcpy(buf, data, size);
+	write_client(c, buf, size);
 }
 
 void
 client_printf(struct connection *c, char *fmt, ...) {
 	char *buf;
 	va_list ap;
+	if(c == NULL) {
+		return; // commands from a file, there is no one to reply to
+	}
 	va_start(ap, fmt);
 	int n = vasprintf(&buf, fmt, ap);
 	if(n == -1) {
@@ -382,104 +1071,275 @@ client_printf(struct connection *c, char *fmt, ...) {
 	write_client(c, buf, n);
 }
 
+/*
+ * Write the channel runs that differ between two frames, from channel first
+ * on: a two byte start channel, a count and the values. Gaps of a few unchanged channels are
+ * sent along, as that is shorter than starting a new run. Returns the
+ * length, or 0 if it would not fit in max.
+ */
+static size_t
+encode_delta(const unsigned char *prev, const unsigned char *cur, size_t first, size_t channels, unsigned char *out, size_t max) {
+	size_t len = 0, i = first;
+	channels += first;
+	while(channels > i) {
+		if(prev[i] == cur[i]) {
+			i++;
+			continue;
+		}
+		size_t start = i, end = i + 1, gap = 0;
+		for(i = end; channels > i && end - start < 255; i++) {
+			if(prev[i] != cur[i]) {
+				end = i + 1;
+				gap = 0;
+			} else if(++gap > 3) {
+				break;
+			}
+		}
+		if(len + 3 + end - start > max) {
+			return 0;
+		}
+		out[len++] = start >> 8;
+		out[len++] = start & 0xFF;
+		out[len++] = end - start;
+		memcpy(out + len, cur + start, end - start);
+		len += end - start;
+		i = end;
+	}
+	return len;
+}
+
+static void
+put16(unsigned char *p, unsigned int v) {
+	p[0] = v >> 8;
+	p[1] = v;
+}
+
+static void
+put32(unsigned char *p, uint32_t v) {
+	p[0] = v >> 24;
+	p[1] = v >> 16;
+	p[2] = v >> 8;
+	p[3] = v;
+}
+
+/*
+ * Turn the newest monitor frame into the client's own message. Clients
+ * that asked for deltas get
+ *   'k' type seq[4] first[2] count[2] values	a keyframe
+ *   'd' type seq[4] base[4] length[2] runs	the runs changed since frame base
+ * for the channels they subscribed to, with numbers big endian. seq counts
+ * the frames of the stream, so frames that were coalesced away or held
+ * back for the rate show up as jumps. A client that does not have frame
+ * base lost track, and asks for a keyframe with 'F' 'K'; every
+ * KEYFRAME_INTERVAL messages one is sent anyway. On a WebSocket, the
+ * message is put in a frame.
+ */
+static void
+encode_monitor(struct connection *c, struct monitor *m) {
+	struct monitor_slot *slot = (struct monitor_slot *)m->link.lb;
+	const unsigned char *frame = (unsigned char *)slot->data;
+	size_t channels = slot->lb.iov.iov_len - 1;
+	unsigned char *msg = (unsigned char *)m->rest + MONITOR_WS_HEADER;
+	size_t len = 0;
+
+	if(!c->monitor_deltas) {
+		memcpy(msg, frame, 1 + channels);
+		len = 1 + channels;
+	} else {
+		if(!m->keyframe_wanted && m->seen_valid && m->since_keyframe < KEYFRAME_INTERVAL) {
+			// never longer than a keyframe
+			size_t extra = MONITOR_DELTA_HEADER - MONITOR_KEYFRAME_HEADER;
+			size_t max = m->count > extra ? m->count - extra : 0;
+			size_t runs = encode_delta(m->seen, frame + 1, m->first, m->count, msg + MONITOR_DELTA_HEADER, max);
+			if(runs > 0 || memcmp(m->seen + m->first, frame + 1 + m->first, m->count) == 0) {
+				msg[0] = 'd';
+				msg[1] = frame[0];
+				put32(msg + 2, slot->seq);
+				put32(msg + 6, m->seen_seq);
+				put16(msg + 10, runs);
+				len = MONITOR_DELTA_HEADER + runs;
+				m->since_keyframe++;
+			}
+		}
+		if(len == 0) {
+			msg[0] = 'k';
+			msg[1] = frame[0];
+			put32(msg + 2, slot->seq);
+			put16(msg + 6, m->first);
+			put16(msg + 8, m->count);
+			memcpy(msg + MONITOR_KEYFRAME_HEADER, frame + 1 + m->first, m->count);
+			len = MONITOR_KEYFRAME_HEADER + m->count;
+			m->keyframe_wanted = 0;
+			m->since_keyframe = 0;
+		}
+		m->seen_valid = 1;
+		m->seen_seq = slot->seq;
+		memcpy(m->seen, frame + 1, channels);
+	}
+
+	if(c->proto == CONN_WEBSOCKET) {
+		unsigned char header[WS_HEADER_MAX];
+		size_t h = websocket_header(header, WS_OP_BINARY, len);
+		msg -= h;
+		memcpy(msg, header, h);
+		len += h;
+	}
+	unref_buf(&slot->lb);
+	m->own.iov.iov_base = msg;
+	m->own.iov.iov_len = len;
+	m->own.refcount = 1;
+	m->link.lb = &m->own;
+}
+
+/*
+ * The client gets no more frames of a stream: a frame it still has queued
+ * becomes its own copy, and a newer one waiting behind it is dropped. Only
+ * subscribers get newer frames, so a slot they held would never be freed.
+ */
+static void
+detach_monitor(struct connection *c, struct monitor *m) {
+	if(m->queued && is_slot(m->link.lb)) {
+		if(c->monitor_deltas || c->proto == CONN_WEBSOCKET) {
+			encode_monitor(c, m);
+		} else {
+			keep_partial_monitor(m);
+		}
+	}
+	if(m->waiting != NULL) {
+		unref_buf(m->waiting);
+		m->waiting = NULL;
+		c->frames_dropped++;
+	}
+	unhold_monitor(m);
+}
+
+/*
+ * Hang up once the output queued so far is written.
+ */
+static void
+start_closing(struct connection *c) {
+	c->closing = 1;
+	for(int i = 0; MONITOR_STREAMS > i; i++) {
+		detach_monitor(c, &c->monitors[i]);
+	}
+}
+
+void
+set_monitor_deltas(struct connection *c, int deltas) {
+	if(c == NULL) {
+		return;
+	}
+	c->monitor_deltas = deltas;
+	for(int i = 0; MONITOR_STREAMS > i; i++) {
+		c->monitors[i].keyframe_wanted = 1;
+	}
+}
+
+void
+request_keyframe(struct connection *c) {
+	if(c == NULL) {
+		return;
+	}
+	for(int i = 0; MONITOR_STREAMS > i; i++) {
+		c->monitors[i].keyframe_wanted = 1;
+	}
+}
+
+/*
+ * Write until everything is out or the socket would block.
+ */
 static int
 flush_writes(struct connection *c) {
 	// pthread_mutex_lock(&outbuflock);
 	assert(c->outbuf != NULL);
-	int i = 0;
-	struct linkedbuf_ptr *obp = c->outbuf;
-	while(obp != NULL && i < PERSISTENT_IOVS) {
-		piovs[i] = obp->lb->iov;
-		i++;
-		obp = obp->next;
-	}
-
-	ssize_t n = writev(c->fd, piovs, i);
-	switch(n) {
-		case -1:
-			if(errno == EAGAIN || errno == EPIPE) {
-				return 1;
+	while(c->outbuf != NULL) {
+		int i = 0;
+		struct linkedbuf_ptr *obp = c->outbuf;
+		if(c->monitor_deltas || c->proto == CONN_WEBSOCKET) {
+			for(int j = 0; MONITOR_STREAMS > j; j++) {
+				if(c->monitors[j].queued && is_slot(c->monitors[j].link.lb)) {
+					encode_monitor(c, &c->monitors[j]);
+				}
 			}
-			warn("writev");
+		}
+		while(obp != NULL && i < PERSISTENT_IOVS) {
+			piovs[i].iov_base = (char *)obp->lb->iov.iov_base + obp->offset;
+			piovs[i].iov_len = obp->lb->iov.iov_len - obp->offset;
+			i++;
+			obp = obp->next;
+		}
+
+		ssize_t n = writev(c->fd, piovs, i);
+		switch(n) {
+			case -1:
+				if(errno == EAGAIN || errno == EWOULDBLOCK) {
+					return 0; // the rest goes out on the next EPOLLOUT
+				}
+				if(errno == EINTR) {
+					continue;
+				}
+				if(errno == EPIPE) {
+					return 1;
+				}
+				warn("writev");
 #ifdef STRESS
-			abort();
+				abort();
 #endif
-			/* FALL THROUGH */
-		case 0:
-			return 1;
-	}
+				/* FALL THROUGH */
+			case 0:
+				return 1;
+		}
 
-	do {
-		obp = c->outbuf;
-		if(n >= obp->lb->iov.iov_len) {
-			n -= obp->lb->iov.iov_len;
+		while(n > 0) {
+			obp = c->outbuf;
+			size_t rest = obp->lb->iov.iov_len - obp->offset;
+			if(rest > n) {
+				obp->offset += n;
+				if(is_slot(obp->lb)) {
+					keep_partial_monitor(monitor_of_link(c, obp));
+				}
+				return 0;
+			}
+			n -= rest;
 			c->outbuf = obp->next;
-			if(--obp->lb->refcount == 0) {
-				free(obp->lb->iov.iov_base);
-				free(obp->lb);
+			if(c->outbuf == NULL) {
+				c->outbuf_tail = &c->outbuf;
 			}
-			free(obp);
-		} else {
-			if(n > 0) {
-				if(obp->lb->refcount == 1) {
-					obp->lb->iov.iov_len -= n;
-					memmove(obp->lb->iov.iov_base, obp->lb->iov.iov_base + n, obp->lb->iov.iov_len);
-				} else {
-					struct linkedbuf *ob2 = malloc(sizeof(struct linkedbuf));
-					ob2->iov.iov_len = obp->lb->iov.iov_len - n;
-					ob2->iov.iov_base = malloc(ob2->iov.iov_len);
-					memcpy(ob2->iov.iov_base, obp->lb->iov.iov_base, ob2->iov.iov_len);
-					ob2->refcount = 1;
-
-					obp->lb->refcount--;
-					obp->lb = ob2;
+			struct monitor *m = monitor_of_link(c, obp);
+			release_link(c, obp);
+			if(m != NULL) {
+				c->frames_sent++;
+				if(m->waiting != NULL) {
+					m->link.lb = m->waiting;
+					m->waiting = NULL;
+					m->queued = 1;
+					append_link(c, &m->link);
 				}
 			}
-			return 0;
 		}
-	} while(c->outbuf != NULL);
-
-	assert(n == 0);
-
-	c->outbuf_tail = &c->outbuf;
-
-	FD_CLR(c->fd, &socksetout);
+	}
 
 	// pthread_mutex_unlock(&outbuflock);
-	return 0;
+	return c->closing;
 }
 
 static void
 drop_client(struct connection *c) {
-	FD_CLR(c->fd, &socksetin);
-	FD_CLR(c->fd, &socksetout);
-	maxsock = -1;
-
+	// closing the descriptor also takes it out of the epoll set
+	clear_pending(c);
 	close(c->fd);
+	nclients--;
+	if(c->batch) {
+		flush_dmxout_sendbuf(); // what it sent so far still goes out
+	}
 
 	// pthread_mutex_lock(&outbuflock);
-	struct linkedbuf_ptr *obp = c->outbuf;
-	while(obp != NULL) {
-		c->outbuf = obp->next;
-		if(--obp->lb->refcount == 0) {
-			free(obp->lb->iov.iov_base);
-			free(obp->lb);
-		}
-		free(obp);
-		obp = c->outbuf;
-	}
+	release_outbuf(c);
 	// pthread_mutex_unlock(&outbuflock);
 
-	if(c == connhead) {
-		connhead = c->next;
-	} else {
-		struct connection *c2 = connhead;
-		while(c2->next != c) {
-			c2 = c2->next;
-			assert(c2 != NULL);
-		}
-		assert(c2->next == c);
-		c2->next = c->next;
+	*c->prevp = c->next;
+	if(c->next != NULL) {
+		c->next->prevp = c->prevp;
 	}
 	free(c);
 }
@@ -1,30 +1,98 @@
+#include "websocket.h"
+
 struct linkedbuf {
 	struct iovec iov;
 	int refcount;
+	int pooled;	// not freed when the last reference goes
 };
 
 struct linkedbuf_ptr {
 	struct linkedbuf_ptr *next;
 	struct linkedbuf *lb;
+	size_t offset;	// already written
 };
 
+#define COMMAND_MAX		600	// the longest command a client can send
+#define CLIENT_QUEUE_MAX	(1 << 20)	// reply bytes a client may leave unread
+
+#define MONITOR_FRAME_MAX	(1 + DMX_CHANNELS)
+#define MONITOR_WS_HEADER	4	// WebSocket header of a message shorter than 64k
+#define MONITOR_KEYFRAME_HEADER	10	// 'k' type seq[4] first[2] count[2]
+#define MONITOR_DELTA_HEADER	12	// 'd' type seq[4] base[4] runs[2]
+#define MONITOR_MESSAGE_MAX	(MONITOR_WS_HEADER + MONITOR_KEYFRAME_HEADER + DMX_CHANNELS)	// a keyframe in a WebSocket frame
+
+#define MONITOR_OUTPUT		0	// '2', the output universe
+#define MONITOR_DMX_INPUT	1	// '1', the DMX input universe
+#define MONITOR_MIDI_INPUT	2	// '3', MIDI controllers
+#define MONITOR_STREAMS		3
+
+/*
+ * A client's subscription to one monitor stream, and the newest frame of
+ * it on its way to the client: at most one is queued, always the newest.
+ */
+struct monitor {
+	int subscribed;
+	int first, count;			// channels, in keyframes and deltas
+	long interval;				// nanoseconds between frames, 0 for all
+	struct timespec next;			// no frame before this
+	struct monitor *next_held;		// a frame was held back for the rate
+	struct monitor **held_prevp;		// NULL if not held
+	struct connection *conn;
+	int stream;
+	struct linkedbuf_ptr link;
+	int queued;
+	struct linkedbuf *waiting;		// newest frame, behind one that is partly written
+	struct linkedbuf own;			// what is left of a partly written frame, or an encoded message
+	char rest[MONITOR_MESSAGE_MAX];
+	int keyframe_wanted;
+	int since_keyframe;
+	int seen_valid;
+	uint32_t seen_seq;			// the frame the client has, for the next delta
+	unsigned char seen[DMX_CHANNELS];
+};
+
+#define CONN_RAW	0	// port 1337, the one byte command protocol
+#define CONN_HTTP	1	// waiting for the WebSocket upgrade request
+#define CONN_WEBSOCKET	2	// the same commands in WebSocket messages
+
 struct connection {
 	struct connection *next;
+	struct connection **prevp;
+	struct connection *next_pending;	// output queued, not written yet
+	struct connection **pending_prevp;	// NULL if not pending
 	int fd;
+	int proto;
+	int closing;				// dropped once the output is written
 	struct linkedbuf_ptr *outbuf;
 	struct linkedbuf_ptr **outbuf_tail;
+	int queued;				// buffers in outbuf
+	size_t queued_bytes;			// in replies, monitor frames are bounded
+	int overrun;				// over CLIENT_QUEUE_MAX, to be dropped
+	int monitor_deltas;			// keyframes and deltas instead of whole frames
+	int batch;				// in a '[' transaction
+	struct monitor monitors[MONITOR_STREAMS];
+	unsigned long frames_sent;
+	unsigned long frames_dropped;		// replaced by a newer frame before they went out
 	size_t inbuf_pos;
-	char inbuf[600];
+	char inbuf[COMMAND_MAX];
+	struct websocket ws;
 };
 
 void init_net();
 void *net_runner(void *);
 void pre_deinit_net(void);
 void deinit_net(void);
-void wakeup_select(void);
+void wakeup_net(void);
 // void write_client(struct connection *, char *, size_t);
 // void queue_buf(struct connection *, struct linkedbuf *);
-void broadcast(char *, size_t);
+void broadcast_frame(int, const unsigned char *, size_t);
+int client_count(void);
+void set_monitor_deltas(struct connection *, int);
+void request_keyframe(struct connection *);
+int monitor_stream(char);
+int subscribe_monitor(struct connection *, int, int, int, int);
 void client_printf(struct connection *, char *, ...);
+void client_write(struct connection *, const char *, size_t);
 
 int handle_data(struct connection *c, char *buf, size_t len);
+int handle_osc(const unsigned char *buf, size_t len);
@@ -0,0 +1,397 @@
+#define _GNU_SOURCE
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <assert.h>
+#include <err.h>
+#include <errno.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sysexits.h>
+#include <time.h>
+#include "schaeckeling.h"
+#include "dmxd.h"
+#include "netin.h"
+#include "artnet.h"
+#include "sacn.h"
+
+#define NETIN_ARTNET_TIMEOUT	10000	// ms, the Art-Net merge timeout
+#define NETIN_SACN_TIMEOUT	2500	// ms, the E1.31 data loss timeout
+
+struct netin_source {
+	int active;
+	unsigned char id[16];		// the CID, or the address for Art-Net
+	int priority;
+	int sequence;
+	struct timespec expires;
+	unsigned char values[DMX_CHANNELS];
+};
+
+struct netin_universe {
+	int protocol;
+	int universe;
+	struct netin_source sources[NETIN_SOURCES];
+	int dirty;			// sources changed since the last merge
+	int merged_valid;
+	unsigned char merged[DMX_CHANNELS];
+};
+
+struct netin_universe netin[NETIN_UNIVERSES];
+int nnetin = 0;
+int artnet_sock = -1;
+int sacn_sock = -1;
+
+/*
+ * Listen to a universe, spec is artnet:port-address or sacn:universe. The
+ * n-th universe added gets the inputs of netin_to_input_index(n - 1, ...).
+ * Returns 0 for an invalid spec.
+ */
+int
+netin_add(const char *spec) {
+	struct netin_universe *u;
+	int protocol, max;
+	const char *number;
+	char *end;
+	long universe;
+
+	if(strncmp(spec, "artnet:", 7) == 0) {
+		protocol = NETIN_ARTNET;
+		number = spec + 7;
+		max = 0x7FFF;
+	} else if(strncmp(spec, "sacn:", 5) == 0) {
+		protocol = NETIN_SACN;
+		number = spec + 5;
+		max = 63999;
+	} else {
+		fprintf(stderr, "netin: expected artnet:port-address or sacn:universe, not %s\n", spec);
+		return 0;
+	}
+	universe = strtol(number, &end, 0);
+	if(end == number || *end != '\0' || universe < (protocol == NETIN_SACN) || universe > max) {
+		fprintf(stderr, "netin: invalid universe in %s\n", spec);
+		return 0;
+	}
+	if(nnetin == NETIN_UNIVERSES) {
+		fprintf(stderr, "netin: more than %d universes\n", NETIN_UNIVERSES);
+		return 0;
+	}
+	for(int i = 0; nnetin > i; i++) {
+		if(netin[i].protocol == protocol && netin[i].universe == universe) {
+			fprintf(stderr, "netin: %s added twice\n", spec);
+			return 0;
+		}
+	}
+	u = &netin[nnetin++];
+	memset(u, 0, sizeof(struct netin_universe));
+	u->protocol = protocol;
+	u->universe = universe;
+	return 1;
+}
+
+int
+netin_inputs(void) {
+	return nnetin;
+}
+
+static int
+open_socket(int port) {
+	struct sockaddr_in addr;
+	int on = 1;
+	int sock = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+	if(sock == -1) {
+		err(EX_UNAVAILABLE, "socket()");
+	}
+	// other programs on this machine may listen too
+	if(setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on)) == -1) {
+		warn("setsockopt(SO_REUSEADDR)");
+	}
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_ANY);
+	addr.sin_port = htons(port);
+	if(bind(sock, (struct sockaddr *)&addr, sizeof(addr)) == -1) {
+		err(EX_UNAVAILABLE, "netin: bind(%d)", port);
+	}
+	return sock;
+}
+
+void
+init_netin(void) {
+	for(int i = 0; nnetin > i; i++) {
+		if(netin[i].protocol == NETIN_ARTNET && artnet_sock == -1) {
+			artnet_sock = open_socket(ARTNET_PORT);
+		}
+		if(netin[i].protocol == NETIN_SACN) {
+			struct ip_mreq mreq;
+			char group[32];
+			if(sacn_sock == -1) {
+				sacn_sock = open_socket(SACN_PORT);
+			}
+			// unicast to this machine works without
+			snprintf(group, sizeof(group), "239.255.%d.%d", netin[i].universe >> 8, netin[i].universe & 0xFF);
+			mreq.imr_multiaddr.s_addr = inet_addr(group);
+			mreq.imr_interface.s_addr = htonl(INADDR_ANY);
+			if(setsockopt(sacn_sock, IPPROTO_IP, IP_ADD_MEMBERSHIP, &mreq, sizeof(mreq)) == -1) {
+				warn("netin: joining %s", group);
+			}
+		}
+	}
+}
+
+static struct netin_universe *
+find_universe(int protocol, int universe) {
+	for(int i = 0; nnetin > i; i++) {
+		if(netin[i].protocol == protocol && netin[i].universe == universe) {
+			return &netin[i];
+		}
+	}
+	return NULL;
+}
+
+/*
+ * The slot of a source, a new one if it was not sending yet. NULL if all
+ * are taken.
+ */
+static struct netin_source *
+find_source(struct netin_universe *u, const unsigned char *id) {
+	struct netin_source *free = NULL;
+	for(int i = 0; NETIN_SOURCES > i; i++) {
+		struct netin_source *s = &u->sources[i];
+		if(s->active && memcmp(s->id, id, sizeof(s->id)) == 0) {
+			return s;
+		}
+		if(!s->active && free == NULL) {
+			free = s;
+		}
+	}
+	if(free != NULL) {
+		memcpy(free->id, id, sizeof(free->id));
+		free->sequence = -1;
+	}
+	return free;
+}
+
+static void
+add_ms(struct timespec *t, const struct timespec *from, int ms) {
+	t->tv_sec = from->tv_sec + ms / 1000;
+	t->tv_nsec = from->tv_nsec + (ms % 1000) * 1000000L;
+	if(t->tv_nsec >= 1000000000L) {
+		t->tv_sec++;
+		t->tv_nsec -= 1000000000L;
+	}
+}
+
+static int
+before(const struct timespec *a, const struct timespec *b) {
+	return a->tv_sec < b->tv_sec || (a->tv_sec == b->tv_sec && a->tv_nsec < b->tv_nsec);
+}
+
+/*
+ * Take the values of a source. Packets that arrive out of order, up to 20
+ * sequence numbers back, are dropped; 0 is no sequence for Art-Net.
+ */
+static void
+receive_values(struct netin_universe *u, const unsigned char *id, int priority, int sequence, const unsigned char *values, int channels, const struct timespec *now) {
+	struct netin_source *s = find_source(u, id);
+	if(s == NULL) {
+		return; // too many sources, the first ones win
+	}
+	if(s->active && (u->protocol == NETIN_SACN || (s->sequence != 0 && sequence != 0))) {
+		signed char diff = sequence - s->sequence;
+		if(diff <= 0 && diff > -20) {
+			return;
+		}
+	}
+	s->active = 1;
+	s->priority = priority;
+	s->sequence = sequence;
+	add_ms(&s->expires, now, u->protocol == NETIN_SACN ? NETIN_SACN_TIMEOUT : NETIN_ARTNET_TIMEOUT);
+	memcpy(s->values, values, channels);
+	memset(s->values + channels, 0, DMX_CHANNELS - channels);
+	u->dirty = 1;
+}
+
+static void
+receive_packet(int protocol, const unsigned char *p, size_t len, const struct sockaddr_in *from, const struct timespec *now) {
+	struct netin_universe *u;
+
+	if(protocol == NETIN_ARTNET) {
+		unsigned char id[16];
+		const unsigned char *values;
+		int universe, sequence;
+		int channels = artnet_parse_dmx(p, len, &universe, &sequence, &values);
+		if(channels < 0 || (u = find_universe(NETIN_ARTNET, universe)) == NULL) {
+			return;
+		}
+		memset(id, 0, sizeof(id));
+		memcpy(id, &from->sin_addr, sizeof(from->sin_addr));
+		memcpy(id + sizeof(from->sin_addr), &from->sin_port, sizeof(from->sin_port));
+		receive_values(u, id, 0, sequence, values, channels, now);
+	} else {
+		struct sacn_data d;
+		if(!sacn_parse_data(p, len, &d) || (u = find_universe(NETIN_SACN, d.universe)) == NULL) {
+			return;
+		}
+		if(d.options & SACN_OPTION_PREVIEW) {
+			return; // for visualizers, not for output
+		}
+		if(d.options & SACN_OPTION_TERMINATED) {
+			struct netin_source *s = find_source(u, d.cid);
+			if(s != NULL && s->active) {
+				s->active = 0;
+				u->dirty = 1;
+			}
+			return;
+		}
+		receive_values(u, d.cid, d.priority, d.sequence, d.values, d.channels, now);
+	}
+}
+
+/*
+ * Drop the sources that stopped sending; returns the time until the next
+ * one expires in ms, or -1 if none are sending.
+ */
+static int
+expire_sources(const struct timespec *now) {
+	int timeout = -1;
+	for(int i = 0; nnetin > i; i++) {
+		for(int j = 0; NETIN_SOURCES > j; j++) {
+			struct netin_source *s = &netin[i].sources[j];
+			if(!s->active) {
+				continue;
+			}
+			if(!before(now, &s->expires)) {
+				s->active = 0;
+				netin[i].dirty = 1;
+				continue;
+			}
+			int ms = (s->expires.tv_sec - now->tv_sec) * 1000 + (s->expires.tv_nsec - now->tv_nsec) / 1000000 + 1;
+			if(timeout == -1 || ms < timeout) {
+				timeout = ms;
+			}
+		}
+	}
+	return timeout;
+}
+
+/*
+ * Merge the sources of a universe and update the inputs that changed.
+ * Returns the number of updated inputs.
+ */
+static int
+merge_universe(int n) {
+	struct netin_universe *u = &netin[n];
+	unsigned char merged[DMX_CHANNELS];
+	int priority = -1, updated = 0;
+
+	u->dirty = 0;
+	for(int i = 0; NETIN_SOURCES > i; i++) {
+		if(u->sources[i].active && u->sources[i].priority > priority) {
+			priority = u->sources[i].priority;
+		}
+	}
+	if(priority == -1) {
+		return 0; // keep the last values
+	}
+	memset(merged, 0, sizeof(merged));
+	for(int i = 0; NETIN_SOURCES > i; i++) {
+		struct netin_source *s = &u->sources[i];
+		if(!s->active || s->priority != priority) {
+			continue;
+		}
+		for(int ch = 0; DMX_CHANNELS > ch; ch++) {
+			if(s->values[ch] > merged[ch]) {
+				merged[ch] = s->values[ch];
+			}
+		}
+	}
+	for(int ch = 0; DMX_CHANNELS > ch; ch++) {
+		if(!u->merged_valid || merged[ch] != u->merged[ch]) {
+			u->merged[ch] = merged[ch];
+			update_input(netin_to_input_index(n, ch + 1), merged[ch]);
+			updated++;
+		}
+	}
+	u->merged_valid = 1;
+	return updated;
+}
+
+/*
+ * Read what arrived on a socket, NETIN_BATCH packets at a time.
+ */
+static void
+read_socket(int sock, int protocol) {
+	static unsigned char bufs[NETIN_BATCH][NETIN_PACKET_MAX];
+	static struct sockaddr_in from[NETIN_BATCH];
+	struct mmsghdr msgs[NETIN_BATCH];
+	struct iovec iovs[NETIN_BATCH];
+	struct timespec now;
+	int n;
+
+	memset(msgs, 0, sizeof(msgs));
+	for(int i = 0; NETIN_BATCH > i; i++) {
+		iovs[i].iov_base = bufs[i];
+		iovs[i].iov_len = NETIN_PACKET_MAX;
+		msgs[i].msg_hdr.msg_name = &from[i];
+		msgs[i].msg_hdr.msg_namelen = sizeof(struct sockaddr_in);
+		msgs[i].msg_hdr.msg_iov = &iovs[i];
+		msgs[i].msg_hdr.msg_iovlen = 1;
+	}
+	do {
+		n = recvmmsg(sock, msgs, NETIN_BATCH, MSG_DONTWAIT, NULL);
+		if(n == -1) {
+			if(errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+				warn("netin: recvmmsg");
+			}
+			return;
+		}
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		for(int i = 0; n > i; i++) {
+			receive_packet(protocol, bufs[i], msgs[i].msg_len, &from[i], &now);
+			msgs[i].msg_hdr.msg_namelen = sizeof(struct sockaddr_in);
+		}
+	} while(n == NETIN_BATCH);
+}
+
+void *
+netin_runner(void *dummy) {
+	struct pollfd fds[2];
+	int nfds = 0, timeout = -1;
+
+	if(artnet_sock != -1) {
+		fds[nfds].fd = artnet_sock;
+		fds[nfds++].events = POLLIN;
+	}
+	if(sacn_sock != -1) {
+		fds[nfds].fd = sacn_sock;
+		fds[nfds++].events = POLLIN;
+	}
+	while(1) {
+		struct timespec now;
+		int updated = 0;
+
+		if(poll(fds, nfds, timeout) == -1 && errno != EINTR) {
+			err(EX_OSERR, "netin: poll");
+		}
+		for(int i = 0; nfds > i; i++) {
+			if(fds[i].revents & POLLIN) {
+				read_socket(fds[i].fd, fds[i].fd == artnet_sock ? NETIN_ARTNET : NETIN_SACN);
+			}
+		}
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		timeout = expire_sources(&now);
+		for(int i = 0; nnetin > i; i++) {
+			if(netin[i].dirty) {
+				updated += merge_universe(i);
+			}
+		}
+		// one output frame for everything that arrived
+		if(updated > 0) {
+			flush_dmxout_sendbuf();
+		}
+	}
+	return NULL;
+}
@@ -0,0 +1,25 @@
+#ifndef NETIN_H
+#define NETIN_H
+
+#define NETIN_ARTNET		1
+#define NETIN_SACN		2
+
+#define NETIN_SOURCES		4	// merged per universe
+#define NETIN_BATCH		16	// packets per recvmmsg()
+#define NETIN_PACKET_MAX	1500
+
+/*
+ * DMX from desks on the network. Every universe listened to gets its own
+ * range of input indices, netin_to_input_index(), which the fader handlers
+ * map like the channels of the DMX input. The values of all sources of a
+ * universe are merged, highest takes precedence; for sACN only among the
+ * sources with the highest priority. A source that stops sending is
+ * dropped after a timeout. If the last source is gone the inputs keep
+ * their values, like a DMX input that lost its cable.
+ */
+int netin_add(const char *spec);
+int netin_inputs(void);
+void init_netin(void);
+void *netin_runner(void *dummy);
+
+#endif
@@ -0,0 +1,213 @@
+#define _GNU_SOURCE
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netdb.h>
+#include <assert.h>
+#include <err.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sysexits.h>
+#include <time.h>
+#include <unistd.h>
+#include "schaeckeling.h"
+#include "netout.h"
+#include "artnet.h"
+#include "sacn.h"
+#include "clock.h"
+
+#define NETOUT_REFRESH 1	// seconds
+#define NETOUT_MULTICAST_TTL 8
+
+struct netout_packet packets[NETOUT_PACKETS];
+struct mmsghdr msgs[NETOUT_PACKETS];		// one for every packet
+struct mmsghdr batch[NETOUT_PACKETS];		// the ones sent this time
+struct iovec iovs[NETOUT_PACKETS];
+int npackets = 0;
+int outsock = -1;
+
+pthread_mutex_t netout_mtx = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t netout_cond;
+unsigned char netout_frame[DMX_CHANNELS];
+int netout_channels = 0;
+int netout_fresh = 0;
+
+/*
+ * Add a packet to every batch, to host, or host:port. Returns NULL if the
+ * host is unknown or there are too many packets.
+ */
+struct netout_packet *
+netout_add(int kind, const char *host, int port) {
+	struct addrinfo hints, *res;
+	char name[256], *colon;
+	struct netout_packet *p;
+
+	if(npackets == NETOUT_PACKETS) {
+		warnx("netout: more than %d packets", NETOUT_PACKETS);
+		return NULL;
+	}
+	snprintf(name, sizeof(name), "%s", host);
+	colon = strchr(name, ':');
+	if(colon != NULL) {
+		*colon = '\0';
+		port = atoi(colon + 1);
+	}
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_INET;
+	hints.ai_socktype = SOCK_DGRAM;
+	if(getaddrinfo(name, NULL, &hints, &res) != 0) {
+		warnx("netout: unknown host %s", name);
+		return NULL;
+	}
+
+	p = &packets[npackets++];
+	memset(p, 0, sizeof(struct netout_packet));
+	p->kind = kind;
+	memcpy(&p->dest, res->ai_addr, sizeof(struct sockaddr_in));
+	p->dest.sin_port = htons(port);
+	freeaddrinfo(res);
+	return p;
+}
+
+int
+netout_outputs(void) {
+	return npackets;
+}
+
+void
+init_netout(void) {
+	int on = 1, ttl = NETOUT_MULTICAST_TTL;
+
+	outsock = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+	if(outsock == -1) {
+		err(EX_UNAVAILABLE, "socket()");
+	}
+	// broadcast addresses are allowed as destinations
+	if(setsockopt(outsock, SOL_SOCKET, SO_BROADCAST, &on, sizeof(on)) == -1) {
+		warn("setsockopt(SO_BROADCAST)");
+	}
+	// sACN multicast may have to cross a router to the nodes
+	if(setsockopt(outsock, IPPROTO_IP, IP_MULTICAST_TTL, &ttl, sizeof(ttl)) == -1) {
+		warn("setsockopt(IP_MULTICAST_TTL)");
+	}
+
+	for(int i = 0; npackets > i; i++) {
+		iovs[i].iov_base = packets[i].data;
+		iovs[i].iov_len = packets[i].len;
+		memset(&msgs[i], 0, sizeof(struct mmsghdr));
+		msgs[i].msg_hdr.msg_name = &packets[i].dest;
+		msgs[i].msg_hdr.msg_namelen = sizeof(struct sockaddr_in);
+		msgs[i].msg_hdr.msg_iov = &iovs[i];
+		msgs[i].msg_hdr.msg_iovlen = 1;
+	}
+	clock_cond_init(&netout_cond);
+}
+
+/*
+ * Hand a frame to the output thread. Only the newest frame is sent when
+ * they come faster than the network takes them.
+ */
+void
+netout_send(const unsigned char *frame, int channels) {
+	if(npackets == 0) {
+		return;
+	}
+	assert(channels >= 0 && channels <= DMX_CHANNELS);
+	pthread_mutex_lock(&netout_mtx);
+	memcpy(netout_frame, frame, channels);
+	netout_channels = channels;
+	netout_fresh = 1;
+	pthread_cond_signal(&netout_cond);
+	pthread_mutex_unlock(&netout_mtx);
+}
+
+/*
+ * Returns 0 if the packet is not sent this time.
+ */
+static int
+fill_packet(struct netout_packet *p, const unsigned char *frame, int channels, const struct timespec *now) {
+	switch(p->kind) {
+		case NETOUT_ARTDMX:
+			artnet_fill_dmx(p, frame, channels);
+			return 1;
+		case NETOUT_ARTSYNC:
+			return 1; // always the same
+		case NETOUT_SACN_DATA:
+			sacn_fill_data(p, frame, channels);
+			return 1;
+		case NETOUT_SACN_DISCOVERY:
+			return sacn_discovery_due(p, now);
+	}
+	return 0;
+}
+
+static void
+send_packets(int count) {
+	static int last_errno = 0;
+	int done = 0;
+
+	while(count > done) {
+		int n = sendmmsg(outsock, batch + done, count - done, 0);
+		if(n == -1) {
+			if(errno == EINTR) {
+				continue;
+			}
+			// once, not for every frame while a network is down
+			if(errno != last_errno) {
+				warn("netout: sendmmsg");
+				last_errno = errno;
+			}
+			// the rest may go elsewhere
+			done++;
+			continue;
+		}
+		if(n > 0) {
+			// the network is back, warn again when it goes
+			last_errno = 0;
+		}
+		done += n;
+	}
+}
+
+void *
+netout_runner(void *dummy) {
+	unsigned char frame[DMX_CHANNELS];
+	int channels = 0;
+	struct timespec until;
+
+	pthread_mutex_lock(&netout_mtx);
+	while(1) {
+		clock_gettime(CLOCK_MONOTONIC, &until);
+		until.tv_sec += NETOUT_REFRESH;
+		while(!netout_fresh) {
+			if(pthread_cond_timedwait(&netout_cond, &netout_mtx, &until) == ETIMEDOUT) {
+				break;
+			}
+		}
+		if(netout_fresh) {
+			memcpy(frame, netout_frame, netout_channels);
+			channels = netout_channels;
+			netout_fresh = 0;
+		}
+		pthread_mutex_unlock(&netout_mtx);
+
+		if(channels > 0) {
+			struct timespec now;
+			int n = 0;
+			clock_gettime(CLOCK_MONOTONIC, &now);
+			for(int i = 0; npackets > i; i++) {
+				if(fill_packet(&packets[i], frame, channels, &now)) {
+					iovs[i].iov_len = packets[i].len;
+					batch[n++] = msgs[i];
+				}
+			}
+			send_packets(n);
+		}
+
+		pthread_mutex_lock(&netout_mtx);
+	}
+	return NULL;
+}
@@ -0,0 +1,39 @@
+#ifndef NETOUT_H
+#define NETOUT_H
+
+#include <netinet/in.h>
+#include <time.h>
+
+#define NETOUT_PACKETS		64
+#define NETOUT_PACKET_MAX	(126 + DMX_CHANNELS)	// an sACN data packet
+
+#define NETOUT_ARTDMX		1
+#define NETOUT_ARTSYNC		2
+#define NETOUT_SACN_DATA	3
+#define NETOUT_SACN_DISCOVERY	4
+
+/*
+ * DMX over the network. send_dmx() hands every frame to netout_send(),
+ * which only copies it; the output thread fills the preallocated packets of
+ * all outputs and sends them with one sendmmsg(), in the order they were
+ * added. Without new frames, the last one is sent again every second, as
+ * nodes drop an output that has been silent too long. Packets that are not
+ * part of every frame, like sACN universe discovery, are left out of the
+ * batch until they are due.
+ */
+struct netout_packet {
+	int kind;
+	struct sockaddr_in dest;
+	size_t len;
+	unsigned char sequence;
+	struct timespec due;		// for packets that are not in every batch
+	unsigned char data[NETOUT_PACKET_MAX];
+};
+
+struct netout_packet *netout_add(int kind, const char *host, int port);
+int netout_outputs(void);
+void init_netout(void);
+void *netout_runner(void *dummy);
+void netout_send(const unsigned char *frame, int channels);
+
+#endif
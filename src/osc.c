@@ -0,0 +1,159 @@
+#include <assert.h>
+#include <stdint.h>
+#include <string.h>
+#include "schaeckeling.h"
+#include "osc.h"
+
+static uint32_t
+get32(const unsigned char *p) {
+	return (uint32_t)p[0] << 24 | p[1] << 16 | p[2] << 8 | p[3];
+}
+
+/*
+ * The size of a string with its padding, 0 if it does not end in the
+ * packet.
+ */
+static size_t
+osc_string(const unsigned char *p, size_t len) {
+	const unsigned char *nul = memchr(p, '\0', len);
+	if(nul == NULL) {
+		return 0;
+	}
+	size_t n = (nul - p + 4) & ~(size_t)3;
+	return n <= len ? n : 0;
+}
+
+static int
+parse_message(const unsigned char *p, size_t len, osc_handler handler, void *arg) {
+	struct osc_message m;
+	size_t n;
+
+	n = osc_string(p, len);
+	if(n == 0 || p[0] != '/') {
+		return -1;
+	}
+	m.address = (const char *)p;
+	p += n;
+	len -= n;
+	n = len > 0 ? osc_string(p, len) : 0;
+	if(n == 0 || p[0] != ',') {
+		return -1;
+	}
+	m.types = (const char *)p + 1;
+	p += n;
+	len -= n;
+
+	// every argument has to be in the packet
+	m.args = p;
+	for(const char *type = m.types; *type != '\0'; type++) {
+		size_t size;
+		switch(*type) {
+			case 'i': case 'f': case 'c': case 'r': case 'm':
+				size = 4;
+				break;
+			case 'h': case 't': case 'd':
+				size = 8;
+				break;
+			case 's': case 'S':
+				size = osc_string(p, len);
+				if(size == 0) {
+					return -1;
+				}
+				break;
+			case 'b':
+				if(len < 4 || get32(p) > len - 4) {
+					return -1;
+				}
+				size = 4 + ((get32(p) + 3) & ~(size_t)3);
+				break;
+			case 'T': case 'F': case 'N': case 'I': case '[': case ']':
+				size = 0;
+				break;
+			default:
+				return -1;
+		}
+		if(size > len) {
+			return -1;
+		}
+		p += size;
+		len -= size;
+	}
+	m.argslen = p - m.args;
+	if(handler != NULL) {
+		handler(&m, arg);
+	}
+	return 0;
+}
+
+/*
+ * Call handler for every message in a packet, in order, also those in
+ * (nested) bundles. Time tags are not looked at: a bundle takes effect when
+ * it arrives. Returns -1 if the packet is malformed, which may be after
+ * some messages were handled; a NULL handler only checks the packet.
+ */
+int
+osc_parse(const unsigned char *p, size_t len, osc_handler handler, void *arg) {
+	if(len == 0 || len % 4 != 0) {
+		return -1;
+	}
+	if(p[0] != '#') {
+		return parse_message(p, len, handler, arg);
+	}
+	if(len < 16 || memcmp(p, "#bundle", 8) != 0) {
+		return -1;
+	}
+	p += 16;
+	len -= 16;
+	while(len > 0) {
+		uint32_t size;
+		if(len < 4) {
+			return -1;
+		}
+		size = get32(p);
+		if(size > len - 4 || osc_parse(p + 4, size, handler, arg) != 0) {
+			return -1;
+		}
+		p += 4 + size;
+		len -= 4 + size;
+	}
+	return 0;
+}
+
+/*
+ * The first argument as a level from 0 to 255: floats and doubles run from
+ * 0 to 1, integers from 0 to 255, True is full. Returns -1 if there is no
+ * such argument.
+ */
+int
+osc_level(const struct osc_message *m) {
+	double d;
+	int32_t i;
+	float f;
+	uint32_t bits;
+	uint64_t wide;
+
+	switch(m->types[0]) {
+		case 'i':
+			i = (int32_t)get32(m->args);
+			return i < 0 ? 0 : (i > 255 ? 255 : i);
+		case 'f':
+			bits = get32(m->args);
+			memcpy(&f, &bits, sizeof(f));
+			d = f;
+			break;
+		case 'd':
+			wide = (uint64_t)get32(m->args) << 32 | get32(m->args + 4);
+			memcpy(&d, &wide, sizeof(d));
+			break;
+		case 'T':
+			return 255;
+		case 'F':
+			return 0;
+		default:
+			return -1;
+	}
+	if(!(d > 0)) {
+		return 0; // also NaN
+	}
+	return d >= 1 ? 255 : (int)(d * 255 + 0.5);
+}
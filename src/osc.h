@@ -0,0 +1,25 @@
+#ifndef OSC_H
+#define OSC_H
+
+#include <stddef.h>
+
+#define OSC_PORT		8000
+#define OSC_PACKET_MAX		8192
+
+/*
+ * Open Sound Control 1.0 over UDP. Messages are not copied: the address,
+ * type tags and arguments point into the packet.
+ */
+struct osc_message {
+	const char *address;
+	const char *types;		// after the ','
+	const unsigned char *args;
+	size_t argslen;
+};
+
+typedef void (*osc_handler)(const struct osc_message *, void *);
+
+int osc_parse(const unsigned char *p, size_t len, osc_handler handler, void *arg);
+int osc_level(const struct osc_message *m);
+
+#endif
@@ -0,0 +1,88 @@
+#define _POSIX_C_SOURCE 200112L
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <assert.h>
+#include <err.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include "schaeckeling.h"
+#include "preset.h"
+
+#define ARENA_SIZE (PRESET_SLOTS * sizeof(struct preset))
+
+static int persistent = 0;
+
+/*
+ * Map the preset arena from filename, creating or resizing the file if
+ * needed. If the file can't be used, presets are kept in memory only.
+ * A read-only arena is a private copy: changes are never written back.
+ */
+struct preset *
+open_preset_arena(const char *filename, int writable) {
+	struct preset *arena;
+	struct stat st;
+	int fd = open(filename, writable ? O_RDWR | O_CREAT : O_RDONLY, 0644);
+	if(fd == -1) {
+		if(writable || errno != ENOENT) {
+			warn("open(%s)", filename);
+		}
+	} else if(writable && ftruncate(fd, ARENA_SIZE) != 0) {
+		warn("ftruncate(%s)", filename);
+		close(fd);
+		fd = -1;
+	} else if(!writable && (fstat(fd, &st) != 0 || st.st_size < ARENA_SIZE)) {
+		close(fd);
+		fd = -1;
+	}
+
+	if(fd != -1) {
+		arena = mmap(NULL, ARENA_SIZE, PROT_READ | PROT_WRITE, writable ? MAP_SHARED : MAP_PRIVATE, fd, 0);
+		close(fd);
+		if(arena != MAP_FAILED) {
+			persistent = writable;
+			return arena;
+		}
+		warn("mmap");
+	}
+
+	if(writable) {
+		fprintf(stderr, "Presets will not be saved\n");
+	}
+	arena = calloc(PRESET_SLOTS, sizeof(struct preset));
+	if(arena == NULL) {
+		err(1, "calloc");
+	}
+	return arena;
+}
+
+/*
+ * Schedule a write-back of one slot after it has been changed.
+ */
+void
+sync_preset(struct preset *arena, int slot) {
+	long pagesize = sysconf(_SC_PAGESIZE);
+	char *start = (char *)(arena + slot);
+	char *page = (char *)arena + ((start - (char *)arena) / pagesize) * pagesize;
+	assert(slot >= 0 && slot < PRESET_SLOTS);
+	if(!persistent) {
+		return;
+	}
+	if(msync(page, start + sizeof(struct preset) - page, MS_ASYNC) != 0) {
+		warn("msync");
+	}
+}
+
+int
+preset_is_empty(const struct preset *p) {
+	int dmxidx;
+	for(dmxidx = 0; DMX_CHANNELS > dmxidx; dmxidx++) {
+		if(p->mask[dmxidx]) {
+			return 0;
+		}
+	}
+	return 1;
+}
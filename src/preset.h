@@ -0,0 +1,20 @@
+#ifndef PRESET_H
+#define PRESET_H
+
+#define PRESET_SLOTS 64
+
+/*
+ * A preset holds a value for every output channel, and a mask telling which
+ * of those channels it actually sets. All slots live in one contiguous arena
+ * that is mapped from a file, so stored presets survive a restart.
+ */
+struct preset {
+	unsigned char values[DMX_CHANNELS];
+	unsigned char mask[DMX_CHANNELS];
+};
+
+struct preset *open_preset_arena(const char *filename, int writable);
+void sync_preset(struct preset *arena, int slot);
+int preset_is_empty(const struct preset *p);
+
+#endif
@@ -0,0 +1,444 @@
+#define _POSIX_C_SOURCE 200112L
+#include <ctype.h>
+#include <err.h>
+#include <math.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sysexits.h>
+#include <unistd.h>
+
+/*
+ * Program compiler: reads a light program in the CSV dialect of
+ * csv-parser.php and writes it as PN/PS/PA commands, either to stdout for
+ * sending to the daemon or to the program file the daemon loads on start.
+ * The input is read in one pass; steps are written to a temporary file as
+ * they are compiled, since the step count goes in front of them.
+ */
+
+#define MAX_COLUMNS	512
+#define MAX_LAMPS	64
+#define MAX_CELL	256
+#define MAX_STEPS	65535
+#define LAMP_CHANNELS	8
+
+extern char *optarg;
+extern int optind;
+
+enum column_type { COLUMN_COLOR, COLUMN_INTENSITY };
+
+struct column {
+	char name[MAX_CELL];
+	enum column_type type;
+	int channel;
+};
+
+struct row {
+	int ncells;
+	char cells[MAX_COLUMNS][MAX_CELL];
+};
+
+struct named_color {
+	const char *name;
+	unsigned char rgb[3];
+};
+
+static const struct named_color named_colors[] = {
+	{ "red",		{ 255,   0,   0 } },
+	{ "orange",		{ 255,  50,   0 } },
+	{ "yellow",		{ 255, 150,   0 } },
+	{ "lightgreen",		{ 100, 255,   0 } },
+	{ "green",		{  40, 255,   0 } },
+	{ "darkgreen",		{   0, 255,   0 } },
+	{ "turqoise",		{   0, 255,  50 } },
+	{ "lightturqoise",	{   0, 255, 150 } },
+	{ "lightblue",		{   0, 150, 255 } },
+	{ "blue",		{   0,  50, 255 } },
+	{ "darkblue",		{   0,   0, 255 } },
+	{ "lila",		{  50,   0, 255 } },
+	{ "lightpink",		{ 150,   0, 255 } },
+	{ "pink",		{ 255,   0, 255 } },
+	{ "magenta",		{ 220,   0,  50 } },
+	{ "white",		{ 220, 200, 100 } },
+	{ "black",		{   0,   0,   0 } },
+};
+
+static int lineno = 0;
+static char *partial = NULL; // output file being written, removed on errors
+
+static void
+fail(const char *fmt, ...) {
+	va_list ap;
+	fprintf(stderr, "Error: Line %d: ", lineno);
+	va_start(ap, fmt);
+	vfprintf(stderr, fmt, ap);
+	va_end(ap);
+	fprintf(stderr, "\n");
+	if(partial != NULL) {
+		unlink(partial);
+	}
+	exit(1);
+}
+
+/*
+ * Read one record: fields separated by ';', optionally quoted with '"'
+ * (a quote inside a quoted field is written twice). Returns 0 at the end.
+ */
+static int
+read_row(FILE *in, struct row *row) {
+	int ch, len = 0, quoted = 0, any = 0;
+	row->ncells = 0;
+	row->cells[0][0] = '\0';
+	lineno++;
+	while((ch = getc_unlocked(in)) != EOF) {
+		any = 1;
+		if(quoted) {
+			if(ch == '"') {
+				ch = getc_unlocked(in);
+				if(ch != '"') {
+					quoted = 0;
+					ungetc(ch, in);
+					continue;
+				}
+			} else if(ch == '\n') {
+				lineno++;
+			}
+		} else if(ch == '"' && len == 0) {
+			quoted = 1;
+			continue;
+		} else if(ch == ';' || ch == '\n') {
+			row->cells[row->ncells][len] = '\0';
+			row->ncells++;
+			len = 0;
+			if(ch == '\n') {
+				return 1;
+			}
+			if(row->ncells == MAX_COLUMNS) {
+				fail("Too many columns");
+			}
+			row->cells[row->ncells][0] = '\0';
+			continue;
+		} else if(ch == '\r') {
+			continue;
+		}
+		if(len == MAX_CELL - 1) {
+			fail("Value too long");
+		}
+		row->cells[row->ncells][len++] = ch;
+	}
+	if(!any) {
+		return 0;
+	}
+	row->cells[row->ncells][len] = '\0';
+	row->ncells++;
+	return 1;
+}
+
+// the same test as PHP's !$cell, so "0" counts as empty too
+static int
+is_empty(const char *cell) {
+	return cell[0] == '\0' || strcmp(cell, "0") == 0;
+}
+
+static int
+is_digits(const char *s, int min, int max) {
+	int n = 0;
+	while(isdigit((unsigned char)s[n])) {
+		n++;
+	}
+	return n >= min && n <= max && s[n] == '\0';
+}
+
+static void
+trim(char *dst, const char *src, int size) {
+	int len;
+	while(isspace((unsigned char)*src)) {
+		src++;
+	}
+	snprintf(dst, size, "%s", src);
+	len = strlen(dst);
+	while(len > 0 && isspace((unsigned char)dst[len - 1])) {
+		dst[--len] = '\0';
+	}
+}
+
+static int
+parse_color(const char *cell, unsigned char *rgb) {
+	char name[MAX_CELL];
+	unsigned int i;
+	if(strlen(cell) == 6 && strspn(cell, "0123456789abcdefABCDEF") == 6) {
+		unsigned long v = strtoul(cell, NULL, 16);
+		rgb[0] = v >> 16;
+		rgb[1] = v >> 8;
+		rgb[2] = v;
+		return 0;
+	}
+	trim(name, cell, sizeof(name));
+	for(i = 0; sizeof(named_colors) / sizeof(named_colors[0]) > i; i++) {
+		if(strcmp(name, named_colors[i].name) == 0) {
+			memcpy(rgb, named_colors[i].rgb, 3);
+			return 0;
+		}
+	}
+	return -1;
+}
+
+static int
+parse_intensity(const char *cell, double *intensity) {
+	char digits[MAX_CELL];
+	int len = strlen(cell);
+	if(len > 1 && cell[len - 1] == '%') {
+		memcpy(digits, cell, len - 1);
+		digits[len - 1] = '\0';
+		if(!is_digits(digits, 1, 3)) {
+			return -1;
+		}
+		*intensity = atoi(digits) * 255 / 100.0;
+	} else if(is_digits(cell, 1, 3)) {
+		*intensity = atoi(cell);
+	} else {
+		return -1;
+	}
+	return (*intensity >= 0 && *intensity <= 255) ? 0 : -1;
+}
+
+// column names: "Kleur N" or "Intensiteit N", case insensitive
+static int
+parse_column(const char *name, struct column *col) {
+	const char *p;
+	int lamp;
+	if(strncasecmp(name, "Kleur", 5) == 0) {
+		col->type = COLUMN_COLOR;
+		p = name + 5;
+	} else if(strncasecmp(name, "Intensiteit", 11) == 0) {
+		col->type = COLUMN_INTENSITY;
+		p = name + 11;
+	} else {
+		return -1;
+	}
+	while(isspace((unsigned char)*p)) {
+		p++;
+	}
+	if(!isdigit((unsigned char)*p)) {
+		return -1;
+	}
+	lamp = atoi(p);
+	if(lamp < 1 || lamp > MAX_LAMPS) {
+		return -1;
+	}
+	col->channel = 1 + (lamp - 1) * LAMP_CHANNELS;
+	snprintf(col->name, sizeof(col->name), "%s", name);
+	return 0;
+}
+
+static void
+put_number(FILE *out, int n) {
+	putc(n / 256, out);
+	putc(n % 256, out);
+}
+
+/*
+ * Steps per beat: n, or 1/n as 128 + n.
+ */
+static void
+put_spb(FILE *out, int spb) {
+	putc(spb >= 1 ? spb : 128 - spb, out);
+}
+
+static void
+copy_stream(FILE *from, FILE *to) {
+	char buf[65536];
+	size_t n;
+	while((n = fread(buf, 1, sizeof(buf), from)) > 0) {
+		if(fwrite(buf, 1, n, to) != n) {
+			err(1, "write");
+		}
+	}
+}
+
+static void
+compile(FILE *in, FILE *out) {
+	static struct row rows[2];
+	struct row *row = &rows[0], *previous = &rows[1], *swap;
+	struct column header[MAX_COLUMNS];
+	int nheader = 0, have_previous = 0, empty_previous = 0;
+	int spb = 1, channels = 0, steps = 0, i, ch;
+	unsigned char step[MAX_LAMPS * LAMP_CHANNELS];
+	unsigned char colors[MAX_LAMPS][3];
+	double intensities[MAX_LAMPS];
+	FILE *tmp = tmpfile();
+
+	if(tmp == NULL) {
+		err(1, "tmpfile");
+	}
+	while(read_row(in, row)) {
+		int total = 0;
+		for(i = 0; row->ncells > i; i++) {
+			total += strlen(row->cells[i]);
+		}
+		if(total == 0 && (nheader == 0 || row->ncells == 1)) {
+			continue;
+		}
+		if(row->cells[0][0] == '#') {
+			continue;
+		} else if(row->cells[0][0] == '!') {
+			const char *arg = row->ncells > 1 ? row->cells[1] : "";
+			if(strcmp(row->cells[0], "!spb") == 0) {
+				if(strncmp(arg, "1/", 2) == 0 && is_digits(arg + 2, 1, 3) && atoi(arg + 2) >= 1 && atoi(arg + 2) <= 127) {
+					spb = -atoi(arg + 2);
+				} else if(is_digits(arg, 1, 3) && atoi(arg) >= 1 && atoi(arg) <= 127) {
+					spb = atoi(arg);
+				} else {
+					fail("Steps Per Beat is not a number");
+				}
+			} else if(strcmp(row->cells[0], "!author") == 0) {
+				if(arg[0] == '\0') {
+					fail("Author is empty");
+				}
+			} else if(strcmp(row->cells[0], "!empty") == 0) {
+				if(strcasecmp(arg, "off") == 0) {
+					empty_previous = 0;
+				} else if(strcasecmp(arg, "previous") == 0) {
+					empty_previous = 1;
+				} else {
+					fail("Empty is invalid. Should be 'off' or 'previous'");
+				}
+			} else {
+				fail("Invalid macro %s", row->cells[0]);
+			}
+			continue;
+		}
+		if(nheader == 0) {
+			for(i = 0; row->ncells > i; i++) {
+				if(parse_column(row->cells[i], &header[i]) != 0) {
+					fail("Invalid column %s", row->cells[i]);
+				}
+				if(header[i].channel + LAMP_CHANNELS - 1 > channels) {
+					channels = header[i].channel + LAMP_CHANNELS - 1;
+				}
+			}
+			nheader = row->ncells;
+			continue;
+		}
+		if(row->ncells > nheader) {
+			fail("Too many columns (%d with only %d in the header)", row->ncells, nheader);
+		}
+		if(steps == MAX_STEPS) {
+			fail("Too many steps");
+		}
+
+		// lamps without a value in this row stay black
+		memset(colors, 0, sizeof(colors));
+		memset(intensities, 0, sizeof(intensities));
+		for(i = 0; row->ncells > i; i++) {
+			char *cell = row->cells[i];
+			int lamp = (header[i].channel - 1) / LAMP_CHANNELS;
+			if(is_empty(cell) && empty_previous) {
+				if(!have_previous) {
+					fail("Invalid empty value for %s (no previous value yet)", header[i].name);
+				}
+				strcpy(cell, i < previous->ncells ? previous->cells[i] : "");
+			}
+			switch(header[i].type) {
+				case COLUMN_COLOR:
+					if(is_empty(cell)) {
+						strcpy(cell, "black");
+					}
+					if(parse_color(cell, colors[lamp]) != 0) {
+						fail("Invalid value %s for %s", cell, header[i].name);
+					}
+					break;
+				case COLUMN_INTENSITY:
+					if(is_empty(cell)) {
+						strcpy(cell, "0");
+					}
+					if(parse_intensity(cell, &intensities[lamp]) != 0) {
+						fail("Invalid value %s for %s", cell, header[i].name);
+					}
+					break;
+			}
+		}
+		memset(step, 0, channels);
+		for(i = 0; nheader > i; i++) {
+			int lamp = (header[i].channel - 1) / LAMP_CHANNELS;
+			for(ch = 0; 3 > ch; ch++) {
+				step[header[i].channel - 1 + ch] = round(colors[lamp][ch] * intensities[lamp] / 255);
+			}
+		}
+		fputs("PS", tmp);
+		put_number(tmp, steps);
+		fwrite(step, 1, channels, tmp);
+		steps++;
+		// the row becomes the previous one, without copying it
+		swap = previous;
+		previous = row;
+		row = swap;
+		have_previous = 1;
+	}
+	if(ferror(in)) {
+		err(1, "read");
+	}
+
+	fputs("PN", out);
+	put_number(out, channels);
+	put_number(out, steps);
+	put_spb(out, spb);
+	rewind(tmp);
+	copy_stream(tmp, out);
+	fclose(tmp);
+	fputs("PA", out);
+}
+
+int
+main(int argc, char **argv) {
+	FILE *in = stdin, *out = stdout;
+	char *output = NULL, tmpname[1024];
+	int opt;
+
+	while((opt = getopt(argc, argv, "o:")) != -1) {
+		switch(opt) {
+			case 'o':
+				output = optarg;
+				break;
+			default:
+				goto usage;
+		}
+	}
+	if(argc - optind > 1) {
+		goto usage;
+	}
+	if(argc - optind == 1 && strcmp(argv[optind], "-") != 0) {
+		in = fopen(argv[optind], "r");
+		if(in == NULL) {
+			err(1, "%s", argv[optind]);
+		}
+	}
+	if(output != NULL) {
+		// write next to the target and rename, so the daemon never reads half a program
+		snprintf(tmpname, sizeof(tmpname), "%s.new", output);
+		out = fopen(tmpname, "wb");
+		if(out == NULL) {
+			err(1, "%s", tmpname);
+		}
+		partial = tmpname;
+	}
+
+	compile(in, out);
+
+	if(fflush(out) != 0 || ferror(out)) {
+		err(1, "write");
+	}
+	if(output != NULL) {
+		fclose(out);
+		if(rename(tmpname, output) != 0) {
+			err(1, "rename %s", tmpname);
+		}
+	}
+	return 0;
+
+usage:
+	fprintf(stderr, "Usage: %s [-o programma.dat] [file.csv]\n", argv[0]);
+	return EX_USAGE;
+}
@@ -0,0 +1,449 @@
+#define _POSIX_C_SOURCE 200112L
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <assert.h>
+#include <err.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "schaeckeling.h"
+#include "record.h"
+
+#define RECORD_CHUNK	(1 << 20)	// the log file grows by doubling from here
+#define RECORD_GAP	2		// unchanged channels that do not end a run
+
+/*
+ * Make room for a record of at most need bytes. On failure the recording
+ * stops, but what has been written so far stays valid.
+ */
+static int
+reserve(struct recorder *r, size_t need) {
+	size_t size = r->size;
+	unsigned char *map;
+	if(r->map == NULL) {
+		return 0;
+	}
+	if(size >= r->len + need) {
+		return 1;
+	}
+	while(r->len + need > size) {
+		size *= 2;
+	}
+	if(ftruncate(r->fd, size) != 0) {
+		warn("recorder: ftruncate");
+	} else if((map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, r->fd, 0)) == MAP_FAILED) {
+		warn("recorder: mmap");
+	} else {
+		munmap(r->map, r->size);
+		r->map = map;
+		r->size = size;
+		return 1;
+	}
+	fprintf(stderr, "recorder: Log full, recording stopped\n");
+	munmap(r->map, r->size);
+	r->map = NULL;
+	return 0;
+}
+
+static void
+put_varint(struct recorder *r, unsigned long long v) {
+	while(v >= 0x80) {
+		r->map[r->len++] = (v & 0x7f) | 0x80;
+		v >>= 7;
+	}
+	r->map[r->len++] = v;
+}
+
+/*
+ * Runs of bytes that differ from old (zeroes if NULL), as pairs of the
+ * number of unchanged bytes before the run and the run length, followed by
+ * the run. A run length of zero ends the list.
+ */
+static void
+put_delta(struct recorder *r, const unsigned char *old, const unsigned char *new, int n) {
+	int i = 0, start, end, prev = 0;
+	put_varint(r, n);
+	while(n > i) {
+		if((old != NULL ? old[i] : 0) == new[i]) {
+			i++;
+			continue;
+		}
+		start = i;
+		end = i + 1;
+		for(i = end; n > i && RECORD_GAP >= i - end; i++) {
+			if((old != NULL ? old[i] : 0) != new[i]) {
+				end = i + 1;
+			}
+		}
+		put_varint(r, start - prev);
+		put_varint(r, end - start);
+		memcpy(r->map + r->len, new + start, end - start);
+		r->len += end - start;
+		prev = i = end;
+	}
+	put_varint(r, 0);
+	put_varint(r, 0);
+}
+
+/*
+ * Start a record: the type byte is only filled in by end_record, so a
+ * record that was cut short by a crash reads as the end of the log.
+ */
+static long
+begin_record(struct recorder *r, const struct timespec *t, size_t payload) {
+	long long ns;
+	long start = r->len;
+	if(!reserve(r, 1 + 10 + payload)) {
+		return -1;
+	}
+	ns = (t->tv_sec - r->last.tv_sec) * 1000000000LL + (t->tv_nsec - r->last.tv_nsec);
+	if(ns < 0) {
+		ns = 0;
+	} else {
+		r->last = *t;
+	}
+	r->len++;
+	put_varint(r, ns);
+	return start;
+}
+
+static void
+end_record(struct recorder *r, long start, int type) {
+	r->map[start] = type;
+}
+
+int
+recorder_open(struct recorder *r, const char *filename, const struct timespec *start) {
+	memset(r, 0, sizeof(*r));
+	r->fd = open(filename, O_RDWR | O_CREAT | O_EXCL, 0644);
+	if(r->fd == -1) {
+		warn("recorder: open(%s)", filename);
+		return 0;
+	}
+	if(ftruncate(r->fd, RECORD_CHUNK) != 0) {
+		warn("recorder: ftruncate");
+		close(r->fd);
+		return 0;
+	}
+	r->map = mmap(NULL, RECORD_CHUNK, PROT_READ | PROT_WRITE, MAP_SHARED, r->fd, 0);
+	if(r->map == MAP_FAILED) {
+		warn("recorder: mmap");
+		r->map = NULL;
+		close(r->fd);
+		return 0;
+	}
+	r->size = RECORD_CHUNK;
+	memcpy(r->map, RECORD_MAGIC, strlen(RECORD_MAGIC));
+	r->len = strlen(RECORD_MAGIC);
+	put_varint(r, start->tv_sec);
+	put_varint(r, start->tv_nsec);
+	r->last = *start;
+	return 1;
+}
+
+/*
+ * Cut the file to what has been written. A log that was never closed is
+ * just as readable, it only has zeroes at the end.
+ */
+void
+recorder_close(struct recorder *r) {
+	if(r->map != NULL) {
+		munmap(r->map, r->size);
+		r->map = NULL;
+	}
+	if(ftruncate(r->fd, r->len) != 0) {
+		warn("recorder: ftruncate");
+	}
+	close(r->fd);
+}
+
+void
+record_presets(struct recorder *r, const struct timespec *t, const unsigned char *arena, int len) {
+	long start = begin_record(r, t, 2 * len + 32);
+	if(start >= 0) {
+		put_delta(r, NULL, arena, len);
+		end_record(r, start, RECORD_PRESETS);
+	}
+}
+
+void
+record_command(struct recorder *r, const struct timespec *t, const char *buf, int len) {
+	long start = begin_record(r, t, 10 + len);
+	if(start >= 0) {
+		put_varint(r, len);
+		memcpy(r->map + r->len, buf, len);
+		r->len += len;
+		end_record(r, start, RECORD_COMMAND);
+	}
+}
+
+void
+record_input(struct recorder *r, const struct timespec *t, int input, int value) {
+	long start = begin_record(r, t, 10 + 1);
+	if(start >= 0) {
+		put_varint(r, input);
+		r->map[r->len++] = value;
+		end_record(r, start, RECORD_INPUT);
+	}
+}
+
+void
+record_midi_clock(struct recorder *r, const struct timespec *t, int status, int position) {
+	long start = begin_record(r, t, 1 + 10);
+	if(start >= 0) {
+		r->map[r->len++] = status;
+		put_varint(r, position + 1);
+		end_record(r, start, RECORD_MIDI_CLOCK);
+	}
+}
+
+void
+record_mtc_quarter_frame(struct recorder *r, const struct timespec *t, int data) {
+	long start = begin_record(r, t, 1);
+	if(start >= 0) {
+		r->map[r->len++] = data;
+		end_record(r, start, RECORD_MTC_QUARTER);
+	}
+}
+
+void
+record_mtc_full_frame(struct recorder *r, const struct timespec *t, const unsigned char *hmsf) {
+	long start = begin_record(r, t, 4);
+	if(start >= 0) {
+		memcpy(r->map + r->len, hmsf, 4);
+		r->len += 4;
+		end_record(r, start, RECORD_MTC_FULL);
+	}
+}
+
+/*
+ * Frames are stored relative to the previous frame of either type.
+ */
+void
+record_frame(struct recorder *r, int type, const struct timespec *t, const unsigned char *frame, int channels) {
+	long start;
+	assert(channels >= 0 && channels <= DMX_CHANNELS);
+	if(r->holding && RECORD_HELD > r->nheld) {
+		r->held[r->nheld].type = type;
+		r->held[r->nheld].t = *t;
+		r->held[r->nheld].channels = channels;
+		memcpy(r->held[r->nheld].frame, frame, channels);
+		r->nheld++;
+		return;
+	}
+	start = begin_record(r, t, 2 * channels + 32);
+	if(start >= 0) {
+		put_delta(r, r->frame, frame, channels);
+		memcpy(r->frame, frame, channels);
+		end_record(r, start, type);
+	}
+}
+
+/*
+ * An input is only recorded once it has been handled, when its length is
+ * known, but a replay has to see it before the frames it sent. Between
+ * record_hold and record_release frames are held back, to be written after
+ * the input.
+ */
+void
+record_hold(struct recorder *r) {
+	r->holding = 1;
+}
+
+void
+record_release(struct recorder *r) {
+	int i;
+	r->holding = 0;
+	for(i = 0; r->nheld > i; i++) {
+		record_frame(r, r->held[i].type, &r->held[i].t, r->held[i].frame, r->held[i].channels);
+	}
+	r->nheld = 0;
+}
+
+static int
+get_varint(struct record_log *log, unsigned long long *v) {
+	int shift = 0;
+	*v = 0;
+	while(log->size > log->pos && 64 > shift) {
+		unsigned char b = log->map[log->pos++];
+		*v |= (unsigned long long)(b & 0x7f) << shift;
+		if(!(b & 0x80)) {
+			return 1;
+		}
+		shift += 7;
+	}
+	return 0;
+}
+
+static int
+get_bytes(struct record_log *log, int n, const unsigned char **data) {
+	if(n < 0 || (size_t)n > log->size - log->pos) {
+		return 0;
+	}
+	*data = log->map + log->pos;
+	log->pos += n;
+	return 1;
+}
+
+/*
+ * Apply the runs written by put_delta to buf, which holds the previous
+ * contents. Returns the length, or -1 if the record is damaged.
+ */
+static int
+get_delta(struct record_log *log, unsigned char *buf, int max) {
+	unsigned long long n, skip, run;
+	const unsigned char *data;
+	size_t i = 0;
+	if(!get_varint(log, &n) || n > (unsigned long long)max) {
+		return -1;
+	}
+	while(1) {
+		if(!get_varint(log, &skip) || !get_varint(log, &run)) {
+			return -1;
+		}
+		if(run == 0) {
+			return n;
+		}
+		if(skip > n - i || run > n - i - skip || !get_bytes(log, run, &data)) {
+			return -1;
+		}
+		memcpy(buf + i + skip, data, run);
+		i += skip + run;
+	}
+}
+
+int
+record_log_open(struct record_log *log, const char *filename) {
+	struct stat st;
+	unsigned long long sec, nsec;
+	int fd;
+	memset(log, 0, sizeof(*log));
+	fd = open(filename, O_RDONLY);
+	if(fd == -1) {
+		warn("open(%s)", filename);
+		return 0;
+	}
+	if(fstat(fd, &st) != 0 || st.st_size < (off_t)strlen(RECORD_MAGIC)) {
+		fprintf(stderr, "%s: Not a show log\n", filename);
+		close(fd);
+		return 0;
+	}
+	log->map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if(log->map == MAP_FAILED) {
+		warn("mmap(%s)", filename);
+		return 0;
+	}
+	log->size = st.st_size;
+	log->pos = strlen(RECORD_MAGIC);
+	if(memcmp(log->map, RECORD_MAGIC, log->pos) != 0 || !get_varint(log, &sec) || !get_varint(log, &nsec) || nsec >= 1000000000ULL) {
+		fprintf(stderr, "%s: Not a show log\n", filename);
+		record_log_close(log);
+		return 0;
+	}
+	log->start.tv_sec = sec;
+	log->start.tv_nsec = nsec;
+	log->time = log->start;
+	return 1;
+}
+
+void
+record_log_close(struct record_log *log) {
+	if(log->map != NULL) {
+		munmap((void *)log->map, log->size);
+		log->map = NULL;
+	}
+	free(log->arena);
+	log->arena = NULL;
+}
+
+/*
+ * Read the next record. Returns its type, RECORD_END at the end of the log
+ * or -1 if the log is damaged.
+ */
+int
+record_log_next(struct record_log *log, struct record *rec) {
+	unsigned long long ns, v;
+	const unsigned char *data;
+	if(log->pos >= log->size || log->map[log->pos] == RECORD_END) {
+		return RECORD_END;
+	}
+	memset(rec, 0, sizeof(*rec));
+	rec->type = log->map[log->pos++];
+	if(!get_varint(log, &ns)) {
+		return -1;
+	}
+	log->time.tv_sec += ns / 1000000000ULL;
+	log->time.tv_nsec += ns % 1000000000ULL;
+	if(log->time.tv_nsec >= 1000000000L) {
+		log->time.tv_sec++;
+		log->time.tv_nsec -= 1000000000L;
+	}
+	rec->time = log->time;
+	rec->position = -1;
+
+	switch(rec->type) {
+		case RECORD_PRESETS:
+			// peek at the length to size the arena
+			data = log->map + log->pos;
+			if(!get_varint(log, &v) || v > 1 << 24) {
+				return -1;
+			}
+			log->pos = data - log->map;
+			free(log->arena);
+			log->arena = calloc(1, v);
+			if(log->arena == NULL) {
+				err(1, "calloc");
+			}
+			if((rec->len = get_delta(log, log->arena, v)) < 0) {
+				return -1;
+			}
+			rec->data = log->arena;
+			break;
+		case RECORD_COMMAND:
+			if(!get_varint(log, &v) || v == 0 || v > 1 << 16 || !get_bytes(log, v, &rec->data)) {
+				return -1;
+			}
+			rec->len = v;
+			break;
+		case RECORD_INPUT:
+			if(!get_varint(log, &v) || v >= INPUT_CHANNELS || !get_bytes(log, 1, &data)) {
+				return -1;
+			}
+			rec->input = v;
+			rec->value = data[0];
+			break;
+		case RECORD_MIDI_CLOCK:
+			if(!get_bytes(log, 1, &data) || !get_varint(log, &v)) {
+				return -1;
+			}
+			rec->value = data[0];
+			rec->position = (int)v - 1;
+			break;
+		case RECORD_MTC_QUARTER:
+			if(!get_bytes(log, 1, &data)) {
+				return -1;
+			}
+			rec->value = data[0];
+			break;
+		case RECORD_MTC_FULL:
+			if(!get_bytes(log, 4, &rec->data)) {
+				return -1;
+			}
+			rec->len = 4;
+			break;
+		case RECORD_FRAME:
+		case RECORD_FLUSH:
+			if((rec->len = get_delta(log, log->frame, DMX_CHANNELS)) < 0) {
+				return -1;
+			}
+			rec->data = log->frame;
+			break;
+		default:
+			return -1;
+	}
+	return rec->type;
+}
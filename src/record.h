@@ -0,0 +1,87 @@
+#ifndef RECORD_H
+#define RECORD_H
+
+#include <stddef.h>
+#include <time.h>
+
+#define RECORD_MAGIC	"DMXREC1\n"
+#define RECORD_HELD	4	// frames sent while an input is handled
+
+/*
+ * Show log: every input the engine takes and every frame it sends, in the
+ * order they happened. The log is a memory mapped file that is only ever
+ * appended to, so whatever was written survives a crash of the daemon; the
+ * unused tail of the file reads as zeroes, which ends the log.
+ *
+ * After the magic comes the engine start time, then records of a type byte,
+ * the nanoseconds since the previous record and a payload. Numbers are
+ * varints: 7 bits per byte, least significant first, high bit set on all
+ * but the last byte. Frames are stored as the runs of channels that differ
+ * from the previous frame.
+ */
+enum record_type {
+	RECORD_END = 0,
+	RECORD_PRESETS = 'P',		// preset arena at the start of the recording
+	RECORD_COMMAND = 'C',		// network or config command
+	RECORD_INPUT = 'I',		// fader or DMX input change
+	RECORD_MIDI_CLOCK = 'M',	// MIDI realtime message or song position
+	RECORD_MTC_QUARTER = 'Q',	// MIDI Timecode quarter frame
+	RECORD_MTC_FULL = 'T',		// MIDI Timecode full frame
+	RECORD_FRAME = 'F',		// frame rendered by the program runner
+	RECORD_FLUSH = 'O',		// frame sent after input changes
+};
+
+struct recorder {
+	int fd;
+	unsigned char *map;
+	size_t size;		// mapped and allocated in the file
+	size_t len;		// written
+	struct timespec last;
+	unsigned char frame[DMX_CHANNELS];
+	// frames an input causes are written after the input, see record_hold
+	int holding, nheld;
+	struct {
+		int type;
+		struct timespec t;
+		int channels;
+		unsigned char frame[DMX_CHANNELS];
+	} held[RECORD_HELD];
+};
+
+int recorder_open(struct recorder *r, const char *filename, const struct timespec *start);
+void recorder_close(struct recorder *r);
+void record_presets(struct recorder *r, const struct timespec *t, const unsigned char *arena, int len);
+void record_command(struct recorder *r, const struct timespec *t, const char *buf, int len);
+void record_input(struct recorder *r, const struct timespec *t, int input, int value);
+void record_midi_clock(struct recorder *r, const struct timespec *t, int status, int position);
+void record_mtc_quarter_frame(struct recorder *r, const struct timespec *t, int data);
+void record_mtc_full_frame(struct recorder *r, const struct timespec *t, const unsigned char *hmsf);
+void record_frame(struct recorder *r, int type, const struct timespec *t, const unsigned char *frame, int channels);
+void record_hold(struct recorder *r);
+void record_release(struct recorder *r);
+
+struct record {
+	int type;
+	struct timespec time;
+	const unsigned char *data;	// command, MTC full frame, preset arena or frame
+	int len;
+	int input;			// input index
+	int value;			// input value, MIDI status or quarter frame
+	int position;			// song position, -1 if none
+};
+
+struct record_log {
+	const unsigned char *map;
+	size_t size;
+	size_t pos;
+	struct timespec start;
+	struct timespec time;
+	unsigned char frame[DMX_CHANNELS];
+	unsigned char *arena;
+};
+
+int record_log_open(struct record_log *log, const char *filename);
+int record_log_next(struct record_log *log, struct record *rec);
+void record_log_close(struct record_log *log);
+
+#endif
@@ -0,0 +1,708 @@
+#define _POSIX_C_SOURCE 200112L
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <assert.h>
+#include <ctype.h>
+#include <err.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sysexits.h>
+#include <time.h>
+#include <unistd.h>
+#include "schaeckeling.h"
+#include "net.h"
+#include "preset.h"
+#include "dmxd.h"
+#include "record.h"
+#include "tempo.h"
+#include "clock.h"
+
+/*
+ * Offline renderer: runs the engine on a simulated clock, without any
+ * hardware, and writes every frame to a file as fast as possible.
+ *
+ * The timeline is a text file with one event per line:
+ *
+ *	# seconds  event
+ *	0.5        midi 3 127
+ *	1.0        dmx 12 255
+ *	2.0        cmd "B" 120
+ *	2.5        expect step 3
+ *
+ * midi and dmx events change an input, cmd events are network commands,
+ * given as quoted strings and byte values. expect lines check the engine:
+ * the step on stage (step), the time it came on stage (steptime), an
+ * output channel (channel) or the tempo (bpm). A failed expectation makes
+ * the exit status 1.
+ *
+ * Frames are rendered at a fixed rate, or with -s just when the program
+ * runner would render them: the scheduler runs on simulated time that
+ * jumps from one wakeup or event to the next, so step times are exact.
+ *
+ * With -r, a show log recorded by the daemon is replayed instead: all
+ * recorded inputs go through the engine again at their recorded times, and
+ * every frame the engine sends is checked against the recorded frame. -R
+ * writes such a log of a render, so a recording can be checked end to end.
+ */
+
+#define MAX_COMMAND	1024
+#define REPLAY_QUEUE	8	// frames sent or recorded, not matched yet
+#define REPLAY_REPORT	10	// mismatches reported in detail
+
+extern char *optarg;
+extern int optind;
+
+extern int programma_position;
+extern int program_woken;
+extern struct tempo tempo;
+extern struct preset *presets;
+extern unsigned char dmxout_sendbuf[DMX_CHANNELS];
+extern int dmxout_channels;
+extern pthread_mutex_t stepmtx;
+
+// the hardware side of the engine, normally in input.c
+volatile int mk2c_lost = 0;
+volatile int receiving_changes = 0;
+
+struct replay_frame {
+	struct timespec time;
+	int channels;
+	unsigned char frame[DMX_CHANNELS];
+};
+
+/*
+ * Frames that are recorded but not sent yet, or sent but not read from the
+ * log yet: the log has a frame sent while handling an input after the input.
+ */
+struct replay_queue {
+	struct replay_frame frames[REPLAY_QUEUE];
+	int first, n;
+	const char *unmatched;
+};
+
+static int replaying = 0;
+static struct replay_queue expected = { .unmatched = "recorded frame was never sent" };
+static struct replay_queue unrecorded = { .unmatched = "frame sent that was not recorded" };
+static long frames_compared = 0, mismatches = 0;
+static struct timespec replay_start;
+
+static void
+mismatch(const struct timespec *t, const char *fmt, ...) {
+	va_list ap;
+	if(REPLAY_REPORT > mismatches) {
+		fprintf(stderr, "%.3fs: ", (t->tv_sec - replay_start.tv_sec) + (t->tv_nsec - replay_start.tv_nsec) / 1e9);
+		va_start(ap, fmt);
+		vfprintf(stderr, fmt, ap);
+		va_end(ap);
+		fputc('\n', stderr);
+	} else if(mismatches == REPLAY_REPORT) {
+		fprintf(stderr, "More mismatches follow, not reported\n");
+	}
+	mismatches++;
+}
+
+static struct replay_frame *
+replay_pop(struct replay_queue *q) {
+	struct replay_frame *f = &q->frames[q->first];
+	q->first = (q->first + 1) % REPLAY_QUEUE;
+	q->n--;
+	return f;
+}
+
+static void
+replay_push(struct replay_queue *q, const struct timespec *t, const unsigned char *frame, int channels) {
+	struct replay_frame *f;
+	if(q->n == REPLAY_QUEUE) {
+		f = replay_pop(q);
+		mismatch(&f->time, "%s", q->unmatched);
+	}
+	f = &q->frames[(q->first + q->n) % REPLAY_QUEUE];
+	f->time = *t;
+	f->channels = channels;
+	memcpy(f->frame, frame, channels);
+	q->n++;
+}
+
+static void
+compare_frame(const struct timespec *t, const unsigned char *recorded, int recorded_channels, const unsigned char *sent, int channels) {
+	int i;
+	frames_compared++;
+	if(recorded_channels != channels) {
+		mismatch(t, "frame of %d channels, recorded %d", channels, recorded_channels);
+		return;
+	}
+	for(i = 0; channels > i; i++) {
+		if(sent[i] != recorded[i]) {
+			mismatch(t, "channel %d is %d, recorded %d", i + 1, sent[i], recorded[i]);
+			break;
+		}
+	}
+}
+
+static void
+expect_frame(const struct record *rec) {
+	struct replay_frame *f;
+	if(unrecorded.n > 0) {
+		f = replay_pop(&unrecorded);
+		compare_frame(&rec->time, rec->data, rec->len, f->frame, f->channels);
+	} else {
+		replay_push(&expected, &rec->time, rec->data, rec->len);
+	}
+}
+
+int
+send_dmx(unsigned char *dmxbytes, int channels) {
+	struct replay_frame *f;
+	struct timespec now;
+	if(!replaying) {
+		return 0;
+	}
+	if(expected.n > 0) {
+		f = replay_pop(&expected);
+		compare_frame(&f->time, f->frame, f->channels, dmxbytes, channels);
+	} else {
+		clock_now(&now);
+		replay_push(&unrecorded, &now, dmxbytes, channels);
+	}
+	return 0;
+}
+
+void
+reconnect_if_needed(void) {
+}
+
+int
+init_communications(void) {
+	return 0;
+}
+
+void
+set_feedback_running(int running) {
+}
+
+void
+set_feedback_blackout(int blackout) {
+}
+
+void
+set_feedback_step() {
+}
+
+enum event_type { EVENT_MIDI, EVENT_DMX, EVENT_COMMAND, EVENT_EXPECT };
+enum expect_what { EXPECT_STEP, EXPECT_STEPTIME, EXPECT_CHANNEL, EXPECT_BPM };
+
+struct event {
+	double time;
+	enum event_type type;
+	int channel;
+	int value;
+	enum expect_what what;
+	double number;
+	int len;
+	char command[MAX_COMMAND];
+};
+
+static FILE *timeline = NULL;
+static int timeline_line = 0;
+
+static struct timespec start = { 1000000000, 0 };
+static int verbose = 0;
+static int last_step = -1;
+static double step_since = 0;		// show time the step came on stage
+static double step_tolerance = 1e-6;	// how far off a steptime may be
+static long steps = 0, expectations = 0, failures = 0;
+
+static double
+show_time(const struct timespec *t) {
+	return (t->tv_sec - start.tv_sec) + (t->tv_nsec - start.tv_nsec) / 1e9;
+}
+
+static void
+add_seconds(struct timespec *ts, const struct timespec *base, double seconds) {
+	*ts = *base;
+	ts->tv_sec += (time_t)seconds;
+	ts->tv_nsec += (long)((seconds - (time_t)seconds) * 1e9);
+	ts->tv_sec += ts->tv_nsec / 1000000000L;
+	ts->tv_nsec %= 1000000000L;
+}
+
+/*
+ * Run the program runner once, at now, and note when the step changes.
+ */
+static void
+program_frame(const struct timespec *now, struct timespec *wakeup) {
+	pthread_mutex_lock(&stepmtx);
+	run_program(now, wakeup);
+	if(programma_position != last_step) {
+		last_step = programma_position;
+		step_since = show_time(now);
+		steps++;
+		if(verbose) {
+			printf("%.6f step %d\n", step_since, last_step);
+		}
+	}
+	pthread_mutex_unlock(&stepmtx);
+}
+
+/*
+ * Read the next event from the timeline. Returns 0 at the end.
+ */
+static int
+read_event(struct event *ev) {
+	char line[4096], kind[16], *p;
+	int n;
+	while(timeline != NULL && fgets(line, sizeof(line), timeline) != NULL) {
+		timeline_line++;
+		p = line;
+		while(isspace((unsigned char)*p)) {
+			p++;
+		}
+		if(*p == '\0' || *p == '#') {
+			continue;
+		}
+		if(sscanf(p, "%lf %15s %n", &ev->time, kind, &n) != 2) {
+			errx(1, "timeline line %d: expected time and event", timeline_line);
+		}
+		p += n;
+		if(strcmp(kind, "midi") == 0 || strcmp(kind, "dmx") == 0) {
+			ev->type = kind[0] == 'm' ? EVENT_MIDI : EVENT_DMX;
+			if(sscanf(p, "%d %d", &ev->channel, &ev->value) != 2
+			|| (ev->type == EVENT_MIDI && (ev->channel < 0 || ev->channel >= MIDI_CHANNELS || ev->value < 0 || ev->value > 127))
+			|| (ev->type == EVENT_DMX && (ev->channel < 1 || ev->channel > DMX_CHANNELS || ev->value < 0 || ev->value > 255))) {
+				errx(1, "timeline line %d: invalid %s event", timeline_line, kind);
+			}
+		} else if(strcmp(kind, "cmd") == 0) {
+			ev->type = EVENT_COMMAND;
+			ev->len = 0;
+			while(*p != '\0' && *p != '\n') {
+				if(isspace((unsigned char)*p)) {
+					p++;
+				} else if(*p == '"') {
+					for(p++; *p != '"'; p++) {
+						if(*p == '\0' || ev->len == MAX_COMMAND) {
+							errx(1, "timeline line %d: invalid string", timeline_line);
+						}
+						ev->command[ev->len++] = *p;
+					}
+					p++;
+				} else {
+					long v = strtol(p, &p, 0);
+					if(v < 0 || v > 255 || ev->len == MAX_COMMAND || !(isspace((unsigned char)*p) || *p == '\0')) {
+						errx(1, "timeline line %d: invalid byte", timeline_line);
+					}
+					ev->command[ev->len++] = v;
+				}
+			}
+		} else if(strcmp(kind, "expect") == 0) {
+			char what[16];
+			ev->type = EVENT_EXPECT;
+			if(sscanf(p, "%15s %n", what, &n) != 1) {
+				errx(1, "timeline line %d: expect what?", timeline_line);
+			}
+			p += n;
+			if(strcmp(what, "channel") == 0) {
+				ev->what = EXPECT_CHANNEL;
+				if(sscanf(p, "%d %d", &ev->channel, &ev->value) != 2 || ev->channel < 1 || ev->channel > DMX_CHANNELS) {
+					errx(1, "timeline line %d: invalid channel expectation", timeline_line);
+				}
+			} else if(strcmp(what, "step") == 0 || strcmp(what, "steptime") == 0 || strcmp(what, "bpm") == 0) {
+				ev->what = (what[0] == 'b') ? EXPECT_BPM : (what[4] == '\0') ? EXPECT_STEP : EXPECT_STEPTIME;
+				if(sscanf(p, "%lf", &ev->number) != 1) {
+					errx(1, "timeline line %d: invalid %s expectation", timeline_line, what);
+				}
+			} else {
+				errx(1, "timeline line %d: cannot expect %s", timeline_line, what);
+			}
+		} else {
+			errx(1, "timeline line %d: unknown event %s", timeline_line, kind);
+		}
+		return 1;
+	}
+	return 0;
+}
+
+static void
+failed(const struct event *ev, const char *fmt, ...) {
+	va_list ap;
+	fprintf(stderr, "%.6f: ", ev->time);
+	va_start(ap, fmt);
+	vfprintf(stderr, fmt, ap);
+	va_end(ap);
+	fputc('\n', stderr);
+	failures++;
+}
+
+static void
+check_expectation(const struct event *ev) {
+	int value;
+	expectations++;
+	pthread_mutex_lock(&stepmtx);
+	switch(ev->what) {
+		case EXPECT_STEP:
+			if(programma_position != ev->number) {
+				failed(ev, "expected step %g, on stage is step %d", ev->number, programma_position);
+			}
+			break;
+		case EXPECT_STEPTIME:
+			if(programma_position != ev->number) {
+				failed(ev, "expected step %g to be on stage, it is step %d", ev->number, programma_position);
+			} else if(fabs(step_since - ev->time) > step_tolerance) {
+				failed(ev, "step %d came on stage at %.6f", programma_position, step_since);
+			}
+			break;
+		case EXPECT_CHANNEL:
+			value = dmxout_sendbuf[ev->channel - 1];
+			if(value != ev->value) {
+				failed(ev, "expected channel %d at %d, it is %d", ev->channel, ev->value, value);
+			}
+			break;
+		case EXPECT_BPM:
+			if(fabs(tempo.bpm - ev->number) > 0.01) {
+				failed(ev, "expected %g BPM, it is %.2f", ev->number, tempo.bpm);
+			}
+			break;
+	}
+	pthread_mutex_unlock(&stepmtx);
+}
+
+static void
+apply_event(const struct event *ev) {
+	int offset = 0, processed;
+	switch(ev->type) {
+		case EVENT_MIDI:
+			update_input(midi_to_input_index(ev->channel), ev->value * 2);
+			break;
+		case EVENT_DMX:
+			update_input(dmx_to_input_index(ev->channel), ev->value);
+			break;
+		case EVENT_COMMAND:
+			do {
+				processed = handle_data(NULL, (char *)ev->command + offset, ev->len - offset);
+				if(processed <= 0) {
+					errx(1, "timeline: invalid or incomplete command at %.3fs", ev->time);
+				}
+				offset += processed;
+			} while(ev->len > offset);
+			break;
+		case EVENT_EXPECT:
+			check_expectation(ev);
+			break;
+	}
+}
+
+/*
+ * Feed a show log through the engine. Returns the exit status.
+ */
+static int
+replay(const char *filename) {
+	static char command[1 << 16];
+	struct record_log log;
+	struct record rec;
+	struct timespec now, wakeup, wall_start, wall_end;
+	long inputs = 0;
+	int type;
+	double elapsed, duration;
+
+	if(!record_log_open(&log, filename)) {
+		return 1;
+	}
+	now = replay_start = log.start;
+	clock_simulate(&now);
+	replaying = 1;
+	init_engine();
+	presets = open_preset_arena("presets.dat", 0);
+
+	clock_gettime(CLOCK_MONOTONIC, &wall_start);
+	while((type = record_log_next(&log, &rec)) > 0) {
+		now = rec.time;
+		clock_set(&now);
+		switch(type) {
+			case RECORD_PRESETS:
+				if(rec.len != PRESET_SLOTS * sizeof(struct preset)) {
+					mismatch(&now, "preset arena of %d bytes, expected %d", rec.len, (int)(PRESET_SLOTS * sizeof(struct preset)));
+					break;
+				}
+				memcpy(presets, rec.data, rec.len);
+				break;
+			case RECORD_COMMAND:
+				memcpy(command, rec.data, rec.len);
+				if(handle_data(NULL, command, rec.len) != rec.len) {
+					mismatch(&now, "command '%c' of %d bytes not accepted", command[0], rec.len);
+				}
+				inputs++;
+				break;
+			case RECORD_INPUT:
+				update_input(rec.input, rec.value);
+				inputs++;
+				break;
+			case RECORD_MIDI_CLOCK:
+				update_midi_clock(rec.value, rec.position);
+				inputs++;
+				break;
+			case RECORD_MTC_QUARTER:
+				update_mtc_quarter_frame(rec.value);
+				inputs++;
+				break;
+			case RECORD_MTC_FULL:
+				update_mtc_full_frame(rec.data);
+				inputs++;
+				break;
+			case RECORD_FRAME:
+				expect_frame(&rec);
+				pthread_mutex_lock(&stepmtx);
+				run_program(&now, &wakeup);
+				pthread_mutex_unlock(&stepmtx);
+				break;
+			case RECORD_FLUSH:
+				expect_frame(&rec);
+				flush_dmxout_sendbuf();
+				break;
+		}
+	}
+	clock_gettime(CLOCK_MONOTONIC, &wall_end);
+	if(type < 0) {
+		fprintf(stderr, "%s: Damaged record at offset %lu, replay stopped\n", filename, (unsigned long)log.pos);
+		mismatches++;
+	}
+	while(expected.n > 0) {
+		mismatch(&replay_pop(&expected)->time, "%s", expected.unmatched);
+	}
+	while(unrecorded.n > 0) {
+		mismatch(&replay_pop(&unrecorded)->time, "%s", unrecorded.unmatched);
+	}
+	record_log_close(&log);
+
+	elapsed = (wall_end.tv_sec - wall_start.tv_sec) + (wall_end.tv_nsec - wall_start.tv_nsec) / 1e9;
+	duration = (now.tv_sec - replay_start.tv_sec) + (now.tv_nsec - replay_start.tv_nsec) / 1e9;
+	fprintf(stderr, "Replayed %ld inputs and %ld frames (%.1fs of show) in %.3fs: %ld mismatches\n",
+		inputs, frames_compared, duration, elapsed, mismatches);
+	return mismatches > 0;
+}
+
+static int
+before(const struct timespec *a, const struct timespec *b) {
+	return a->tv_sec < b->tv_sec || (a->tv_sec == b->tv_sec && a->tv_nsec < b->tv_nsec);
+}
+
+/*
+ * Run the program runner like prog_runner does, on simulated time: the
+ * clock jumps to its next wakeup, or to the next timeline event if that
+ * comes first. An event that wakes the runner has it render right away.
+ * Returns the number of frames rendered.
+ */
+static long
+simulate(double duration, struct event *ev) {
+	struct timespec now = start, wakeup = start, end, at;
+	long frames = 0;
+	int have_event = read_event(ev);
+
+	add_seconds(&end, &start, duration);
+	while(1) {
+		if(have_event) {
+			add_seconds(&at, &start, ev->time);
+		}
+		if(have_event && before(&at, &wakeup) && before(&at, &end)) {
+			clock_set(&at);
+			apply_event(ev);
+			have_event = read_event(ev);
+			if(program_woken) {
+				wakeup = at;
+			}
+			continue;
+		}
+		if(!before(&wakeup, &end)) {
+			break;
+		}
+		now = wakeup;
+		clock_set(&now);
+		program_frame(&now, &wakeup);
+		frames++;
+		if(!before(&now, &wakeup)) {
+			// due again right away: the real clock would have moved on a little
+			add_seconds(&wakeup, &now, 1e-6);
+		}
+	}
+	while(have_event && duration >= ev->time) {
+		add_seconds(&at, &start, ev->time);
+		clock_set(&at);
+		apply_event(ev);
+		have_event = read_event(ev);
+	}
+	return frames;
+}
+
+int
+main(int argc, char **argv) {
+	char *config = "config.dat", *program = NULL, *output = NULL, *ppm = NULL, *log = NULL, *record = NULL;
+	double duration = 10, fps = 40, elapsed;
+	int opt, channels = 0, stride = 0, simulated = 0, have_event, frame, nframes, x, c;
+	struct timespec now, wakeup, wall_start, wall_end;
+	static struct event ev;
+	FILE *out = NULL, *strip = NULL;
+
+	while((opt = getopt(argc, argv, "c:p:t:d:f:n:o:P:l:r:R:sv")) != -1) {
+		switch(opt) {
+			case 'c':
+				config = optarg;
+				break;
+			case 'p':
+				program = optarg;
+				break;
+			case 't':
+				timeline = fopen(optarg, "r");
+				if(timeline == NULL) {
+					err(1, "%s", optarg);
+				}
+				break;
+			case 'd':
+				duration = atof(optarg);
+				break;
+			case 'f':
+				fps = atof(optarg);
+				break;
+			case 'n':
+				channels = atoi(optarg);
+				break;
+			case 'o':
+				output = optarg;
+				break;
+			case 'P':
+				ppm = optarg;
+				break;
+			case 'l':
+				stride = atoi(optarg);
+				break;
+			case 'r':
+				log = optarg;
+				break;
+			case 'R':
+				record = optarg;
+				break;
+			case 's':
+				simulated = 1;
+				break;
+			case 'v':
+				verbose = 1;
+				break;
+			default:
+				goto usage;
+		}
+	}
+	if(optind != argc || duration <= 0 || fps <= 0 || channels < 0 || channels > DMX_CHANNELS || stride < 0 || (simulated && (output != NULL || ppm != NULL))) {
+		goto usage;
+	}
+	if(log != NULL) {
+		return replay(log);
+	}
+
+	// the engine runs on render time from here on
+	now = start;
+	clock_simulate(&now);
+	init_engine();
+	presets = open_preset_arena("presets.dat", 0);
+	// like the daemon, from before the configuration
+	if(record != NULL && !start_recording(record)) {
+		return 1;
+	}
+	if(!read_config_file(config)) {
+		errx(1, "could not read %s", config);
+	}
+	if(program != NULL && !read_config_file(program)) {
+		errx(1, "could not read %s", program);
+	}
+	if(channels == 0) {
+		channels = dmxout_channels > 0 ? dmxout_channels : DMX_CHANNELS;
+	}
+	if(stride > channels) {
+		stride = channels;
+	}
+
+	if(simulated) {
+		clock_gettime(CLOCK_MONOTONIC, &wall_start);
+		nframes = simulate(duration, &ev);
+		clock_gettime(CLOCK_MONOTONIC, &wall_end);
+		elapsed = (wall_end.tv_sec - wall_start.tv_sec) + (wall_end.tv_nsec - wall_start.tv_nsec) / 1e9;
+		fprintf(stderr, "Simulated %.1fs of show in %.3fs: %d frames, %ld steps\n", duration, elapsed, nframes, steps);
+		goto report;
+	}
+
+	nframes = duration * fps;
+	step_tolerance = 1 / fps;
+	if(output != NULL && (out = fopen(output, "wb")) == NULL) {
+		err(1, "%s", output);
+	}
+	if(ppm != NULL) {
+		if((strip = fopen(ppm, "wb")) == NULL) {
+			err(1, "%s", ppm);
+		}
+		fprintf(strip, "P6\n%d %d\n255\n", stride ? (channels + stride - 1) / stride : channels, nframes);
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &wall_start);
+	have_event = read_event(&ev);
+	for(frame = 0; nframes > frame; frame++) {
+		double t = frame / fps;
+		// like with -s, what happens at the time of a frame comes after it
+		while(have_event && t > ev.time) {
+			add_seconds(&now, &start, ev.time);
+			clock_set(&now);
+			apply_event(&ev);
+			have_event = read_event(&ev);
+		}
+		add_seconds(&now, &start, t);
+		clock_set(&now);
+		program_frame(&now, &wakeup);
+
+		if(out != NULL && fwrite(dmxout_sendbuf, 1, channels, out) != (size_t)channels) {
+			err(1, "%s", output);
+		}
+		if(strip != NULL) {
+			// one gray pixel per channel, or one RGB pixel per lamp of stride channels
+			for(x = 0; channels > x; x += stride ? stride : 1) {
+				if(stride >= 3) {
+					// a last lamp cut short by the channel count is padded with black
+					for(c = 0; 3 > c; c++) {
+						putc((channels > x + c) ? dmxout_sendbuf[x + c] : 0, strip);
+					}
+				} else {
+					putc(dmxout_sendbuf[x], strip);
+					putc(dmxout_sendbuf[x], strip);
+					putc(dmxout_sendbuf[x], strip);
+				}
+			}
+		}
+	}
+	while(have_event && duration >= ev.time) {
+		add_seconds(&now, &start, ev.time);
+		clock_set(&now);
+		apply_event(&ev);
+		have_event = read_event(&ev);
+	}
+	clock_gettime(CLOCK_MONOTONIC, &wall_end);
+
+	if(out != NULL && fclose(out) != 0) {
+		err(1, "%s", output);
+	}
+	if(strip != NULL && fclose(strip) != 0) {
+		err(1, "%s", ppm);
+	}
+	elapsed = (wall_end.tv_sec - wall_start.tv_sec) + (wall_end.tv_nsec - wall_start.tv_nsec) / 1e9;
+	fprintf(stderr, "Rendered %d frames of %d channels (%.1fs of show) in %.3fs, %.0f frames/s\n",
+		nframes, channels, duration, elapsed, elapsed > 0 ? nframes / elapsed : 0);
+
+report:
+	if(expectations > 0) {
+		fprintf(stderr, "%ld of %ld expectations met\n", expectations - failures, expectations);
+	}
+	return failures > 0;
+
+usage:
+	fprintf(stderr, "Usage: %s [-c config.dat] [-p programma.dat] [-t timeline] [-d seconds] [-R show.log] [-v]\n", argv[0]);
+	fprintf(stderr, "       [-s | [-f fps] [-n channels] [-o frames.bin] [-P strip.ppm [-l lamp channels]]]\n");
+	fprintf(stderr, "       %s -r show.log\n", argv[0]);
+	return EX_USAGE;
+}
@@ -0,0 +1,258 @@
+#define _DEFAULT_SOURCE
+#include <assert.h>
+#include <err.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "schaeckeling.h"
+#include "netout.h"
+#include "sacn.h"
+
+#define VECTOR_ROOT_E131_DATA		0x00000004
+#define VECTOR_ROOT_E131_EXTENDED	0x00000008
+#define VECTOR_E131_DATA_PACKET		0x00000002
+#define VECTOR_E131_EXTENDED_DISCOVERY	0x00000002
+#define VECTOR_UNIVERSE_DISCOVERY_LIST	0x00000001
+#define VECTOR_DMP_SET_PROPERTY		0x02
+
+#define SACN_SOURCE_NAME	64
+#define SACN_DISCOVERY_HEADER	120	// up to the list of universes
+
+struct netout_packet *sacn_packets[NETOUT_PACKETS];
+int sacn_universes[NETOUT_PACKETS];
+int nsacn = 0;
+
+static void
+put16(unsigned char *p, int v) {
+	p[0] = v >> 8;
+	p[1] = v & 0xFF;
+}
+
+static void
+put32(unsigned char *p, unsigned int v) {
+	put16(p, v >> 16);
+	put16(p + 2, v & 0xFFFF);
+}
+
+// a PDU starts with its length, from there to the end of the packet
+static void
+put_length(unsigned char *data, int at, size_t len) {
+	put16(data + at, 0x7000 | (len - at));
+}
+
+/*
+ * The root layer of every E1.31 packet: preamble, ACN packet identifier,
+ * vector and the CID of this source.
+ */
+static void
+root_layer(unsigned char *p, unsigned int vector) {
+	put16(p, 0x0010);
+	put16(p + 2, 0);
+	memcpy(p + 4, "ASC-E1.17\0\0\0", 12);
+	put32(p + 18, vector);
+}
+
+/*
+ * Send the output as an sACN (E1.31) universe, spec is
+ * universe[/priority][@host[:port]]. Without a host it goes to the
+ * multicast group of the universe. Returns 0 for an invalid spec.
+ */
+int
+sacn_add_output(const char *spec) {
+	char *end, group[32];
+	const char *host;
+	long universe, priority = SACN_PRIORITY;
+	struct netout_packet *p;
+
+	universe = strtol(spec, &end, 0);
+	if(end != spec && *end == '/') {
+		const char *s = end + 1;
+		priority = strtol(s, &end, 0);
+		if(end == s) {
+			priority = -1;
+		}
+	}
+	if(end == spec || (*end != '\0' && *end != '@') || universe < 1 || universe > 63999 || priority < 0 || priority > 200) {
+		fprintf(stderr, "sacn: expected universe[/priority][@host], universe 1-63999, priority 0-200, not %s\n", spec);
+		return 0;
+	}
+	if(*end == '@') {
+		host = end + 1;
+	} else {
+		snprintf(group, sizeof(group), "239.255.%ld.%ld", universe >> 8, universe & 0xFF);
+		host = group;
+	}
+	p = netout_add(NETOUT_SACN_DATA, host, SACN_PORT);
+	if(p == NULL) {
+		return 0;
+	}
+
+	root_layer(p->data, VECTOR_ROOT_E131_DATA);
+	// framing layer, the source name is filled in by sacn_finish()
+	put32(p->data + 40, VECTOR_E131_DATA_PACKET);
+	p->data[108] = priority;
+	put16(p->data + 109, 0);	// no synchronization universe
+	p->data[112] = 0;		// options
+	put16(p->data + 113, universe);
+	// DMP layer
+	p->data[117] = VECTOR_DMP_SET_PROPERTY;
+	p->data[118] = 0xA1;		// address and data type
+	put16(p->data + 119, 0);	// first property address
+	put16(p->data + 121, 1);	// address increment
+	p->data[125] = 0;		// start code
+
+	sacn_packets[nsacn] = p;
+	sacn_universes[nsacn] = universe;
+	nsacn++;
+	return 1;
+}
+
+/*
+ * A CID identifies a source for as long as it runs; a random (version 4)
+ * UUID.
+ */
+static void
+make_cid(unsigned char *cid) {
+	int fd = open("/dev/urandom", O_RDONLY | O_CLOEXEC);
+	if(fd == -1 || read(fd, cid, 16) != 16) {
+		warn("sacn: /dev/urandom");
+		srandom(time(NULL) ^ getpid());
+		for(int i = 0; 16 > i; i++) {
+			cid[i] = random() & 0xFF;
+		}
+	}
+	if(fd != -1) {
+		close(fd);
+	}
+	cid[6] = (cid[6] & 0x0F) | 0x40;
+	cid[8] = (cid[8] & 0x3F) | 0x80;
+}
+
+static int
+compare_universes(const void *a, const void *b) {
+	return *(const int *)a - *(const int *)b;
+}
+
+/*
+ * Once all outputs are added: put the CID and source name in their packets
+ * and announce the sacn_universes with a discovery packet every 10 seconds.
+ */
+int
+sacn_finish(const char *source) {
+	unsigned char cid[16];
+	char name[SACN_SOURCE_NAME], hostname[SACN_SOURCE_NAME - 13], group[32];
+	int list[NETOUT_PACKETS], n = 0;
+	struct netout_packet *p;
+
+	if(nsacn == 0) {
+		return 1;
+	}
+	make_cid(cid);
+	memset(name, 0, sizeof(name));
+	if(source != NULL) {
+		snprintf(name, sizeof(name), "%s", source);
+	} else {
+		if(gethostname(hostname, sizeof(hostname)) == -1) {
+			snprintf(hostname, sizeof(hostname), "localhost");
+		}
+		hostname[sizeof(hostname) - 1] = '\0';
+		snprintf(name, sizeof(name), "schaeckeling@%s", hostname);
+	}
+
+	for(int i = 0; nsacn > i; i++) {
+		memcpy(sacn_packets[i]->data + 22, cid, 16);
+		memcpy(sacn_packets[i]->data + 44, name, SACN_SOURCE_NAME);
+	}
+
+	// sorted, every universe once
+	memcpy(list, sacn_universes, nsacn * sizeof(int));
+	qsort(list, nsacn, sizeof(int), compare_universes);
+	for(int i = 0; nsacn > i; i++) {
+		if(n == 0 || list[n - 1] != list[i]) {
+			list[n++] = list[i];
+		}
+	}
+
+	snprintf(group, sizeof(group), "239.255.%d.%d", SACN_DISCOVERY_UNIVERSE >> 8, SACN_DISCOVERY_UNIVERSE & 0xFF);
+	p = netout_add(NETOUT_SACN_DISCOVERY, group, SACN_PORT);
+	if(p == NULL) {
+		return 0;
+	}
+	p->len = SACN_DISCOVERY_HEADER + 2 * n;
+	root_layer(p->data, VECTOR_ROOT_E131_EXTENDED);
+	memcpy(p->data + 22, cid, 16);
+	put_length(p->data, 16, p->len);
+	put_length(p->data, 38, p->len);
+	put32(p->data + 40, VECTOR_E131_EXTENDED_DISCOVERY);
+	memcpy(p->data + 44, name, SACN_SOURCE_NAME);
+	put32(p->data + 108, 0);	// reserved
+	put_length(p->data, 112, p->len);
+	put32(p->data + 114, VECTOR_UNIVERSE_DISCOVERY_LIST);
+	p->data[118] = 0;		// page
+	p->data[119] = 0;		// last page
+	for(int i = 0; n > i; i++) {
+		put16(p->data + SACN_DISCOVERY_HEADER + 2 * i, list[i]);
+	}
+	return 1;
+}
+
+void
+sacn_fill_data(struct netout_packet *p, const unsigned char *frame, int channels) {
+	p->len = SACN_HEADER + channels;
+	p->data[111] = p->sequence++;
+	put_length(p->data, 16, p->len);
+	put_length(p->data, 38, p->len);
+	put_length(p->data, 115, p->len);
+	put16(p->data + 123, 1 + channels);	// start code and slots
+	memcpy(p->data + SACN_HEADER, frame, channels);
+}
+
+int
+sacn_discovery_due(struct netout_packet *p, const struct timespec *now) {
+	if(now->tv_sec < p->due.tv_sec || (now->tv_sec == p->due.tv_sec && now->tv_nsec < p->due.tv_nsec)) {
+		return 0;
+	}
+	p->due = *now;
+	p->due.tv_sec += SACN_DISCOVERY_INTERVAL;
+	return 1;
+}
+
+static int
+get16(const unsigned char *p) {
+	return p[0] << 8 | p[1];
+}
+
+static unsigned int
+get32(const unsigned char *p) {
+	return (unsigned int)get16(p) << 16 | get16(p + 2);
+}
+
+/*
+ * Check a received packet for E1.31 DMX data, start code 0. Returns 0 for
+ * anything else.
+ */
+int
+sacn_parse_data(const unsigned char *p, size_t len, struct sacn_data *d) {
+	if(len < SACN_HEADER || get16(p) != 0x0010 || memcmp(p + 4, "ASC-E1.17\0\0\0", 12) != 0) {
+		return 0;
+	}
+	if(get32(p + 18) != VECTOR_ROOT_E131_DATA || get32(p + 40) != VECTOR_E131_DATA_PACKET) {
+		return 0;
+	}
+	if(p[117] != VECTOR_DMP_SET_PROPERTY || p[118] != 0xA1 || p[125] != 0) {
+		return 0;
+	}
+	d->channels = get16(p + 123) - 1;
+	if(d->channels < 0 || d->channels > DMX_CHANNELS || SACN_HEADER + d->channels > len) {
+		return 0;
+	}
+	d->cid = p + 22;
+	d->priority = p[108];
+	d->sequence = p[111];
+	d->options = p[112];
+	d->universe = get16(p + 113);
+	d->values = p + SACN_HEADER;
+	return 1;
+}
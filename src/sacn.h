@@ -0,0 +1,35 @@
+#ifndef SACN_H
+#define SACN_H
+
+#include <stddef.h>
+#include <time.h>
+
+#define SACN_PORT		5568
+#define SACN_HEADER		126	// of a data packet, up to the first slot
+#define SACN_PRIORITY		100	// the default
+#define SACN_DISCOVERY_UNIVERSE	64214
+#define SACN_DISCOVERY_INTERVAL	10	// seconds
+
+#define SACN_OPTION_PREVIEW	0x80
+#define SACN_OPTION_TERMINATED	0x40
+
+struct netout_packet;
+
+// a received data packet, pointing into it
+struct sacn_data {
+	const unsigned char *cid;
+	int universe;
+	int priority;
+	int sequence;
+	int options;
+	int channels;
+	const unsigned char *values;
+};
+
+int sacn_add_output(const char *spec);
+int sacn_finish(const char *source);
+void sacn_fill_data(struct netout_packet *p, const unsigned char *frame, int channels);
+int sacn_discovery_due(struct netout_packet *p, const struct timespec *now);
+int sacn_parse_data(const unsigned char *p, size_t len, struct sacn_data *d);
+
+#endif
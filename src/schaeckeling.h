@@ -1,6 +1,8 @@
 #define DMX_CHANNELS 512
 #define MIDI_CHANNELS 128
-#define INPUT_CHANNELS (DMX_CHANNELS+MIDI_CHANNELS)
+#define NETIN_UNIVERSES 4
+#define NETIN_CHANNELS (NETIN_UNIVERSES*DMX_CHANNELS)
+#define INPUT_CHANNELS (DMX_CHANNELS+MIDI_CHANNELS+NETIN_CHANNELS)
 
 typedef int inputidx_t;
 typedef int dmxchannel_t;
@@ -18,6 +20,14 @@ dmx_to_input_index(dmxchannel_t channel) {
 	return channel + MIDI_CHANNELS - 1;
 }
 
+// a channel of one of the universes received over the network
+static inline inputidx_t
+netin_to_input_index(int universe, dmxchannel_t channel) {
+	assert(universe >= 0 && universe < NETIN_UNIVERSES);
+	assert(channel > 0 && channel <= DMX_CHANNELS);
+	return MIDI_CHANNELS + DMX_CHANNELS + universe * DMX_CHANNELS + channel - 1;
+}
+
 static inline midichannel_t
 input_index_to_midi(inputidx_t input) {
 	assert(input >= 0 && input < MIDI_CHANNELS);
@@ -26,10 +36,22 @@ input_index_to_midi(inputidx_t input) {
 
 static inline dmxchannel_t
 input_index_to_dmx(inputidx_t input) {
-	assert(input >= MIDI_CHANNELS && input < INPUT_CHANNELS);
+	assert(input >= MIDI_CHANNELS && input < MIDI_CHANNELS + DMX_CHANNELS);
 	return input - MIDI_CHANNELS + 1;
 }
 
+static inline int
+input_index_to_netin_universe(inputidx_t input) {
+	assert(input >= MIDI_CHANNELS + DMX_CHANNELS && input < INPUT_CHANNELS);
+	return (input - MIDI_CHANNELS - DMX_CHANNELS) / DMX_CHANNELS;
+}
+
+static inline dmxchannel_t
+input_index_to_netin(inputidx_t input) {
+	assert(input >= MIDI_CHANNELS + DMX_CHANNELS && input < INPUT_CHANNELS);
+	return (input - MIDI_CHANNELS - DMX_CHANNELS) % DMX_CHANNELS + 1;
+}
+
 static int inline
 input_index_is_midi(inputidx_t iidx) {
 	assert(iidx >= 0 && iidx < INPUT_CHANNELS);
@@ -39,5 +61,11 @@ input_index_is_midi(inputidx_t iidx) {
 static int inline
 input_index_is_dmx(inputidx_t iidx) {
 	assert(iidx >= 0 && iidx < INPUT_CHANNELS);
-	return (iidx >= MIDI_CHANNELS);
+	return (iidx >= MIDI_CHANNELS && iidx < MIDI_CHANNELS + DMX_CHANNELS);
+}
+
+static int inline
+input_index_is_netin(inputidx_t iidx) {
+	assert(iidx >= 0 && iidx < INPUT_CHANNELS);
+	return (iidx >= MIDI_CHANNELS + DMX_CHANNELS);
 }
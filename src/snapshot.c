@@ -0,0 +1,82 @@
+#define _POSIX_C_SOURCE 200112L
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <assert.h>
+#include <err.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include "schaeckeling.h"
+#include "snapshot.h"
+
+struct snapshot *snap = NULL;
+
+/*
+ * Create or take over the segment. Without it the daemon runs on, there are
+ * just no snapshots.
+ */
+void
+init_snapshot(void) {
+	struct snapshot *s;
+	uint32_t old;
+	int fd = shm_open(SNAPSHOT_NAME, O_RDWR | O_CREAT, 0644);
+	if(fd == -1) {
+		warn("snapshot: shm_open(%s)", SNAPSHOT_NAME);
+		return;
+	}
+	if(ftruncate(fd, sizeof(struct snapshot)) == -1) {
+		warn("snapshot: ftruncate");
+		close(fd);
+		return;
+	}
+	s = mmap(NULL, sizeof(struct snapshot), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if(s == MAP_FAILED) {
+		warn("snapshot: mmap");
+		return;
+	}
+	// readers of a previous run see a write, then the sequence go on; a
+	// crash in the middle of a write may have left it odd already
+	old = __atomic_load_n(&s->sequence, __ATOMIC_RELAXED) | 1;
+	__atomic_store_n(&s->sequence, old, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	s->magic = SNAPSHOT_MAGIC;
+	s->version = SNAPSHOT_VERSION;
+	s->frames = 0;
+	s->channels = 0;
+	memset(s->output, 0, sizeof(s->output));
+	__atomic_store_n(&s->sequence, old + 1, __ATOMIC_RELEASE);
+	snap = s;
+}
+
+/*
+ * Writers must not overlap; the caller holds dmxout_sendbuf_mtx.
+ */
+void
+snapshot_publish(const unsigned char *frame, int channels, const struct snapshot_meta *meta) {
+	uint32_t seq;
+	if(snap == NULL) {
+		return;
+	}
+	assert(channels >= 0 && channels <= SNAPSHOT_CHANNELS);
+	seq = snap->sequence;
+	__atomic_store_n(&snap->sequence, seq + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+
+	if(channels < (int)snap->channels) {
+		memset(snap->output + channels, 0, snap->channels - channels);
+	}
+	memcpy(snap->output, frame, channels);
+	snap->channels = channels;
+	snap->frames++;
+	snap->time_ns = (int64_t)meta->time.tv_sec * 1000000000 + meta->time.tv_nsec;
+	snap->step = meta->step;
+	snap->steps = meta->steps;
+	snap->bpm = meta->bpm;
+	snap->master = meta->master;
+	snap->blackout = meta->blackout;
+	snap->running = meta->running;
+
+	__atomic_store_n(&snap->sequence, seq + 2, __ATOMIC_RELEASE);
+}
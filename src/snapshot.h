@@ -0,0 +1,70 @@
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include <stdint.h>
+#include <time.h>
+
+#define SNAPSHOT_NAME		"/schaeckeling-output"	// for shm_open()
+#define SNAPSHOT_MAGIC		0x50414E53		// "SNAP"
+#define SNAPSHOT_VERSION	1
+#define SNAPSHOT_CHANNELS	512			// DMX_CHANNELS
+
+/*
+ * The last frame sent, for local readers such as visualizers, in a POSIX
+ * shared memory segment. The daemon rewrites it for every frame under a
+ * seqlock: sequence is odd while it writes. A reader never blocks the
+ * daemon; it reads what it needs between snapshot_read_begin() and
+ * snapshot_read_retry() and reads again if the latter says the frame
+ * changed in the meantime:
+ *
+ *	do {
+ *		seq = snapshot_read_begin(s);
+ *		memcpy(look, s->output, s->channels);
+ *	} while(snapshot_read_retry(s, seq));
+ */
+struct snapshot {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t sequence;
+	uint32_t channels;		// in use, the rest of output is zero
+	uint64_t frames;
+	int64_t time_ns;		// engine clock (CLOCK_MONOTONIC) of the frame
+	int32_t step;
+	int32_t steps;
+	double bpm;
+	uint8_t master;
+	uint8_t blackout;
+	uint8_t running;
+	uint8_t reserved[5];
+	uint8_t output[SNAPSHOT_CHANNELS];
+};
+
+struct snapshot_meta {
+	struct timespec time;
+	int step;
+	int steps;
+	double bpm;
+	int master;
+	int blackout;
+	int running;
+};
+
+static inline uint32_t
+snapshot_read_begin(const struct snapshot *s) {
+	uint32_t seq;
+	while((seq = __atomic_load_n(&s->sequence, __ATOMIC_ACQUIRE)) & 1) {
+		; // the daemon is writing, which takes a microsecond
+	}
+	return seq;
+}
+
+static inline int
+snapshot_read_retry(const struct snapshot *s, uint32_t seq) {
+	__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	return __atomic_load_n(&s->sequence, __ATOMIC_RELAXED) != seq;
+}
+
+void init_snapshot(void);
+void snapshot_publish(const unsigned char *frame, int channels, const struct snapshot_meta *meta);
+
+#endif
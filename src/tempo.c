@@ -0,0 +1,204 @@
+#define _POSIX_C_SOURCE 200112L
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "tempo.h"
+
+static double
+seconds_between(const struct timespec *from, const struct timespec *to) {
+	return (to->tv_sec - from->tv_sec) + (to->tv_nsec - from->tv_nsec) / 1e9;
+}
+
+static void
+add_seconds(struct timespec *ts, double seconds) {
+	double whole = floor(seconds);
+	ts->tv_sec += (time_t)whole;
+	ts->tv_nsec += (long)((seconds - whole) * 1e9);
+	ts->tv_sec += ts->tv_nsec / 1000000000L;
+	ts->tv_nsec %= 1000000000L;
+}
+
+static double
+clamp_bpm(double bpm) {
+	if(bpm < TEMPO_MIN_BPM) {
+		return TEMPO_MIN_BPM;
+	} else if(bpm > TEMPO_MAX_BPM) {
+		return TEMPO_MAX_BPM;
+	}
+	return bpm;
+}
+
+void
+tempo_init(struct tempo *t, double bpm, const struct timespec *now) {
+	memset(t, 0, sizeof(*t));
+	t->bpm = clamp_bpm(bpm);
+	t->ref = *now;
+}
+
+double
+tempo_beat(const struct tempo *t, const struct timespec *now) {
+	double dt = seconds_between(&t->ref, now);
+	double pos = t->beat + dt * t->bpm / 60;
+	if(t->slew_time > 0 && dt > 0) {
+		pos += t->slew * (dt >= t->slew_time ? 1 : dt / t->slew_time);
+	}
+	return pos;
+}
+
+/*
+ * When the beat position reaches beat; now if that has already happened.
+ */
+void
+tempo_time_of(const struct tempo *t, double beat, const struct timespec *now, struct timespec *out) {
+	double rate = t->bpm / 60;
+	double dt;
+	if(beat <= tempo_beat(t, now)) {
+		*out = *now;
+		return;
+	}
+	if(t->slew_time > 0 && beat <= t->beat + t->slew_time * rate + t->slew) {
+		dt = (beat - t->beat) / (rate + t->slew / t->slew_time);
+	} else if(t->slew_time > 0) {
+		dt = t->slew_time + (beat - t->beat - t->slew_time * rate - t->slew) / rate;
+	} else {
+		dt = (beat - t->beat) / rate;
+	}
+	*out = t->ref;
+	add_seconds(out, dt);
+	// rounded down to whole nanoseconds it can fall just short of the beat
+	for(int i = 0; 16 > i && beat > tempo_beat(t, out); i++) {
+		if(++out->tv_nsec == 1000000000L) {
+			out->tv_sec++;
+			out->tv_nsec = 0;
+		}
+	}
+}
+
+/*
+ * Move the reference point to now, keeping the position and what is left of
+ * the correction.
+ */
+static void
+rebase(struct tempo *t, const struct timespec *now) {
+	double dt = seconds_between(&t->ref, now);
+	t->beat = tempo_beat(t, now);
+	if(t->slew_time > 0 && dt < t->slew_time) {
+		if(dt > 0) {
+			t->slew -= t->slew * dt / t->slew_time;
+			t->slew_time -= dt;
+		}
+	} else {
+		t->slew = 0;
+		t->slew_time = 0;
+	}
+	t->ref = *now;
+}
+
+/*
+ * A correction in progress keeps its length in beats: at the old length in
+ * seconds, a slower tempo could be outrun by a negative correction and run
+ * the clock backwards.
+ */
+void
+tempo_set_bpm(struct tempo *t, double bpm, const struct timespec *now) {
+	double old = t->bpm;
+	rebase(t, now);
+	t->bpm = clamp_bpm(bpm);
+	t->slew_time *= old / t->bpm;
+}
+
+/*
+ * Shift the phase by beats, spread out over the next beat. The correction
+ * is limited to half a beat either way, so the clock never runs backwards.
+ */
+void
+tempo_adjust_phase(struct tempo *t, double beats, const struct timespec *now) {
+	rebase(t, now);
+	t->slew += beats;
+	if(t->slew > 0.5) {
+		t->slew = 0.5;
+	} else if(t->slew < -0.5) {
+		t->slew = -0.5;
+	}
+	t->slew_time = 60 / t->bpm;
+}
+
+/*
+ * Move the position forward by beats at once.
+ */
+void
+tempo_jump(struct tempo *t, double beats, const struct timespec *now) {
+	rebase(t, now);
+	t->beat += beats;
+}
+
+/*
+ * Follow an external clock: take over its tempo and steer the position
+ * towards its position within one beat. Differences of more than half a
+ * beat are jumped over; returns 1 if that happened.
+ */
+int
+tempo_sync(struct tempo *t, double beat, double bpm, const struct timespec *now) {
+	rebase(t, now);
+	t->bpm = clamp_bpm(bpm);
+	if(fabs(beat - t->beat) > 0.5) {
+		t->beat = beat;
+		t->slew = 0;
+		t->slew_time = 0;
+		return 1;
+	}
+	t->slew = beat - t->beat;
+	t->slew_time = 60 / t->bpm;
+	return 0;
+}
+
+static int
+compare_doubles(const void *a, const void *b) {
+	double x = *(const double *)a, y = *(const double *)b;
+	return (x > y) - (x < y);
+}
+
+/*
+ * Register a tap. The tempo is estimated from the intervals between the
+ * recent taps, ignoring intervals that are more than 25% off the median.
+ * Every tap also pulls the phase towards having a beat on the tap.
+ */
+void
+tempo_tap(struct tempo *t, const struct timespec *now) {
+	double intervals[TEMPO_MAX_TAPS - 1], sorted[TEMPO_MAX_TAPS - 1];
+	double median, sum = 0, pos;
+	int i, n, used = 0;
+
+	if(t->ntaps > 0 && seconds_between(&t->taps[t->ntaps - 1], now) > TEMPO_TAP_TIMEOUT) {
+		t->ntaps = 0;
+	}
+	if(t->ntaps == TEMPO_MAX_TAPS) {
+		memmove(t->taps, t->taps + 1, (TEMPO_MAX_TAPS - 1) * sizeof(struct timespec));
+		t->ntaps--;
+	}
+	t->taps[t->ntaps++] = *now;
+
+	n = t->ntaps - 1;
+	if(n > 0) {
+		for(i = 0; n > i; i++) {
+			intervals[i] = seconds_between(&t->taps[i], &t->taps[i + 1]);
+		}
+		memcpy(sorted, intervals, n * sizeof(double));
+		qsort(sorted, n, sizeof(double), compare_doubles);
+		median = sorted[n / 2];
+		for(i = 0; n > i; i++) {
+			if(fabs(intervals[i] - median) <= median / 4) {
+				sum += intervals[i];
+				used++;
+			}
+		}
+		if(used > 0 && sum > 0) {
+			tempo_set_bpm(t, 60 * used / sum, now);
+			printf("tempo: %.1f BPM from %d taps\n", t->bpm, used + 1);
+		}
+	}
+
+	pos = tempo_beat(t, now);
+	tempo_adjust_phase(t, floor(pos + 0.5) - pos, now);
+}
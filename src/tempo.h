@@ -0,0 +1,35 @@
+#ifndef TEMPO_H
+#define TEMPO_H
+
+#include <time.h>
+
+#define TEMPO_MAX_TAPS		8
+#define TEMPO_TAP_TIMEOUT	2.0	// seconds without a tap start a new series
+#define TEMPO_MIN_BPM		30
+#define TEMPO_MAX_BPM		300
+
+/*
+ * Beat clock: the beat position grows at bpm/60 beats per second. Changing
+ * the tempo keeps the position continuous, and phase corrections are spread
+ * over one beat instead of being applied as a jump.
+ */
+struct tempo {
+	double bpm;
+	struct timespec ref;
+	double beat;		// position at ref
+	double slew;		// correction still to be applied, in beats
+	double slew_time;	// seconds from ref over which slew is applied
+	struct timespec taps[TEMPO_MAX_TAPS];
+	int ntaps;
+};
+
+void tempo_init(struct tempo *t, double bpm, const struct timespec *now);
+double tempo_beat(const struct tempo *t, const struct timespec *now);
+void tempo_time_of(const struct tempo *t, double beat, const struct timespec *now, struct timespec *out);
+void tempo_set_bpm(struct tempo *t, double bpm, const struct timespec *now);
+void tempo_adjust_phase(struct tempo *t, double beats, const struct timespec *now);
+void tempo_jump(struct tempo *t, double beats, const struct timespec *now);
+int tempo_sync(struct tempo *t, double beat, double bpm, const struct timespec *now);
+void tempo_tap(struct tempo *t, const struct timespec *now);
+
+#endif
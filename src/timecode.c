@@ -0,0 +1,154 @@
+#define _POSIX_C_SOURCE 200112L
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "timecode.h"
+
+static const int mtc_rates[4] = { 24, 25, 30, 30 }; // 29.97 drop frame runs as 30
+
+static struct keyframe *keyframes = NULL;
+static int nkeyframes = 0, allocated = 0;
+
+static double
+seconds_between(const struct timespec *from, const struct timespec *to) {
+	return (to->tv_sec - from->tv_sec) + (to->tv_nsec - from->tv_nsec) / 1e9;
+}
+
+void
+mtc_init(struct mtc *m) {
+	memset(m, 0, sizeof(*m));
+	m->fps = 25;
+}
+
+/*
+ * Returns 1 when the piece completed a new time. Piece 7 arrives 7/4 frames
+ * after the frame the pieces describe.
+ */
+int
+mtc_quarter_frame(struct mtc *m, unsigned char data, const struct timespec *now) {
+	int piece = data >> 4;
+	int hh, mm, ss, ff;
+	m->last = *now;
+	if(piece == 0) {
+		m->received = 0;
+	}
+	m->pieces[piece] = data & 0x0f;
+	m->received |= 1 << piece;
+	if(piece != 7 || m->received != 0xff) {
+		return 0;
+	}
+	ff = m->pieces[0] | m->pieces[1] << 4;
+	ss = m->pieces[2] | m->pieces[3] << 4;
+	mm = m->pieces[4] | m->pieces[5] << 4;
+	hh = m->pieces[6] | (m->pieces[7] & 0x01) << 4;
+	m->fps = mtc_rates[(m->pieces[7] >> 1) & 0x03];
+	m->seconds = hh * 3600 + mm * 60 + ss + (ff + 1.75) / m->fps;
+	m->at = *now;
+	m->locked = 1;
+	m->moving = 1;
+	return 1;
+}
+
+/*
+ * Full frame message, sent after a locate while the transport is stopped.
+ */
+void
+mtc_full_frame(struct mtc *m, const unsigned char *hmsf, const struct timespec *now) {
+	m->fps = mtc_rates[(hmsf[0] >> 5) & 0x03];
+	m->seconds = (hmsf[0] & 0x1f) * 3600 + hmsf[1] * 60 + hmsf[2] + (double)hmsf[3] / m->fps;
+	m->at = *now;
+	m->received = 0;
+	m->locked = 1;
+	m->moving = 0;
+}
+
+int
+mtc_running(const struct mtc *m, const struct timespec *now) {
+	return m->moving && MTC_TIMEOUT >= seconds_between(&m->last, now);
+}
+
+double
+mtc_time(const struct mtc *m, const struct timespec *now) {
+	if(!mtc_running(m, now)) {
+		return m->seconds;
+	}
+	return m->seconds + seconds_between(&m->at, now);
+}
+
+void
+clear_keyframes(void) {
+	nkeyframes = 0;
+}
+
+/*
+ * Insert a keyframe, replacing one at the same time. Returns its index.
+ */
+int
+add_keyframe(unsigned long ms, int step, int bpm) {
+	int lo = 0, hi = nkeyframes;
+	while(hi > lo) {
+		int mid = (lo + hi) / 2;
+		if(keyframes[mid].ms < ms) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+	if(nkeyframes > lo && keyframes[lo].ms == ms) {
+		keyframes[lo].step = step;
+		keyframes[lo].bpm = bpm;
+		return lo;
+	}
+	if(nkeyframes == allocated) {
+		allocated = allocated ? allocated * 2 : 16;
+		keyframes = realloc(keyframes, allocated * sizeof(struct keyframe));
+		assert(keyframes != NULL);
+	}
+	memmove(keyframes + lo + 1, keyframes + lo, (nkeyframes - lo) * sizeof(struct keyframe));
+	keyframes[lo].ms = ms;
+	keyframes[lo].step = step;
+	keyframes[lo].bpm = bpm;
+	nkeyframes++;
+	return lo;
+}
+
+int
+keyframe_count(void) {
+	return nkeyframes;
+}
+
+const struct keyframe *
+get_keyframe(int n) {
+	return (n >= 0 && nkeyframes > n) ? &keyframes[n] : NULL;
+}
+
+/*
+ * Program position in steps at the given show time, not wrapped around the
+ * program length. Without keyframes, the program starts at time 0 and runs
+ * at default_bpm.
+ */
+double
+timecode_position(double seconds, double steps_per_beat, double default_bpm, double *bpm) {
+	int lo = 0, hi = nkeyframes;
+	double from = 0, step = 0;
+	*bpm = default_bpm;
+	// last keyframe at or before the time
+	while(hi > lo) {
+		int mid = (lo + hi) / 2;
+		if(keyframes[mid].ms <= seconds * 1000) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+	if(lo > 0) {
+		from = keyframes[lo - 1].ms / 1000.0;
+		step = keyframes[lo - 1].step;
+		*bpm = keyframes[lo - 1].bpm;
+	}
+	if(seconds < from) {
+		return step;
+	}
+	return step + (seconds - from) * *bpm / 60 * steps_per_beat;
+}
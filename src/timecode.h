@@ -0,0 +1,48 @@
+#ifndef TIMECODE_H
+#define TIMECODE_H
+
+#include <time.h>
+
+#define MTC_TIMEOUT	0.2	// seconds without quarter frames: timecode stopped
+
+/*
+ * MIDI Timecode reader. Quarter frames carry the time in eight pieces, so a
+ * complete time comes in every two frames; in between, the time is
+ * extrapolated from the wall clock while quarter frames keep coming in.
+ */
+struct mtc {
+	unsigned char pieces[8];
+	int received;		// bit mask of the pieces received since piece 0
+	int fps;
+	double seconds;		// last complete time
+	struct timespec at;	// when it was received
+	struct timespec last;	// when the last quarter frame was received
+	int locked;		// a time has been received
+	int moving;		// it came from quarter frames
+};
+
+void mtc_init(struct mtc *m);
+int mtc_quarter_frame(struct mtc *m, unsigned char data, const struct timespec *now);
+void mtc_full_frame(struct mtc *m, const unsigned char *hmsf, const struct timespec *now);
+int mtc_running(const struct mtc *m, const struct timespec *now);
+double mtc_time(const struct mtc *m, const struct timespec *now);
+
+/*
+ * Timecode map: the program position as a function of the show time. Each
+ * keyframe puts the program at a step at a time, after which it runs on at
+ * the keyframe's tempo until the next keyframe. Keyframes are kept sorted,
+ * so a time is looked up with a binary search.
+ */
+struct keyframe {
+	unsigned long ms;
+	int step;
+	int bpm;
+};
+
+void clear_keyframes(void);
+int add_keyframe(unsigned long ms, int step, int bpm);
+int keyframe_count(void);
+const struct keyframe *get_keyframe(int n);
+double timecode_position(double seconds, double steps_per_beat, double default_bpm, double *bpm);
+
+#endif
@@ -0,0 +1,128 @@
+#include <assert.h>
+#include <string.h>
+#include "timerwheel.h"
+
+#define TW_MASK (TW_SLOTS - 1)
+#define TW_RANGE(level) (1UL << (TW_BITS * ((level) + 1)))
+
+void
+timerwheel_init(struct timerwheel *tw, unsigned long now) {
+	memset(tw, 0, sizeof(*tw));
+	tw->now = now;
+}
+
+void
+timer_init(struct timer *t, timer_callback_t callback, void *arg) {
+	t->next = NULL;
+	t->pprev = NULL;
+	t->callback = callback;
+	t->arg = arg;
+}
+
+static void
+link_timer(struct timerwheel *tw, struct timer *t) {
+	unsigned long delta = t->expires - tw->now;
+	struct timer **slot;
+	int level;
+
+	if((long)delta < 0) {
+		// already expired, fire on the next tick
+		slot = &tw->slots[0][tw->now & TW_MASK];
+	} else {
+		for(level = 0; TW_LEVELS - 1 > level; level++) {
+			if(delta < TW_RANGE(level)) {
+				break;
+			}
+		}
+		if(delta >= TW_RANGE(TW_LEVELS - 1)) {
+			// too far ahead; it fires at the end of the wheel's range
+			t->expires = tw->now + TW_RANGE(TW_LEVELS - 1) - 1;
+		}
+		slot = &tw->slots[level][(t->expires >> (TW_BITS * level)) & TW_MASK];
+	}
+
+	t->next = *slot;
+	if(t->next != NULL) {
+		t->next->pprev = &t->next;
+	}
+	t->pprev = slot;
+	*slot = t;
+}
+
+static void
+unlink_timer(struct timer *t) {
+	*t->pprev = t->next;
+	if(t->next != NULL) {
+		t->next->pprev = t->pprev;
+	}
+	t->next = NULL;
+	t->pprev = NULL;
+}
+
+void
+timer_add(struct timerwheel *tw, struct timer *t, unsigned long expires) {
+	if(timer_pending(t)) {
+		timer_del(tw, t);
+	}
+	t->expires = expires;
+	link_timer(tw, t);
+	tw->pending++;
+}
+
+void
+timer_del(struct timerwheel *tw, struct timer *t) {
+	if(!timer_pending(t)) {
+		return;
+	}
+	unlink_timer(t);
+	tw->pending--;
+}
+
+/*
+ * Move all timers of one slot of a higher wheel down to where they belong
+ * now. Returns the index of that slot, so the caller knows whether the next
+ * wheel up has to be cascaded as well.
+ */
+static int
+cascade(struct timerwheel *tw, int level) {
+	int index = (tw->now >> (TW_BITS * level)) & TW_MASK;
+	struct timer *t = tw->slots[level][index];
+	tw->slots[level][index] = NULL;
+	while(t != NULL) {
+		struct timer *next = t->next;
+		link_timer(tw, t);
+		t = next;
+	}
+	return index;
+}
+
+/*
+ * Advance the wheel to now, running the callback of every timer that expires
+ * on the way. Callbacks may add and delete timers.
+ */
+void
+timerwheel_advance(struct timerwheel *tw, unsigned long now) {
+	while((long)(now - tw->now) >= 0) {
+		int level, index = tw->now & TW_MASK;
+		struct timer *t;
+
+		if(tw->pending == 0) {
+			tw->now = now + 1;
+			break;
+		}
+		if(index == 0) {
+			for(level = 1; TW_LEVELS > level; level++) {
+				if(cascade(tw, level) != 0) {
+					break;
+				}
+			}
+		}
+
+		while((t = tw->slots[0][index]) != NULL) {
+			unlink_timer(t);
+			tw->pending--;
+			t->callback(t);
+		}
+		tw->now++;
+	}
+}
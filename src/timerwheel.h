@@ -0,0 +1,43 @@
+#ifndef TIMERWHEEL_H
+#define TIMERWHEEL_H
+
+/*
+ * Hierarchical timer wheel: TW_LEVELS wheels of TW_SLOTS slots each. Adding
+ * and removing a timer is O(1), and advancing the wheel by one tick is O(1)
+ * apart from the occasional cascade of one slot into the wheel below.
+ * Times are in ticks; the caller decides how long a tick is.
+ */
+
+#define TW_BITS		6
+#define TW_SLOTS	(1 << TW_BITS)
+#define TW_LEVELS	4
+
+struct timer;
+typedef void (*timer_callback_t)(struct timer *);
+
+struct timer {
+	struct timer *next;
+	struct timer **pprev;
+	unsigned long expires;
+	timer_callback_t callback;
+	void *arg;
+};
+
+struct timerwheel {
+	unsigned long now;
+	int pending;
+	struct timer *slots[TW_LEVELS][TW_SLOTS];
+};
+
+void timerwheel_init(struct timerwheel *tw, unsigned long now);
+void timer_init(struct timer *t, timer_callback_t callback, void *arg);
+void timer_add(struct timerwheel *tw, struct timer *t, unsigned long expires);
+void timer_del(struct timerwheel *tw, struct timer *t);
+void timerwheel_advance(struct timerwheel *tw, unsigned long now);
+
+static inline int
+timer_pending(const struct timer *t) {
+	return t->pprev != NULL;
+}
+
+#endif
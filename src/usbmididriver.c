@@ -32,10 +32,14 @@ usbmidi_read_data(void *_ctx, const unsigned char *buffer, int len) {
 				}
 			}
 			break;
+		case 0xf1:
+			cmdlen = 2;
+			break;
+		case 0xf2:
+			cmdlen = 3;
+			break;
 		default:
-			printf("Wat de fuck is %02x?\n", buffer[0]);
-			midi_print_buf("buffer: ", buffer, len);
-			abort();
+			return midi_skip_message(buffer, len);
 	}
 	if(cmdlen > len) {
 		printf("Not enough data for %02x: %d of %d\n", buffer[0], len, cmdlen);
@@ -50,8 +54,18 @@ usbmidi_read_data(void *_ctx, const unsigned char *buffer, int len) {
 			}
 			midi_changed(buffer[1], buffer[2]);
 			break;
+		case 0xf1:
+			midi_quarter_frame(buffer[1]);
+			break;
+		case 0xf2:
+			midi_song_position(buffer[1] + buffer[2] * 128);
+			break;
 		case 0xf0:
 			assert(buffer[cmdlen-1] == 0xf7);
+			// MTC full frame: f0 7f <device> 01 01 hh mm ss ff f7
+			if(cmdlen == 10 && buffer[1] == 0x7f && buffer[3] == 0x01 && buffer[4] == 0x01) {
+				midi_full_frame(buffer + 5);
+			}
 			break;
 	}
 	return cmdlen;
@@ -0,0 +1,271 @@
+#include <assert.h>
+#include <string.h>
+#include <strings.h>
+#include <stdlib.h>
+#include "schaeckeling.h"
+#include "websocket.h"
+
+#define WS_GUID "258EAFA5-E914-47DA-95CA-C5AB0DC85B11"
+
+void
+websocket_init(struct websocket *ws) {
+	memset(ws, 0, sizeof(struct websocket));
+}
+
+/*
+ * Compare a header name, case insensitive, and return its value with the
+ * surrounding blanks taken off, or NULL if it is another header.
+ */
+static const char *
+header_value(const char *line, size_t len, const char *name, size_t *vlen) {
+	size_t n = strlen(name);
+	if(len <= n || strncasecmp(line, name, n) != 0 || line[n] != ':') {
+		return NULL;
+	}
+	line += n + 1;
+	len -= n + 1;
+	while(len > 0 && (*line == ' ' || *line == '\t')) {
+		line++;
+		len--;
+	}
+	while(len > 0 && (line[len - 1] == ' ' || line[len - 1] == '\t')) {
+		len--;
+	}
+	*vlen = len;
+	return line;
+}
+
+static int
+contains_token(const char *value, size_t len, const char *token) {
+	size_t n = strlen(token);
+	for(size_t i = 0; i + n <= len; i++) {
+		if(strncasecmp(value + i, token, n) == 0) {
+			return 1;
+		}
+	}
+	return 0;
+}
+
+/*
+ * Take one line of the upgrade request, without its line ending. Returns 0
+ * while more lines are needed, 1 after the empty line ending a valid
+ * request, -1 for a request that is not a WebSocket upgrade and -2 for an
+ * unsupported protocol version.
+ */
+int
+websocket_request_line(struct websocket *ws, const char *line, size_t len) {
+	const char *value;
+	size_t vlen;
+
+	if(!ws->request_seen) {
+		if(len < 4 || strncmp(line, "GET ", 4) != 0) {
+			return -1;
+		}
+		ws->request_seen = 1;
+		return 0;
+	}
+	if(len == 0) {
+		if(!ws->upgrade || ws->key[0] == '\0') {
+			return -1;
+		}
+		return ws->version == 13 ? 1 : -2;
+	}
+	if((value = header_value(line, len, "Upgrade", &vlen)) != NULL) {
+		ws->upgrade = contains_token(value, vlen, "websocket");
+	} else if((value = header_value(line, len, "Sec-WebSocket-Key", &vlen)) != NULL) {
+		if(vlen == 0 || vlen >= sizeof(ws->key)) {
+			return -1;
+		}
+		memcpy(ws->key, value, vlen);
+		ws->key[vlen] = '\0';
+	} else if((value = header_value(line, len, "Sec-WebSocket-Version", &vlen)) != NULL) {
+		ws->version = vlen == 2 && value[0] == '1' && value[1] == '3' ? 13 : -1;
+	}
+	return 0;
+}
+
+#define ROL(x, n) (((x) << (n)) | ((x) >> (32 - (n))))
+
+static void
+sha1_block(uint32_t *h, const unsigned char *p) {
+	uint32_t w[80], a, b, c, d, e, f, k, t;
+	int i;
+
+	for(i = 0; 16 > i; i++) {
+		w[i] = (uint32_t)p[4 * i] << 24 | (uint32_t)p[4 * i + 1] << 16 | (uint32_t)p[4 * i + 2] << 8 | p[4 * i + 3];
+	}
+	for(; 80 > i; i++) {
+		w[i] = ROL(w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16], 1);
+	}
+	a = h[0]; b = h[1]; c = h[2]; d = h[3]; e = h[4];
+	for(i = 0; 80 > i; i++) {
+		if(i < 20) {
+			f = (b & c) | (~b & d);
+			k = 0x5A827999;
+		} else if(i < 40) {
+			f = b ^ c ^ d;
+			k = 0x6ED9EBA1;
+		} else if(i < 60) {
+			f = (b & c) | (b & d) | (c & d);
+			k = 0x8F1BBCDC;
+		} else {
+			f = b ^ c ^ d;
+			k = 0xCA62C1D6;
+		}
+		t = ROL(a, 5) + f + e + k + w[i];
+		e = d; d = c; c = ROL(b, 30); b = a; a = t;
+	}
+	h[0] += a; h[1] += b; h[2] += c; h[3] += d; h[4] += e;
+}
+
+static void
+sha1(const unsigned char *data, size_t len, unsigned char *digest) {
+	uint32_t h[5] = { 0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476, 0xC3D2E1F0 };
+	unsigned char block[64];
+	size_t i, rest;
+
+	for(i = 0; i + 64 <= len; i += 64) {
+		sha1_block(h, data + i);
+	}
+	rest = len - i;
+	memcpy(block, data + i, rest);
+	block[rest++] = 0x80;
+	if(rest > 56) {
+		memset(block + rest, 0, 64 - rest);
+		sha1_block(h, block);
+		rest = 0;
+	}
+	memset(block + rest, 0, 56 - rest);
+	for(i = 0; 8 > i; i++) {
+		block[63 - i] = (uint64_t)len * 8 >> (8 * i);
+	}
+	sha1_block(h, block);
+	for(i = 0; 20 > i; i++) {
+		digest[i] = h[i / 4] >> (24 - 8 * (i % 4));
+	}
+}
+
+static void
+base64(const unsigned char *data, size_t len, char *out) {
+	static const char alphabet[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+	size_t i;
+	for(i = 0; i + 2 < len; i += 3) {
+		*out++ = alphabet[data[i] >> 2];
+		*out++ = alphabet[(data[i] & 3) << 4 | data[i + 1] >> 4];
+		*out++ = alphabet[(data[i + 1] & 15) << 2 | data[i + 2] >> 6];
+		*out++ = alphabet[data[i + 2] & 63];
+	}
+	if(i < len) {
+		*out++ = alphabet[data[i] >> 2];
+		if(i + 1 < len) {
+			*out++ = alphabet[(data[i] & 3) << 4 | data[i + 1] >> 4];
+			*out++ = alphabet[(data[i + 1] & 15) << 2];
+		} else {
+			*out++ = alphabet[(data[i] & 3) << 4];
+			*out++ = '=';
+		}
+		*out++ = '=';
+	}
+	*out = '\0';
+}
+
+/*
+ * Sec-WebSocket-Accept for a key: base64 of the SHA-1 of the key and the
+ * protocol GUID. accept must hold WS_ACCEPT_LEN + 1 characters.
+ */
+void
+websocket_accept(const char *key, char *accept) {
+	unsigned char buf[sizeof(((struct websocket *)0)->key) + sizeof(WS_GUID)];
+	unsigned char digest[20];
+	size_t len = strlen(key);
+
+	assert(len + sizeof(WS_GUID) <= sizeof(buf));
+	memcpy(buf, key, len);
+	memcpy(buf + len, WS_GUID, sizeof(WS_GUID) - 1);
+	sha1(buf, len + sizeof(WS_GUID) - 1, digest);
+	base64(digest, sizeof(digest), accept);
+}
+
+/*
+ * Returns the length of the frame header at buf, 0 if it is not complete
+ * yet, or -1 if it is invalid.
+ */
+int
+websocket_parse_header(const unsigned char *buf, size_t len, struct websocket_frame *f) {
+	size_t need = 2;
+	int i;
+
+	if(len < 2) {
+		return 0;
+	}
+	if(buf[0] & 0x70) {
+		return -1; // no extensions were negotiated
+	}
+	f->fin = buf[0] >> 7;
+	f->opcode = buf[0] & 0x0F;
+	f->masked = buf[1] >> 7;
+	f->len = buf[1] & 0x7F;
+	if(f->len == 126) {
+		need += 2;
+	} else if(f->len == 127) {
+		need += 8;
+	}
+	if(f->masked) {
+		need += 4;
+	}
+	if(len < need) {
+		return 0;
+	}
+	if(f->len == 126) {
+		f->len = buf[2] << 8 | buf[3];
+		i = 4;
+	} else if(f->len == 127) {
+		f->len = 0;
+		for(i = 2; 10 > i; i++) {
+			f->len = f->len << 8 | buf[i];
+		}
+	} else {
+		i = 2;
+	}
+	if(f->masked) {
+		memcpy(f->mask, buf + i, 4);
+	}
+	if(f->opcode >= WS_OP_CLOSE && (!f->fin || f->len > WS_CONTROL_MAX)) {
+		return -1;
+	}
+	return need;
+}
+
+/*
+ * Write the header of an unmasked frame, as a server sends them, and return
+ * its length.
+ */
+size_t
+websocket_header(unsigned char *buf, int opcode, uint64_t len) {
+	buf[0] = 0x80 | opcode;
+	if(len < 126) {
+		buf[1] = len;
+		return 2;
+	}
+	if(len <= 0xFFFF) {
+		buf[1] = 126;
+		buf[2] = len >> 8;
+		buf[3] = len;
+		return 4;
+	}
+	buf[1] = 127;
+	for(int i = 0; 8 > i; i++) {
+		buf[9 - i] = len >> (8 * i);
+	}
+	return 10;
+}
+
+void
+websocket_unmask(unsigned char *buf, size_t len, const unsigned char *mask, int *maskpos) {
+	int m = *maskpos;
+	for(size_t i = 0; len > i; i++) {
+		buf[i] ^= mask[m];
+		m = (m + 1) & 3;
+	}
+	*maskpos = m;
+}
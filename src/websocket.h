@@ -0,0 +1,56 @@
+#ifndef WEBSOCKET_H
+#define WEBSOCKET_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define WEBSOCKET_PORT		1338
+
+#define WS_OP_CONTINUATION	0x0
+#define WS_OP_TEXT		0x1
+#define WS_OP_BINARY		0x2
+#define WS_OP_CLOSE		0x8
+#define WS_OP_PING		0x9
+#define WS_OP_PONG		0xA
+
+#define WS_HEADER_MAX		14	// with a 64 bit length and a mask
+#define WS_CONTROL_MAX		125	// payload of a control frame
+#define WS_ACCEPT_LEN		28	// base64 of a SHA-1 hash
+
+/*
+ * A WebSocket connection (RFC 6455) carries the same commands and replies
+ * as a plain one, as binary messages. Data frames from the client are
+ * treated as one stream of command bytes, so a command may be split over
+ * frames and a frame may hold many commands.
+ */
+struct websocket {
+	// the HTTP upgrade request
+	int request_seen;
+	int upgrade;
+	int version;
+	char key[32];		// Sec-WebSocket-Key
+	int skipping;		// discarding a header line too long to matter
+
+	// frames from the client
+	size_t decoded;		// unmasked command bytes at the start of inbuf
+	uint64_t remaining;	// payload left in the current data frame
+	unsigned char mask[4];
+	int maskpos;
+};
+
+struct websocket_frame {
+	int fin;
+	int opcode;
+	int masked;
+	unsigned char mask[4];
+	uint64_t len;
+};
+
+void websocket_init(struct websocket *ws);
+int websocket_request_line(struct websocket *ws, const char *line, size_t len);
+void websocket_accept(const char *key, char *accept);
+int websocket_parse_header(const unsigned char *buf, size_t len, struct websocket_frame *f);
+size_t websocket_header(unsigned char *buf, int opcode, uint64_t len);
+void websocket_unmask(unsigned char *buf, size_t len, const unsigned char *mask, int *maskpos);
+
+#endif